@@ -21,6 +21,7 @@ enum ParameterType {
     IS_DOUBLE,
     IS_INT,
     IS_UINT,
+    IS_ATOMIC_FLOAT,
 };
 
 struct Parameter {
@@ -34,6 +35,8 @@ struct Parameter {
     void* value;        // void pointer to the variable holding the value
     bool isStepped;     // is parameter toggled or use integer steps 
     int type;           // controller type 0 = float, 1 = double, 2 = int32_t, 3 = uint32_t,
+                        // 4 = std::atomic<float>
+    bool isReadOnly;    // output only parameter, reported to the host but never set by it
 };
 
 class Params {
@@ -61,7 +64,7 @@ public:
                     double min, double max, double def, double step,
                     void* value, bool isStepped, int type) {
         int id = static_cast<int>(parameter.size());
-        Parameter p = {id, name, group, min, max, def, step, value, isStepped, type};
+        Parameter p = {id, name, group, min, max, def, step, value, isStepped, type, false};
         parameter.push_back(p);
     }
 
@@ -70,7 +73,15 @@ public:
                     double min, double max, double def, double step,
                     void* value, bool isStepped, int type) {
         int id = static_cast<int>(parameter.size());
-        Parameter p = {id, name, group, min, max, def, step, value, isStepped, type};
+        Parameter p = {id, name, group, min, max, def, step, value, isStepped, type, false};
+        parameter.push_back(p);
+    }
+
+    // register a variable as read only parameter (output from the engine)
+    void registerReadOnlyParam(std::string name, std::string group,
+                    double min, double max, void* value, int type) {
+        int id = static_cast<int>(parameter.size());
+        Parameter p = {id, name, group, min, max, min, 0.0, value, false, type, true};
         parameter.push_back(p);
     }
 
@@ -79,6 +90,7 @@ public:
         uint32_t count = parameter.size();
         for (uint32_t i = 0; i < count; i++) {
             const auto& def = parameter[i];
+            if (def.isReadOnly) continue;
             setParam(i, def.def);
         }
         // inform the GUI thread that parameters was changed by the host
@@ -100,6 +112,9 @@ public:
         } else if (parameter[idx].type == IS_UINT) {
             uint32_t* pvalue = static_cast<uint32_t*>(parameter[idx].value);
             return (double)*pvalue;
+        } else if (parameter[idx].type == IS_ATOMIC_FLOAT) {
+            std::atomic<float>* pvalue = static_cast<std::atomic<float>*>(parameter[idx].value);
+            return (double)pvalue->load(std::memory_order_relaxed);
         }
         return 0.0;
     }
@@ -107,6 +122,7 @@ public:
     // set the parameter value as double
     void setParam(int idx, double value) {
         if (idx >= static_cast<int>(parameter.size())) return;
+        if (parameter[idx].isReadOnly) return;
         if (parameter[idx].type == Is_FLOAT) {
             float* pvalue = static_cast<float*>(parameter[idx].value);
             *pvalue = static_cast<float>(value);
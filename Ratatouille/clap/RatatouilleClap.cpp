@@ -31,8 +31,10 @@ typedef struct {
     clap_plugin_t plugin;
     const clap_host_t *host;
     Ratatouille *r;
+    bool stereo;
     bool guiIsCreated;
     uint32_t latency;
+    bool restartRequested;
     uint32_t width;
     uint32_t height;
 } ratatouille_plugin_t;
@@ -61,6 +63,7 @@ static bool params_get_info(const clap_plugin_t* plugin, uint32_t param_index, c
     param_info->max_value = def.max;
     uint32_t flags = CLAP_PARAM_IS_AUTOMATABLE;
     if (def.isStepped) flags |= CLAP_PARAM_IS_STEPPED;
+    if (def.isReadOnly) flags = CLAP_PARAM_IS_READONLY;
     param_info->flags = flags;
     param_info->cookie = nullptr;
     return true;
@@ -155,12 +158,13 @@ static uint32_t audio_ports_count(const clap_plugin_t *plugin, bool is_input) {
 }
 
 static bool audio_ports_get(const clap_plugin_t *plugin, uint32_t index, bool is_input, clap_audio_port_info_t *info) {
+    ratatouille_plugin_t *plug = (ratatouille_plugin_t *)plugin->plugin_data;
     if (index > 0) return false;
     info->id = index;
     snprintf(info->name, sizeof(info->name), "%s", is_input ? "Input" : "Output");
-    if (is_input) {
-        info->channel_count = 1; // Mono
-        info->port_type = CLAP_PORT_MONO;
+    if (plug->stereo) {
+        info->channel_count = 2; // Stereo
+        info->port_type = CLAP_PORT_STEREO;
     } else {
         info->channel_count = 1; // Mono
         info->port_type = CLAP_PORT_MONO;
@@ -182,6 +186,7 @@ static const clap_plugin_audio_ports_t audio_ports = {
 static uint32_t ratatouille_latency_get(const clap_plugin_t *plugin) {
     ratatouille_plugin_t *plug = (ratatouille_plugin_t *)plugin->plugin_data;
     plug->r->getLatency(&plug->latency);
+    plug->restartRequested = false;
     return plug->latency;
 }
 
@@ -385,6 +390,14 @@ static clap_process_status ratatouille_process(const clap_plugin_t *plugin, cons
 
     float *input = process->audio_inputs[0].data32[0]; // Mono input channel
     float *output = process->audio_outputs[0].data32[0]; // Mono output
+    // right channel in stereo mode
+    float *input1 = nullptr;
+    float *output1 = nullptr;
+    if (plug->stereo && process->audio_inputs[0].channel_count > 1 &&
+                        process->audio_outputs[0].channel_count > 1) {
+        input1 = process->audio_inputs[0].data32[1];
+        output1 = process->audio_outputs[0].data32[1];
+    }
     uint32_t nframes = process->frames_count;
     const uint32_t nev = process->in_events->size(process->in_events);
     uint32_t ev_index = 0;
@@ -416,8 +429,19 @@ static clap_process_status ratatouille_process(const clap_plugin_t *plugin, cons
     // in-place processing
     if(output != input)
         memcpy(output, input, nframes*sizeof(float));
+    if(output1 && output1 != input1)
+        memcpy(output1, input1, nframes*sizeof(float));
     
-    plug->r->process(nframes, output);
+    plug->r->process(nframes, output, output1);
+
+    // the buffered mode changed the latency, the host needs to re-activate
+    // the plugin to pick up the new value
+    uint32_t latency = 0;
+    plug->r->getLatency(&latency);
+    if (latency != plug->latency && !plug->restartRequested) {
+        plug->restartRequested = true;
+        plug->host->request_restart(plug->host);
+    }
     return CLAP_PROCESS_CONTINUE;
 }
 
@@ -429,6 +453,7 @@ static bool ratatouille_activate(const struct clap_plugin *plugin,
                              uint32_t                  max_frames_count) {
     ratatouille_plugin_t *plug = (ratatouille_plugin_t *)plugin->plugin_data;
     //if (sample_rate != 48000) 
+    plug->r->setMaxBufferSize(max_frames_count);
     plug->r->initEngine(sample_rate, 25, 1);
     return true;
 }
@@ -455,6 +480,19 @@ static const clap_plugin_descriptor_t ratatouille_descriptor = {
     .features = (const char *[]){ CLAP_PLUGIN_FEATURE_AUDIO_EFFECT, NULL },
 };
 
+static const clap_plugin_descriptor_t ratatouille_stereo_descriptor = {
+    .clap_version = CLAP_VERSION_INIT,
+    .id = "com.brummer10.Ratatouille.Stereo",
+    .name = "Ratatouille Stereo",
+    .vendor = "brummer10",
+    .url = "https://github.com/brummer10/Ratatouille",
+    .manual_url = "https://github.com/brummer10/Ratatouille",
+    .support_url = "https://github.com/brummer10/Ratatouille",
+    .version = "0.9.11",
+    .description = "CLAP plugin wrapper for Ratatouille, stereo version",
+    .features = (const char *[]){ CLAP_PLUGIN_FEATURE_AUDIO_EFFECT, CLAP_PLUGIN_FEATURE_STEREO, NULL },
+};
+
 // Extensions
 static const void *ratatouille_get_extension(const clap_plugin_t *plugin, const char *id) {
     if (!strcmp(id, CLAP_EXT_AUDIO_PORTS)) return &audio_ports;
@@ -466,14 +504,18 @@ static const void *ratatouille_get_extension(const clap_plugin_t *plugin, const
 }
 
 // Create the plugin
-static const clap_plugin_t *ratatouille_create(const clap_host_t *host) {
+static const clap_plugin_t *ratatouille_create(const clap_host_t *host, bool stereo) {
     ratatouille_plugin_t *plug = (ratatouille_plugin_t *)calloc(1, sizeof(ratatouille_plugin_t));
     if (!plug) return NULL;
     plug->r = new Ratatouille();
+    plug->stereo = stereo;
+    plug->r->setChannels(stereo ? 2 : 1);
     plug->guiIsCreated = false;
+    plug->latency = 0;
+    plug->restartRequested = false;
     plug->width = WINDOW_WIDTH;
     plug->height = WINDOW_HEIGHT;
-    plug->plugin.desc = &ratatouille_descriptor;
+    plug->plugin.desc = stereo ? &ratatouille_stereo_descriptor : &ratatouille_descriptor;
     plug->plugin.plugin_data = plug;
     plug->plugin.init = ratatouille_init;
     plug->plugin.destroy = ratatouille_destroy;
@@ -495,11 +537,12 @@ static const clap_plugin_t *ratatouille_create(const clap_host_t *host) {
  */
 
 static uint32_t plugin_factory_get_plugin_count(const struct clap_plugin_factory *factory) {
-   return 1;
+   return 2;
 }
 
 static const clap_plugin_descriptor_t *plugin_factory_get_ratatouille_descriptor
                     (const struct clap_plugin_factory *factory, uint32_t index) {
+   if (index == 1) return &ratatouille_stereo_descriptor;
    return  &ratatouille_descriptor; //s_plugins[index].desc;
 }
 
@@ -510,7 +553,8 @@ static const clap_plugin_t *plugin_factory_create_ratatouille
    if (!clap_version_is_compatible(host->clap_version)) {
       return NULL;
    }
-   return ratatouille_create(host);
+   return ratatouille_create(host, plugin_id &&
+            !strcmp(plugin_id, ratatouille_stereo_descriptor.id));
 }
 
 static const clap_plugin_factory_t plugin_factory = {
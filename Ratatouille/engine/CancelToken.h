@@ -0,0 +1,45 @@
+/*
+ * CancelToken.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** CancelToken - check if a background load was superseded
+ *
+ *  The CommandQueue count the requests per target (model slot,
+ *  IR slot). A load remember the count of the request it serve,
+ *  when a newer request for the same target is pushed, the token
+ *  is cancelled. Model and IR loaders check the token at safe
+ *  checkpoints (after parsing, while warm up, before the FFT
+ *  partitioning) and give up early.
+ *  A default token is never cancelled.
+ *
+ *  usage:
+ *      if (token && token->cancelled()) return false;
+ */
+
+#include <atomic>
+#include <cstdint>
+
+#pragma once
+
+#ifndef CANCELTOKEN_H_
+#define CANCELTOKEN_H_
+
+namespace ratatouille {
+
+struct CancelToken {
+    const std::atomic<uint32_t>*    serial = nullptr;
+    uint32_t                        expect = 0;
+
+    inline bool cancelled() const noexcept {
+        return serial && serial->load(std::memory_order_acquire) != expect;
+    }
+};
+
+} // end namespace ratatouille
+
+#endif
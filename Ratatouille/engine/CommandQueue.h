@@ -0,0 +1,321 @@
+/*
+ * CommandQueue.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** CommandQueue - real-time safe command channel to the worker
+ *
+ *  The host, the GUI or the state restore push typed commands
+ *  (load a model into slot X, load a IR file into convolver Y,
+ *  erase, change normalisation, set the model graph) to the
+ *  worker thread. A command carries the file path in a fixed
+ *  size buffer, so pushing a command never allocate and could
+ *  be done from the real-time thread. Commands of one producer
+ *  are applied in the order they were pushed, between producers
+ *  the serial of the target decide, so two requests can't
+ *  clobber each other.
+ *
+ *  Every producer thread get a own bounded single producer,
+ *  single consumer ring, so the real-time thread never wait on
+ *  a other thread. The audio thread use pushRt(), which is lock
+ *  free and return false when the ring is full, the caller keep
+ *  the request and push it again in the next period. All other
+ *  threads (GUI, state restore) use push(), they are serialised
+ *  by a mutex, the real-time thread never touch it. When the GUI
+ *  ring is full the command is kept in a backlog, so push()
+ *  never drop a command.
+ *
+ *  Each model or IR request get a serial number per target, a
+ *  newer request cancel the CancelToken of a load in flight for
+ *  the same target. Requests from the GUI could be pushed with
+ *  Command::INTERACTIVE, the worker serve them first.
+ *
+ *  usage:
+ *      // producer side, GUI or state restore
+ *      queue.push(Command::LOAD_MODEL, 0, Command::INTERACTIVE, "/path/to/model.nam");
+ *      // producer side, real-time thread
+ *      if (!queue.pushRt(Command::ERASE_IR, 0, 0)) retryNextPeriod();
+ *      // worker side
+ *      Command cmd;
+ *      while (queue.pop(cmd)) apply(cmd);
+ *
+ ****************************************************************
+ ** PathState - the currently loaded file, published by the worker
+ *
+ *  Written only by the worker thread, read lock free from any
+ *  thread (seqlock), the real-time thread copy it into a fixed
+ *  buffer, other threads could fetch it as std::string.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "CancelToken.h"
+
+#pragma once
+
+#ifndef COMMANDQUEUE_H_
+#define COMMANDQUEUE_H_
+
+namespace ratatouille {
+
+// maximal length of a file path (or graph description) including the \0
+static constexpr size_t MAX_PATH_LEN = 4096;
+
+/****************************************************************
+ ** Command - a typed message for the worker thread
+ */
+
+struct Command {
+    enum Type : uint32_t {
+        LOAD_MODEL,         // slot 0/1, value priority, path
+        ERASE_MODEL,        // slot 0/1
+        LOAD_IR,            // slot 0/1, value priority, path
+        ERASE_IR,           // slot 0/1
+        NORMALISE_IR,       // slot 0/1, value on/off
+        SET_GRAPH,          // path holds the graph description
+        INIT_BUFFER,        // nothing, just wake the worker
+    };
+
+    // priority of a load request
+    enum Priority : int32_t {
+        NORMAL = 0,         // state restore, presets
+        INTERACTIVE = 1,    // the user is browsing files in the GUI
+    };
+
+    // targets which could supersede each other
+    enum Target : int32_t {
+        NO_TARGET = -1,
+        MODEL_A,
+        MODEL_B,
+        IR_A,
+        IR_B,
+        TARGETS
+    };
+
+    Type                type;
+    uint32_t            slot;
+    int32_t             value;
+    uint32_t            serial;     // request count of the target
+    char                path[MAX_PATH_LEN];
+
+    static inline int32_t targetOf(Type type, uint32_t slot) noexcept {
+        switch (type) {
+            case LOAD_MODEL:
+            case ERASE_MODEL:
+                return slot ? MODEL_B : MODEL_A;
+            case LOAD_IR:
+            case ERASE_IR:
+            case NORMALISE_IR:
+                return slot ? IR_B : IR_A;
+            default:
+                return NO_TARGET;
+        }
+    }
+};
+
+/****************************************************************
+ ** CommandQueue - bounded queues of commands, one per producer
+ */
+
+class CommandQueue {
+public:
+    static constexpr uint32_t CAPACITY = 32;
+
+    CommandQueue() {
+        for (auto& s : serials) s.store(0, std::memory_order_relaxed);
+    }
+
+    // queue a command from a non real-time thread (GUI, state restore),
+    // never drop a command, returns false when the path doesn't fit
+    inline bool push(Command::Type type, uint32_t slot, int32_t value,
+                                    const char* path = nullptr) {
+        const size_t len = path ? strnlen(path, MAX_PATH_LEN) : 0;
+        if (len >= MAX_PATH_LEN) {
+            fprintf(stderr, "CommandQueue: path to long, dropped\n");
+            return false;
+        }
+        std::lock_guard<std::mutex> guard(uiLock);
+        // keep the order, once the backlog is used it get all commands
+        // until the worker has emptied it
+        if (backlog.empty() && ui.push(*this, type, slot, value, path, len))
+            return true;
+        backlog.emplace_back();
+        fill(backlog.back(), type, slot, value, path, len);
+        hasBacklog.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // queue a command from the real-time thread, lock free, returns false
+    // when the ring is full or the path doesn't fit, the caller should try
+    // again in the next period
+    inline bool pushRt(Command::Type type, uint32_t slot, int32_t value,
+                                    const char* path = nullptr) noexcept {
+        const size_t len = path ? strnlen(path, MAX_PATH_LEN) : 0;
+        if (len >= MAX_PATH_LEN) return false;
+        return rt.push(*this, type, slot, value, path, len);
+    }
+
+    // fetch the next command, only from the consumer (worker) thread.
+    // Commands from different producers may come out of push order, the
+    // serial tell which request for a target is the newest.
+    inline bool pop(Command& c) {
+        if (rt.pop(c)) return true;
+        if (ui.pop(c)) return true;
+        if (!hasBacklog.load(std::memory_order_acquire)) return false;
+        std::lock_guard<std::mutex> guard(uiLock);
+        if (backlog.empty()) return false;
+        copy(c, backlog.front());
+        backlog.pop_front();
+        if (backlog.empty()) hasBacklog.store(false, std::memory_order_release);
+        return true;
+    }
+
+    inline bool empty() const noexcept {
+        return rt.empty() && ui.empty() && !hasBacklog.load(std::memory_order_acquire);
+    }
+
+    // true when the serial of c is older then the last one seen,
+    // wrap around safe
+    static inline bool older(uint32_t serial, uint32_t seen) noexcept {
+        return static_cast<int32_t>(serial - seen) < 0;
+    }
+
+    // token for a load serving the given command, cancelled
+    // when a newer command for the same target is pushed
+    inline CancelToken token(const Command& c) const noexcept {
+        CancelToken t;
+        const int32_t target = Command::targetOf(c.type, c.slot);
+        if (target >= 0) {
+            t.serial = &serials[target];
+            t.expect = c.serial;
+        }
+        return t;
+    }
+
+private:
+    // a single producer, single consumer ring
+    struct Ring {
+        Command                 ring[CAPACITY];
+        std::atomic<uint32_t>   head{0};
+        std::atomic<uint32_t>   tail{0};
+
+        inline bool push(CommandQueue& q, Command::Type type, uint32_t slot,
+                        int32_t value, const char* path, size_t len) noexcept {
+            const uint32_t h = head.load(std::memory_order_relaxed);
+            if (h - tail.load(std::memory_order_acquire) >= CAPACITY) return false;
+            q.fill(ring[h % CAPACITY], type, slot, value, path, len);
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        inline bool pop(Command& c) noexcept {
+            const uint32_t t = tail.load(std::memory_order_relaxed);
+            if (t == head.load(std::memory_order_acquire)) return false;
+            copy(c, ring[t % CAPACITY]);
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        inline bool empty() const noexcept {
+            return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+        }
+    };
+
+    inline void fill(Command& c, Command::Type type, uint32_t slot,
+                    int32_t value, const char* path, size_t len) noexcept {
+        c.type = type;
+        c.slot = slot;
+        c.value = value;
+        // a newer request cancel the load in flight for the same target
+        const int32_t target = Command::targetOf(type, slot);
+        c.serial = target < 0 ? 0 :
+                serials[target].fetch_add(1, std::memory_order_acq_rel) + 1;
+        if (len) memcpy(c.path, path, len);
+        c.path[len] = '\0';
+    }
+
+    static inline void copy(Command& c, const Command& s) noexcept {
+        c.type = s.type;
+        c.slot = s.slot;
+        c.value = s.value;
+        c.serial = s.serial;
+        memcpy(c.path, s.path, strnlen(s.path, MAX_PATH_LEN - 1) + 1);
+    }
+
+    Ring                    rt;         // the real-time thread
+    Ring                    ui;         // all other threads, under uiLock
+    std::mutex              uiLock;
+    std::deque<Command>     backlog;    // GUI commands when ui is full
+    std::atomic<bool>       hasBacklog{false};
+    std::atomic<uint32_t>   serials[Command::TARGETS];
+};
+
+/****************************************************************
+ ** PathState - a published file name
+ */
+
+class PathState {
+public:
+    PathState() : seq(0) {
+        memcpy(path, "None", 5);
+    }
+
+    // publish a new file name, only from the worker thread
+    inline void set(const std::string& file) noexcept {
+        const size_t len = std::min(file.size(), MAX_PATH_LEN - 1);
+        seq.fetch_add(1, std::memory_order_acq_rel);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(path, file.data(), len);
+        path[len] = '\0';
+        seq.fetch_add(1, std::memory_order_release);
+    }
+
+    // copy the file name into buf, real-time safe,
+    // returns false when no file is loaded
+    inline bool copy(char* buf, size_t size) const noexcept {
+        if (!size) return false;
+        uint32_t s0, s1;
+        do {
+            s0 = seq.load(std::memory_order_acquire);
+            if (s0 & 1) continue;
+            strncpy(buf, path, size - 1);
+            buf[size - 1] = '\0';
+            std::atomic_thread_fence(std::memory_order_acquire);
+            s1 = seq.load(std::memory_order_relaxed);
+            if (s0 == s1) break;
+        } while (true);
+        return strcmp(buf, "None") != 0;
+    }
+
+    // get the file name as string, not real-time safe
+    inline std::string str() const {
+        std::string s(MAX_PATH_LEN, '\0');
+        copy(s.data(), MAX_PATH_LEN);
+        s.resize(strlen(s.c_str()));
+        return s;
+    }
+
+    inline bool isNone() const {
+        char buf[8];
+        return !copy(buf, sizeof(buf));
+    }
+
+private:
+    std::atomic<uint32_t>   seq;
+    char                    path[MAX_PATH_LEN];
+};
+
+}; // end namespace ratatouille
+
+#endif
@@ -0,0 +1,384 @@
+/*
+ * ConvolverPlanner.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** ConvolverPlanner - pick the partition layout by measure
+ *
+ *  Which convolver and which partition sizes run cheapest depend
+ *  on the IR length, the host block size and the CPU. When a IR is
+ *  loaded, the planner benchmark a few candidate layouts (uniform
+ *  partitions, multi level partitions with different head and level
+ *  sizes, and for short IR's at small blocks a direct FIR head with
+ *  partitioned tail) on a synthetic IR of the same length, and pick the one
+ *  with the lowest CPU load, which fit the deadline: the real-time
+ *  part of a period must stay below RT_BUDGET of the period, each
+ *  level job below JOB_BUDGET of its own block.
+ *
+ *  Like the FFTW wisdom, the plans are kept in memory and in
+ *  $XDG_CACHE_HOME/ratatouille/convolver.plans (or ~/.cache/...,
+ *  %LOCALAPPDATA% on windows), keyed by the IR length (rounded up to
+ *  a power of two), the host block size and the sample rate, so only
+ *  the first load of a new combination take the time to measure.
+ *
+ *  RATATOUILLE_PLANNER=0 disable the planner, the fixed layouts are
+ *  used then.
+ *
+ *  usage (worker thread only):
+ *      ConvolverPlan p = ConvolverPlanner::get().plan(irLength, blockSize, rate, token);
+ *      IrLayout l = p.layout();
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PartitionedConvolver.h"
+#include "CancelToken.h"
+
+#pragma once
+
+#ifndef CONVOLVER_PLANNER_H_
+#define CONVOLVER_PLANNER_H_
+
+namespace ratatouille {
+
+/****************************************************************
+ ** ConvolverPlan - the convolver to use and its partition sizes
+ */
+
+struct ConvolverPlan {
+    enum Engine : uint32_t {
+        UNIFORM = 0,    // SingleThreadConvolver
+        MULTI = 1,      // MultiThreadConvolver
+        DIRECT = 2      // DirectHeadConvolver
+    };
+    uint32_t    engine = UNIFORM;
+    uint32_t    block = 1024;   // partition size, the head size for MULTI, the FIR taps for DIRECT
+    uint32_t    maxBlock = 0;   // largest level of MULTI
+
+    IrLayout layout() const {
+        if (engine == MULTI) return IrLayout::multiLevel(block, maxBlock);
+        if (engine == DIRECT) return IrLayout::direct(block);
+        return IrLayout::uniform(block);
+    }
+
+    std::string str() const {
+        return std::to_string(engine) + " " + std::to_string(block) + " " + std::to_string(maxBlock);
+    }
+
+    bool operator==(const ConvolverPlan& o) const {
+        return engine == o.engine && block == o.block && maxBlock == o.maxBlock;
+    }
+};
+
+class ConvolverPlanner {
+public:
+    static constexpr uint32_t VERSION = 2;
+    // share of the period the real-time part of a convolver may use
+    static constexpr double RT_BUDGET = 0.25;
+    // share of its block a level job may use
+    static constexpr double JOB_BUDGET = 0.5;
+
+    static ConvolverPlanner& get() {
+        static ConvolverPlanner planner;
+        return planner;
+    }
+
+    static bool enabled() {
+        static const bool on = [] {
+            const char* env = getenv("RATATOUILLE_PLANNER");
+            return !(env && env[0] == '0');
+        }();
+        return on;
+    }
+
+    // the fixed layouts, used without planner
+    static ConvolverPlan fallback(uint32_t len, uint32_t block) {
+        ConvolverPlan p;
+        uint32_t maxSize = 16384;
+        p.block = 1024;
+        #ifdef __MOD_DEVICES__
+        maxSize = 4069;
+        p.block = 256;
+        #endif
+        if (len <= maxSize) return p;
+        p.engine = ConvolverPlan::MULTI;
+        p.block = head(block);
+        p.maxBlock = 16384;
+        #ifdef __MOD_DEVICES__
+        p.block = 128;
+        p.maxBlock = 2048;
+        #endif
+        return p;
+    }
+
+    // the plan for a IR of len samples, measured when it isn't known
+    // yet. Falls back to the fixed layout when cancelled
+    ConvolverPlan plan(uint32_t len, uint32_t block, uint32_t rate,
+                                    const CancelToken *token = nullptr) {
+        if (!enabled() || !len || !block || !rate) return fallback(len, block);
+        const uint32_t bucket = pow2(std::max(len, 1024u));
+        const std::string key = std::to_string(bucket) + "|" + std::to_string(block) +
+                                                         "|" + std::to_string(rate);
+        // plan one at a time, a concurrent request for the same key
+        // take the result
+        std::lock_guard<std::mutex> lk(mutex);
+        if (!loaded) load();
+        auto it = plans.find(key);
+        if (it != plans.end()) return it->second;
+        ConvolverPlan p;
+        if (!measure(bucket, block, rate, token, p)) return fallback(len, block);
+        plans[key] = p;
+        save();
+        return p;
+    }
+
+    static std::string cacheDir() {
+        std::string dir;
+#if defined(_WIN32)
+        if (getenv("LOCALAPPDATA")) dir = std::string(getenv("LOCALAPPDATA")) + "\\ratatouille\\";
+#else
+        if (getenv("XDG_CACHE_HOME")) dir = std::string(getenv("XDG_CACHE_HOME")) + "/ratatouille/";
+        else if (getenv("HOME")) dir = std::string(getenv("HOME")) + "/.cache/ratatouille/";
+#endif
+        return dir;
+    }
+
+private:
+    std::mutex                              mutex;
+    std::map<std::string, ConvolverPlan>    plans;
+    bool                                    loaded = false;
+
+    ConvolverPlanner() {}
+
+    static uint32_t pow2(uint32_t n) {
+        uint32_t p = 1;
+        while (p < n) p *= 2;
+        return p;
+    }
+
+    // the smallest head partition for the host block
+    static uint32_t head(uint32_t block) {
+        return pow2(std::max(block, 32u));
+    }
+
+    // the measured costs of a candidate
+    struct Cost {
+        double  cpu = 0.0;      // seconds per second of audio
+        double  rtMax = 0.0;    // worst real-time part of a period
+        bool    fits = false;
+    };
+
+    // a multi level convolver which run and time the level jobs in place
+    class Bench : public MultiLevelConvolver {
+    public:
+        std::vector<uint32_t>   blocks;
+        double                  jobTime = 0.0;
+        double                  jobOver = 0.0;
+        uint32_t                rate = 48000;
+    protected:
+        void startBackgroundProcessing(size_t level) override {
+            const auto t = std::chrono::steady_clock::now();
+            doBackgroundProcessing(level);
+            const double d = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+            jobTime += d;
+            // the share of the level deadline
+            jobOver = std::max(jobOver, d * rate / blocks[level]);
+        }
+    };
+
+    static std::vector<ConvolverPlan> candidates(uint32_t len, uint32_t block) {
+        std::vector<ConvolverPlan> c;
+        std::vector<uint32_t> uniform = {128, 256, 512, 1024, 2048};
+        std::vector<uint32_t> levels = {4096, 16384, 32768};
+        std::vector<uint32_t> taps = {64, 128, 256};
+        uint32_t uniformLimit = 65536;
+        uint32_t directLimit = 16384;
+        #ifdef __MOD_DEVICES__
+        uniform = {128, 256, 512};
+        levels = {2048, 4096};
+        taps = {32, 64, 128};
+        uniformLimit = 16384;
+        directLimit = 4096;
+        #endif
+        if (len <= uniformLimit) {
+            for (uint32_t b : uniform) c.push_back({ConvolverPlan::UNIFORM, b, 0});
+        }
+        // the FIR head pay off when the tail block span a few periods
+        if (len <= directLimit) {
+            for (uint32_t t : taps) {
+                if (t >= 4 * block) c.push_back({ConvolverPlan::DIRECT, t, 0});
+            }
+        }
+        const uint32_t h = head(block);
+        for (uint32_t hb : {h, 2 * h}) {
+            for (uint32_t m : levels) {
+                // the first level must fit into the IR
+                if (2 * hb * IrLayout::LEVEL_GROWTH >= len || hb * IrLayout::LEVEL_GROWTH > m) continue;
+                c.push_back({ConvolverPlan::MULTI, hb, m});
+            }
+        }
+        if (c.empty()) c.push_back(fallback(len, block));
+        return c;
+    }
+
+    // time the calls of a convolver which run all in the calling thread
+    template <class C>
+    static void run(C& conv, std::vector<float>& in, std::vector<float>& out,
+                            uint32_t calls, double& total, double& rtMax) {
+        const uint32_t block = in.size();
+        for (uint32_t i = 0; i < calls; i++) {
+            const auto t = std::chrono::steady_clock::now();
+            conv.process(in.data(), out.data(), block);
+            const double d = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - t).count();
+            // skip the first calls, they warm up the caches
+            if (i < 8) continue;
+            total += d;
+            rtMax = std::max(rtMax, d);
+        }
+    }
+
+    // benchmark the candidates on a decaying noise IR of len samples
+    static bool measure(uint32_t len, uint32_t block, uint32_t rate,
+                        const CancelToken *token, ConvolverPlan& best) {
+        std::mt19937 gen(len);
+        std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+        std::vector<float> ir(len);
+        for (uint32_t i = 0; i < len; i++) ir[i] = noise(gen) * std::exp(-3.0f * i / len);
+        std::vector<float> in(block), out(block);
+        for (float& v : in) v = noise(gen);
+
+        bool found = false;
+        Cost bestCost;
+        for (const ConvolverPlan& p : candidates(len, block)) {
+            if (token && token->cancelled()) return false;
+            const IrLayout layout = p.layout();
+            std::shared_ptr<const IrSpectrum> s = IrSpectrum::build(ir.data(), len, layout, token);
+            if (!s) return false;
+            // run at least two periods of the largest level
+            uint32_t largest = block;
+            for (const IrLayout::Part& lp : layout.parts) largest = std::max(largest, lp.block);
+            const uint32_t calls = std::max(4 * largest, rate / 4) / block + 8;
+            Cost c;
+            double total = 0.0;
+            double jobOver = 0.0;
+            if (p.engine == ConvolverPlan::UNIFORM) {
+                PartitionedConvolver conv;
+                conv.init(s, 0);
+                run(conv, in, out, calls, total, c.rtMax);
+            } else if (p.engine == ConvolverPlan::DIRECT) {
+                HybridConvolver conv;
+                if (!conv.init(s)) continue;
+                run(conv, in, out, calls, total, c.rtMax);
+            } else {
+                Bench conv;
+                conv.init(s);
+                conv.rate = rate;
+                for (size_t k = 1; k < layout.parts.size(); k++) conv.blocks.push_back(layout.parts[k].block);
+                for (uint32_t i = 0; i < calls; i++) {
+                    const double j0 = conv.jobTime;
+                    const auto t = std::chrono::steady_clock::now();
+                    conv.process(in.data(), out.data(), block);
+                    const double d = std::chrono::duration<double>(
+                                        std::chrono::steady_clock::now() - t).count();
+                    if (i < 8) {
+                        conv.jobOver = 0.0;
+                        continue;
+                    }
+                    const double job = conv.jobTime - j0;
+                    total += d;
+                    // the level jobs run in there own threads
+                    c.rtMax = std::max(c.rtMax, d - job);
+                }
+                jobOver = conv.jobOver;
+            }
+            const double audio = double(calls - 8) * block / rate;
+            const double period = double(block) / rate;
+            c.cpu = total / audio;
+            c.fits = c.rtMax <= RT_BUDGET * period && jobOver <= JOB_BUDGET;
+            // the cheapest plan which fit, else the one with the lowest peak
+            if (!found || (c.fits && (!bestCost.fits || c.cpu < bestCost.cpu)) ||
+                    (!c.fits && !bestCost.fits && c.rtMax < bestCost.rtMax)) {
+                best = p;
+                bestCost = c;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    std::string cachePath() const {
+        const std::string dir = cacheDir();
+        return dir.empty() ? dir : dir + "convolver.plans";
+    }
+
+    // the header tag the plans to the version and the machine
+    static std::string tag() {
+        return "ratatouille-plans " + std::to_string(VERSION) + " " +
+                std::to_string(std::thread::hardware_concurrency());
+    }
+
+    void load() {
+        loaded = true;
+        const std::string path = cachePath();
+        if (path.empty()) return;
+        std::ifstream f(path);
+        std::string line;
+        if (!f || !std::getline(f, line) || line != tag()) return;
+        while (std::getline(f, line)) {
+            std::istringstream l(line);
+            std::string key;
+            ConvolverPlan p;
+            if (!(l >> key >> p.engine >> p.block >> p.maxBlock)) continue;
+            if (p.engine > ConvolverPlan::DIRECT || !p.block) continue;
+            plans[key] = p;
+        }
+    }
+
+    void save() {
+        const std::string path = cachePath();
+        if (path.empty()) return;
+        std::error_code ec;
+        std::filesystem::create_directories(cacheDir(), ec);
+        const std::string tmp = path + "." + std::to_string(std::hash<std::thread::id>()(
+                                                    std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::trunc);
+            if (!f) return;
+            f << tag() << "\n";
+            for (auto& e : plans) f << e.first << " " << e.second.str() << "\n";
+            if (!f) {
+                f.close();
+                std::filesystem::remove(tmp, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(tmp, path, ec);
+        if (ec) {
+            fprintf(stderr, "ConvolverPlanner: unable to write %s\n", path.c_str());
+            std::filesystem::remove(tmp, ec);
+        }
+    }
+};
+
+} // end namespace ratatouille
+
+#endif
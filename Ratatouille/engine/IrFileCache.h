@@ -0,0 +1,225 @@
+/*
+ * IrFileCache.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** IrFileCache - prepared IR spectra on disk
+ *
+ *  Preparing a IR (read, resample at quality 32, normalise, FFT
+ *  of every partition) dominate the load time of long room IRs.
+ *  When a IR was prepared the first time, the IrStore write the
+ *  spectrum to $XDG_CACHE_HOME/ratatouille/irs (or
+ *  ~/.cache/ratatouille/irs, %LOCALAPPDATA% on windows).
+ *  Later loads map the file and use the partitions in place.
+ *
+ *  A cache file is named by the hash of the IR file path, the host
+ *  sample rate, the normalisation and the partition layout. The
+ *  header keep the size and the modification time of the source
+ *  file, a changed source invalidate the cached copy.
+ *
+ *  The file layout (little endian, version 1):
+ *      Header          64 bytes, see below
+ *      Part table      32 bytes per partition part
+ *      spectra         per part, split complex, aligned to 64 bytes
+ *
+ *  RATATOUILLE_IR_CACHE=0 disable the cache
+ *
+ *  usage (worker thread only):
+ *      std::shared_ptr<IrSpectrum> s = IrFileCache::load(file, rate, norm, layout);
+ *      ...
+ *      IrFileCache::store(file, rate, norm, layout, *s);
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "IrSpectrum.h"
+#include "MappedFile.h"
+
+#pragma once
+
+#ifndef IR_FILE_CACHE_H_
+#define IR_FILE_CACHE_H_
+
+namespace ratatouille {
+
+class IrFileCache {
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint64_t ALIGN = 64;
+
+    static bool enabled() {
+        static const bool on = [] {
+            const char* env = getenv("RATATOUILLE_IR_CACHE");
+            return !(env && env[0] == '0');
+        }();
+        return on;
+    }
+
+    // map the cached spectrum, nullptr when there is no valid copy
+    static std::shared_ptr<IrSpectrum> load(const std::string& source, uint32_t rate,
+                                            uint32_t norm, const IrLayout& layout) {
+        if (!enabled()) return nullptr;
+        uint64_t size;
+        int64_t time;
+        if (!sourceStat(source, size, time)) return nullptr;
+        const std::string path = cachePath(source, rate, norm, layout);
+        std::shared_ptr<MappedFile> f = std::make_shared<MappedFile>();
+        if (path.empty() || !f->open(path) || f->size < sizeof(Header)) return nullptr;
+        const Header* h = reinterpret_cast<const Header*>(f->data);
+        if (memcmp(h->magic, "RATIR", 6) != 0 || h->version != VERSION ||
+                h->rate != rate || h->norm != norm || h->layoutHash != cacheHash(layout.str()) ||
+                h->sourceSize != size || h->sourceTime != time ||
+                h->partCount != layout.parts.size() ||
+                sizeof(Header) + h->partCount * sizeof(PartEntry) > f->size)
+            return nullptr;
+        const PartEntry* pe = reinterpret_cast<const PartEntry*>(f->data + sizeof(Header));
+        std::shared_ptr<IrSpectrum> s = std::make_shared<IrSpectrum>();
+        s->length = h->length;
+        for (uint32_t i = 0; i < h->partCount; i++) {
+            IrPart p = IrSpectrum::partOf(layout.parts[i], h->length);
+            if (pe[i].block != p.block || pe[i].offset != p.offset ||
+                    pe[i].segments != p.segments || pe[i].stride != p.stride ||
+                    pe[i].dataOffset % ALIGN ||
+                    pe[i].dataOffset + 2 * uint64_t(p.segments) * p.stride * sizeof(float) > f->size)
+                return nullptr;
+            p.data = reinterpret_cast<const float*>(f->data + pe[i].dataOffset);
+            s->parts.push_back(p);
+        }
+        s->mapped = f;
+        return s;
+    }
+
+    // write the spectrum to the cache
+    static void store(const std::string& source, uint32_t rate, uint32_t norm,
+                            const IrLayout& layout, const IrSpectrum& s) {
+        if (!enabled() || s.parts.size() != layout.parts.size()) return;
+        Header h{};
+        memcpy(h.magic, "RATIR", 6);
+        h.version = VERSION;
+        h.rate = rate;
+        h.norm = norm;
+        h.length = s.length;
+        h.layoutHash = cacheHash(layout.str());
+        h.partCount = static_cast<uint32_t>(s.parts.size());
+        if (!sourceStat(source, h.sourceSize, h.sourceTime)) return;
+
+        std::vector<PartEntry> pe(s.parts.size());
+        uint64_t pos = align(sizeof(Header) + pe.size() * sizeof(PartEntry));
+        for (size_t i = 0; i < s.parts.size(); i++) {
+            const IrPart& p = s.parts[i];
+            pe[i].block = p.block;
+            pe[i].offset = p.offset;
+            pe[i].segments = p.segments;
+            pe[i].stride = p.stride;
+            pe[i].dataOffset = pos;
+            pos = align(pos + 2 * uint64_t(p.segments) * p.stride * sizeof(float));
+        }
+
+        const std::string path = cachePath(source, rate, norm, layout);
+        if (path.empty()) return;
+        std::error_code ec;
+        std::filesystem::create_directories(cacheDir(), ec);
+        const std::string tmp = path + "." + std::to_string(std::hash<std::thread::id>()(
+                                                    std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) return;
+            static const char zero[ALIGN] = {};
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            out.write(reinterpret_cast<const char*>(pe.data()), pe.size() * sizeof(PartEntry));
+            uint64_t at = sizeof(Header) + pe.size() * sizeof(PartEntry);
+            for (size_t i = 0; i < s.parts.size(); i++) {
+                out.write(zero, pe[i].dataOffset - at);
+                const size_t n = 2 * size_t(s.parts[i].segments) * s.parts[i].stride * sizeof(float);
+                out.write(reinterpret_cast<const char*>(s.parts[i].data), n);
+                at = pe[i].dataOffset + n;
+            }
+            if (!out) {
+                out.close();
+                std::filesystem::remove(tmp, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(tmp, path, ec);
+        if (ec) {
+            fprintf(stderr, "IrFileCache: unable to write %s\n", path.c_str());
+            std::filesystem::remove(tmp, ec);
+        }
+    }
+
+    static std::string cacheDir() {
+        std::string dir;
+#if defined(_WIN32)
+        if (getenv("LOCALAPPDATA")) dir = std::string(getenv("LOCALAPPDATA")) + "\\ratatouille\\irs\\";
+#else
+        if (getenv("XDG_CACHE_HOME")) dir = std::string(getenv("XDG_CACHE_HOME")) + "/ratatouille/irs/";
+        else if (getenv("HOME")) dir = std::string(getenv("HOME")) + "/.cache/ratatouille/irs/";
+#endif
+        return dir;
+    }
+
+private:
+    struct Header {
+        char        magic[8];
+        uint32_t    version;
+        uint32_t    rate;
+        uint32_t    norm;
+        uint32_t    length;
+        uint64_t    sourceSize;
+        int64_t     sourceTime;
+        uint64_t    layoutHash;
+        uint32_t    partCount;
+        uint8_t     reserved[12];
+    };
+    static_assert(sizeof(Header) == 64, "IrFileCache header must be 64 bytes");
+
+    struct PartEntry {
+        uint32_t    block;
+        uint32_t    offset;
+        uint32_t    segments;
+        uint32_t    stride;
+        uint64_t    dataOffset;
+        uint64_t    reserved;
+    };
+    static_assert(sizeof(PartEntry) == 32, "IrFileCache part entry must be 32 bytes");
+
+    static bool sourceStat(const std::string& source, uint64_t& size, int64_t& time) {
+        std::error_code ec;
+        size = std::filesystem::file_size(source, ec);
+        if (ec) return false;
+        time = std::filesystem::last_write_time(source, ec).time_since_epoch().count();
+        return !ec;
+    }
+
+    static std::string cachePath(const std::string& source, uint32_t rate,
+                                    uint32_t norm, const IrLayout& layout) {
+        const std::string dir = cacheDir();
+        if (dir.empty()) return dir;
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.ric", static_cast<unsigned long long>(
+            cacheHash(source + "|" + std::to_string(rate) + "|" + std::to_string(norm) +
+                                                            "|" + layout.str())));
+        return dir + name;
+    }
+
+    static uint64_t align(uint64_t v) {
+        return (v + ALIGN - 1) & ~(ALIGN - 1);
+    }
+};
+
+} // end namespace ratatouille
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ * IrPremix.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** IrPremix - run the two IR's as one convolution while the mix is static
+ *
+ *  The IR stage mix the output of two convolvers (conv and conv1).
+ *  When both run a short IR and the Mix control didn't move for
+ *  SETTLE_MS, the worker thread sum both spectra, weighted by the
+ *  mix, into one IrSpectrum (see IrSpectrum::mix), and the real-time
+ *  thread run this single convolution instead of the two.
+ *
+ *  A new pre-mixed convolver is fed until its delay line is filled,
+ *  then run along for a block, before the IR stage crossfade over.
+ *  Meanwhile conv and conv1 are only fed (ConvolverSelector::feed).
+ *  When the Mix move or a IR change, they run again, and after two
+ *  blocks the IR stage crossfade back. Long IR's (run by the
+ *  MultiThreadConvolver) are not pre-mixed.
+ *
+ *  The pre-mixed convolvers live in two slots, the worker thread
+ *  build the slot the real-time thread doesn't use and publish it
+ *  with a atomic index. The build never wait, when the free slot is
+ *  still faded out or a IR tail is still prepared it give up, and
+ *  the real-time thread ask again after the mix settled once more.
+ *
+ *  usage (rt):
+ *      IrPremix::Mode m = premix.begin(n, genA, genB, uniform, mix, steady);
+ *      if (worker.getState() && premix.request()) { buildWanted = true; worker.runProcess();}
+ *      if (premix.active()) premix.compute(n, in, out, channel);
+ *      if (m == IrPremix::BOTH) smooth::mix(n, twoConvolvers, out, out, premix.fader());
+ *  usage (worker thread):
+ *      premix.build(conv, conv1, rate, channels);
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "fftconvolver.h"
+#include "Smoother.h"
+
+#pragma once
+
+#ifndef IR_PREMIX_H_
+#define IR_PREMIX_H_
+
+namespace ratatouille {
+
+class IrPremix {
+public:
+    // time the mix must be static before it's pre-mixed
+    static constexpr int SETTLE_MS = 250;
+
+    enum Mode {
+        TWO,        // run conv and conv1
+        BOTH,       // run conv, conv1 and the pre-mix, crossfade by fader()
+        PREMIX      // run the pre-mix, feed conv and conv1
+    };
+
+    IrPremix() : published(-1), inUse(-1), retry(false), slot(-1), settleLen(1),
+                 still(0), warm(0), qWarm(0), lastMix(-1.0f) {
+        fade.setPole(0.995);
+        fade.reset(0.0);
+    }
+
+    // set the rate before processing (non rt)
+    void init(uint32_t rate) {
+        settleLen = std::max(1u, rate * SETTLE_MS / 1000);
+        drop();
+    }
+
+    // give up the pre-mix at once, when the IR stage doesn't run (rt)
+    inline void drop() {
+        if (slot < 0) return;
+        slot = -1;
+        fade.reset(0.0);
+        inUse.store(-1, std::memory_order_release);
+    }
+
+    // decide how the IR stage run this period. uniform is true when all
+    // convolvers run a short IR, steady when the mix smoother is idle (rt)
+    inline Mode begin(uint32_t n, uint32_t genA, uint32_t genB, bool uniform,
+                                                    float mix, bool steady) {
+        // the last build gave up, request it again when the mix settled
+        if (retry.exchange(false, std::memory_order_acquire)) {
+            requested = Key();
+            still = 0;
+        }
+        if (mix != lastMix) {
+            lastMix = mix;
+            still = 0;
+        } else still = std::min(still + n, settleLen);
+        current = {genA, genB, mix, true};
+        const int pub = published.load(std::memory_order_acquire);
+        ok = uniform && steady;
+        wanted = ok && still >= settleLen && !(pub >= 0 && info[pub] == current) &&
+                                                            !(requested == current);
+        if (slot < 0) {
+            if (!ok || pub < 0 || !(info[pub] == current)) return TWO;
+            slot = pub;
+            warm = 0;
+            qWarm = 0;
+            inUse.store(slot, std::memory_order_release);
+        }
+        const uint32_t block = conv[slot][0].getBlockSize();
+        if (ok && info[slot] == current) {
+            // fill the delay line, run along a block, then fade over
+            warm = std::min(warm + n, (conv[slot][0].getSegmentCount() + 3) * block);
+            if (warm <= (conv[slot][0].getSegmentCount() + 1) * block) return TWO;
+            if (warm > (conv[slot][0].getSegmentCount() + 2) * block) fade.setTarget(1.0);
+            if (fade.isSteady() && fade.value() == 1.0f) {
+                qWarm = 0;
+                return PREMIX;
+            }
+            qWarm += n;
+            return BOTH;
+        }
+        // conv and conv1 take over again
+        if (fade.isSteady() && fade.value() == 0.0f) {
+            drop();
+            return TWO;
+        }
+        qWarm += n;
+        if (qWarm >= 2 * block) fade.setTarget(0.0);
+        return BOTH;
+    }
+
+    // true when the worker thread should build a new pre-mix, the
+    // request is taken when the worker thread is idle (rt)
+    inline bool request() {
+        if (!wanted) return false;
+        req = current;
+        requested = current;
+        wanted = false;
+        return true;
+    }
+
+    // true when the slot in use must be computed or fed (rt)
+    inline bool active() const { return slot >= 0;}
+
+    // run the pre-mix of the channel, or feed it while it warm up (rt)
+    inline void compute(uint32_t n, float* input, float* output, uint32_t channel) {
+        PartitionedConvolver& c = conv[slot][channel];
+        if (warm <= (c.getSegmentCount() + 1) * c.getBlockSize()) c.feed(input, n);
+        else c.process(input, output, n);
+    }
+
+    // crossfade from the two convolvers (0) to the pre-mix (1)
+    inline Smoother& fader() { return fade;}
+
+    // build the requested pre-mix from the published banks of a and b
+    // into the free slot (worker thread)
+    void build(ConvolverSelector& a, ConvolverSelector& b, uint32_t rate, uint32_t channels) {
+        const Key k = req;
+        const int s = published.load(std::memory_order_acquire) == 0 ? 1 : 0;
+        // the real-time thread may still fade out from the free slot
+        if (inUse.load(std::memory_order_acquire) == s) {
+            retry.store(true, std::memory_order_release);
+            return;
+        }
+        std::string fa, fb;
+        uint32_t na, nb, ga, gb;
+        IrLayout la, lb;
+        if (!a.getSource(fa, na, la, ga) || !b.getSource(fb, nb, lb, gb) ||
+                ga != k.genA || gb != k.genB) return;
+        // both uniform, the larger partitions were planned for the longer IR.
+        // the spectrum in the own layout is shared with conv or conv1
+        const IrLayout layout = la.parts[0].block >= lb.parts[0].block ? la : lb;
+        std::shared_ptr<const IrSpectrum> sa = IrStore::get().acquire(fa, rate, na, layout);
+        std::shared_ptr<const IrSpectrum> sb = IrStore::get().acquire(fb, rate, nb, layout);
+        if (!sa || !sb) return;
+        // the tail of a resampled IR may be still prepared
+        if (!sa->complete() || !sb->complete()) {
+            retry.store(true, std::memory_order_release);
+            return;
+        }
+        std::shared_ptr<const IrSpectrum> m = IrSpectrum::mix(*sa, 1.0f - k.mix, *sb, k.mix, layout);
+        if (!m) return;
+        for (uint32_t c = 0; c < 2; c++) {
+            if (c < channels) conv[s][c].init(m, 0);
+            else conv[s][c].reset();
+        }
+        info[s] = k;
+        published.store(s, std::memory_order_release);
+    }
+
+private:
+    struct Key {
+        uint32_t    genA = 0;
+        uint32_t    genB = 0;
+        float       mix = 0.0f;
+        bool        valid = false;
+
+        bool operator==(const Key& o) const {
+            return valid && o.valid && genA == o.genA && genB == o.genB && mix == o.mix;
+        }
+    };
+
+    PartitionedConvolver    conv[2][2];
+    Key                     info[2];
+    // the published slot, written by the worker thread
+    std::atomic<int>        published;
+    // the slot used by the real-time thread
+    std::atomic<int>        inUse;
+    // the request, written by the real-time thread while the worker is idle
+    Key                     req;
+    // set by the worker thread when the build gave up for now
+    std::atomic<bool>       retry;
+
+    // real-time thread state
+    int                     slot;
+    Key                     current;
+    Key                     requested;
+    Smoother                fade;
+    uint32_t                settleLen;
+    uint32_t                still;
+    uint32_t                warm;
+    uint32_t                qWarm;
+    float                   lastMix;
+    bool                    ok = false;
+    bool                    wanted = false;
+};
+
+} // end namespace ratatouille
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ * IrSpectrum.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** IrSpectrum - prepared IR partitions shared by all convolvers
+ *
+ *  A IR file is read, reduced to the first channel, resampled to
+ *  the host rate, normalised and split into uniform partitions,
+ *  which are transformed to the frequency domain. A published
+ *  partition is immutable and shared by all convolvers which use
+ *  the same file at the same rate, normalisation and layout, in one
+ *  instance (conv, conv1, the stereo channels, the graph) or in
+ *  all instances of the process. The convolvers only keep there
+ *  input delay lines and accumulators.
+ *
+ *  IrLayout describe the partitions: a list of parts, each with
+ *  its partition size, the first IR sample it covers and the
+ *  count of samples (0 = up to the end of the IR).
+ *
+ *  The spectra are managed by the IrStore (see IrStore.h).
+ *
+ *  usage (worker thread only):
+ *      std::vector<float> ir;
+ *      if (IrSource::load(file, rate, norm, ir))
+ *          spectrum = IrSpectrum::build(ir.data(), ir.size(), IrLayout::uniform(1024));
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sndfile.hh>
+
+#include "AudioFFT.h"
+#include "gx_resampler.h"
+#include "CancelToken.h"
+#include "MappedFile.h"
+
+#pragma once
+
+#ifndef IR_SPECTRUM_H_
+#define IR_SPECTRUM_H_
+
+namespace ratatouille {
+
+/****************************************************************
+ ** IrLayout - the partition layout of a IR
+ */
+
+struct IrLayout {
+    struct Part {
+        uint32_t    block;      // partition size, the FFT size is 2 * block
+        uint32_t    offset;     // first IR sample of the part
+        uint32_t    length;     // count of IR samples, 0 = up to the end
+    };
+    std::vector<Part> parts;
+
+    // all partitions of the same size
+    static IrLayout uniform(uint32_t block) {
+        IrLayout l;
+        l.parts.push_back({block, 0, 0});
+        return l;
+    }
+
+    // the layout used by the multi level convolver: the head run the
+    // IR up to 2 * B1 with the small partitions, each level k the IR
+    // from 2 * Bk up to the next level, the block sizes grow by LEVEL_GROWTH
+    // up to maxBlock, the last level run up to the end
+    static constexpr uint32_t LEVEL_GROWTH = 4;
+    static IrLayout multiLevel(uint32_t head, uint32_t maxBlock) {
+        IrLayout l;
+        uint32_t block = head * LEVEL_GROWTH;
+        uint32_t offset = 2 * block;
+        l.parts.push_back({head, 0, offset});
+        for (;;) {
+            const uint32_t next = block * LEVEL_GROWTH;
+            if (next > maxBlock) {
+                l.parts.push_back({block, offset, 0});
+                break;
+            }
+            l.parts.push_back({block, offset, 2 * next - offset});
+            offset = 2 * next;
+            block = next;
+        }
+        return l;
+    }
+
+    // the layout used by the hybrid convolver: the first taps samples
+    // in one segment, they are run as direct FIR, the rest in
+    // partitions of the same size
+    static IrLayout direct(uint32_t taps) {
+        IrLayout l;
+        l.parts.push_back({taps, 0, taps});
+        l.parts.push_back({taps, taps, 0});
+        return l;
+    }
+
+    std::string str() const {
+        std::string s;
+        for (const Part& p : parts) {
+            s += std::to_string(p.block) + "@" + std::to_string(p.offset) +
+                                           "+" + std::to_string(p.length) + ",";
+        }
+        return s;
+    }
+};
+
+/****************************************************************
+ ** IrPart - one uniform partitioned part of a IR in the frequency domain
+ *
+ *  The spectra are stored as split complex (re, im), each array
+ *  aligned to 64 bytes, segment s start at data + 2 * s * stride.
+ */
+
+struct IrPart {
+    uint32_t        block = 0;
+    uint32_t        offset = 0;
+    uint32_t        segments = 0;
+    uint32_t        complexSize = 0;
+    uint32_t        stride = 0;
+    const float*    data = nullptr;
+
+    inline const float* re(uint32_t s) const { return data + 2 * s * stride;}
+    inline const float* im(uint32_t s) const { return data + (2 * s + 1) * stride;}
+};
+
+/****************************************************************
+ ** IrSpectrum - the prepared partitions of a IR file
+ *
+ *  The partitions could be transformed progressive, the count of
+ *  ready segments of each part is published with release order.
+ *  Convolvers read it once per block, so the tail partitions
+ *  come in at block boundaries while they are prepared.
+ */
+
+struct IrSpectrum {
+    static constexpr uint32_t ALIGN = 16; // in floats
+
+    std::string             key;
+    uint32_t                length = 0; // IR samples at the host rate
+    std::vector<IrPart>     parts;
+    // the partitions live in storage, or in a mapped cache file
+    std::vector<float>      storage;
+    std::shared_ptr<const MappedFile> mapped;
+    // count of transformed segments per part
+    std::unique_ptr<std::atomic<uint32_t>[]> ready;
+
+    size_t bytes() const {
+        size_t n = 0;
+        for (const IrPart& p : parts) n += 2 * static_cast<size_t>(p.segments) * p.stride;
+        return n * sizeof(float);
+    }
+
+    inline uint32_t readySegments(size_t p) const {
+        return ready ? ready[p].load(std::memory_order_acquire) : parts[p].segments;
+    }
+
+    bool complete() const {
+        for (size_t p = 0; p < parts.size(); p++) {
+            if (readySegments(p) < parts[p].segments) return false;
+        }
+        return true;
+    }
+
+    static uint32_t align(uint32_t n) { return (n + ALIGN - 1) & ~(ALIGN - 1);}
+
+    // the dimensions of a part for a IR of len samples
+    static IrPart partOf(const IrLayout::Part& lp, uint32_t len) {
+        IrPart p;
+        p.block = lp.block;
+        p.offset = lp.offset;
+        const uint32_t end = lp.length ? std::min(len, lp.offset + lp.length) : len;
+        const uint32_t plen = end > lp.offset ? end - lp.offset : 0;
+        p.segments = (plen + lp.block - 1) / lp.block;
+        p.complexSize = static_cast<uint32_t>(audiofft::AudioFFT::ComplexSize(2 * lp.block));
+        p.stride = align(p.complexSize);
+        return p;
+    }
+
+    // allocate the partitions for a IR of len samples, nothing is
+    // transformed yet
+    static std::shared_ptr<IrSpectrum> create(uint32_t len, const IrLayout& layout) {
+        std::shared_ptr<IrSpectrum> s = std::make_shared<IrSpectrum>();
+        s->length = len;
+        size_t total = ALIGN;
+        for (const IrLayout::Part& lp : layout.parts) {
+            const IrPart p = partOf(lp, len);
+            total += 2 * static_cast<size_t>(p.segments) * p.stride;
+            s->parts.push_back(p);
+        }
+        s->storage.assign(total, 0.0f);
+        float* base = s->storage.data();
+        base += (ALIGN - (reinterpret_cast<uintptr_t>(base) / sizeof(float)) % ALIGN) % ALIGN;
+        for (IrPart& p : s->parts) {
+            p.data = base;
+            base += 2 * static_cast<size_t>(p.segments) * p.stride;
+        }
+        s->ready.reset(new std::atomic<uint32_t>[s->parts.size()]);
+        for (size_t p = 0; p < s->parts.size(); p++) s->ready[p].store(0);
+        return s;
+    }
+
+    // transform the next segments of part p, up to segment end, and
+    // publish them. returns false when the part is complete
+    bool transform(const float* ir, size_t p, uint32_t end, audiofft::AudioFFT& fft,
+                                                    std::vector<float>& buf) {
+        IrPart& pt = parts[p];
+        uint32_t i = ready[p].load(std::memory_order_relaxed);
+        end = std::min(end, pt.segments);
+        if (i >= end) return i < pt.segments;
+        fft.init(2 * pt.block);
+        buf.resize(2 * pt.block);
+        float* d = const_cast<float*>(pt.data);
+        for (; i < end; i++) {
+            const uint32_t pos = pt.offset + i * pt.block;
+            const uint32_t n = std::min(pt.block, length - pos);
+            std::fill(buf.begin(), buf.end(), 0.0f);
+            memcpy(buf.data(), ir + pos, n * sizeof(float));
+            fft.fft(buf.data(), d + 2 * i * pt.stride, d + (2 * i + 1) * pt.stride);
+        }
+        ready[p].store(end, std::memory_order_release);
+        return end < pt.segments;
+    }
+
+    // the weighted sum a * ga + b * gb of two complete spectra with the
+    // same layout. The transform is linear, so a convolution with the
+    // sum equals the mix of the convolutions with a and b.
+    // returns nullptr when the layouts doesn't match
+    static std::shared_ptr<IrSpectrum> mix(const IrSpectrum& a, float ga,
+                        const IrSpectrum& b, float gb, const IrLayout& layout) {
+        if (!a.complete() || !b.complete()) return nullptr;
+        for (const IrSpectrum* src : {&a, &b}) {
+            if (src->parts.size() != layout.parts.size()) return nullptr;
+            for (size_t p = 0; p < layout.parts.size(); p++) {
+                if (src->parts[p].block != layout.parts[p].block) return nullptr;
+            }
+        }
+        std::shared_ptr<IrSpectrum> s = create(std::max(a.length, b.length), layout);
+        for (size_t p = 0; p < s->parts.size(); p++) {
+            IrPart& pt = s->parts[p];
+            float* d = const_cast<float*>(pt.data);
+            for (const IrSpectrum* src : {&a, &b}) {
+                const IrPart& sp = src->parts[p];
+                const float g = src == &a ? ga : gb;
+                const uint32_t n = std::min(sp.segments, pt.segments);
+                for (uint32_t i = 0; i < 2 * n; i++) {
+                    const float* x = sp.data + i * sp.stride;
+                    float* y = d + i * pt.stride;
+                    for (uint32_t j = 0; j < pt.complexSize; j++) y[j] += g * x[j];
+                }
+            }
+            s->ready[p].store(pt.segments, std::memory_order_release);
+        }
+        return s;
+    }
+
+    // partition the IR and transform all partitions, returns nullptr
+    // when the token was cancelled
+    static std::shared_ptr<IrSpectrum> build(const float* ir, uint32_t len,
+                        const IrLayout& layout, const CancelToken *token = nullptr) {
+        std::shared_ptr<IrSpectrum> s = create(len, layout);
+        std::vector<float> buf;
+        audiofft::AudioFFT fft;
+        for (size_t p = 0; p < s->parts.size(); p++) {
+            for (uint32_t i = 0; i < s->parts[p].segments; i += 64) {
+                if (token && token->cancelled()) return nullptr;
+                s->transform(ir, p, i + 64, fft, buf);
+            }
+        }
+        return s;
+    }
+};
+
+/****************************************************************
+ ** IrSource - read, resample and normalise a IR file
+ */
+
+class IrSource {
+public:
+    static constexpr int LIMIT = 2000000; // arbitrary size limit
+
+    // read the first channel of the file at the given sample rate
+    static bool load(const std::string& fname, uint32_t samplerate, uint32_t norm,
+                                                        std::vector<float>& ir) {
+        SF_INFO info;
+        memset(&info, 0, sizeof(info));
+        SNDFILE* sf = sf_open(fname.c_str(), SFM_READ, &info);
+        if (!sf) {
+            fprintf(stderr, "Unable to open %s\n", fname.c_str() );
+            return false;
+        }
+        int asize = static_cast<int>(info.frames);
+        if (asize > LIMIT) {
+            fprintf(stderr, "too many samples (%i), truncated to %i\n", asize, LIMIT);
+            asize = LIMIT;
+        }
+        if (asize * info.channels == 0) {
+            fprintf(stderr, "No samples found\n");
+            sf_close(sf);
+            return false;
+        }
+        float* cbuffer = new float[asize * info.channels];
+        if (sf_readf_float(sf, cbuffer, asize) != asize) {
+            delete[] cbuffer;
+            fprintf(stderr, "Error reading file\n");
+            sf_close(sf);
+            return false;
+        }
+        sf_close(sf);
+        if (info.channels > 1) {
+            float *abuffer = new float[asize];
+            for (int i = 0; i < asize; i++) {
+                abuffer[i] = cbuffer[i * info.channels];
+            }
+            delete[] cbuffer;
+            cbuffer = abuffer;
+        }
+        if (static_cast<uint32_t>(info.samplerate) != samplerate) {
+            gx_resample::BufferResampler resamp;
+            float* rbuffer = resamp.process(info.samplerate, asize, cbuffer, samplerate, &asize);
+            if (!rbuffer) {
+                delete[] cbuffer;
+                fprintf(stderr, "Unable to resample %s\n", fname.c_str());
+                return false;
+            }
+            cbuffer = rbuffer;
+        }
+        ir.assign(cbuffer, cbuffer + asize);
+        delete[] cbuffer;
+        normalize(ir.data(), asize, norm);
+        return true;
+    }
+
+    static void normalize(float* buffer, int asize, uint32_t norm) {
+        float gain = 0.0;
+        float peak = 0.0;
+        // get normalization peak
+        for (int i = 0; i < asize; i++) {
+            peak = std::max(peak, std::abs( buffer[i])) ;
+        }
+        // apply normalize factor and get gain factor
+        if (peak != 0.0) {
+            peak = 0.8 / peak;
+            for (int i = 0; i < asize; i++) {
+               buffer[i] *= peak;
+
+               double v = buffer[i] ;
+               gain += v*v;
+            }
+        }
+        // apply gain square root factor when needed
+        if (gain != 0.0) {
+            if (!norm) gain = 1.5 / gain;
+            else gain = 1.0 / gain;
+
+            for (int i = 0; i < asize; i++) {
+                buffer[i] *= gain;
+            }
+        }
+    }
+};
+
+} // end namespace ratatouille
+
+#endif
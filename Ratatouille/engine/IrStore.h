@@ -0,0 +1,228 @@
+/*
+ * IrStore.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** IrStore - process wide store of prepared IR spectra
+ *
+ *  All convolvers get there IR partitions from here. A spectrum
+ *  is keyed by the IR file path, its modification time, the host
+ *  sample rate, the normalisation and the partition layout.
+ *  The store hold weak references, the spectra are freed when the
+ *  last convolver release them. When two convolvers request the
+ *  same spectrum at once, the second one wait for the first one.
+ *  A spectrum not in use is taken from the IrFileCache, or
+ *  prepared from the IR file and written to the IrFileCache.
+ *
+ *  Preparing is progressive: the partitions of the first HEAD
+ *  samples are transformed before acquire() return, so the
+ *  convolver could start at once, the tail partitions are
+ *  transformed by a background thread and picked up by the
+ *  convolvers at block boundaries. When all convolvers released
+ *  the spectrum while the tail is prepared, the work is dropped.
+ *
+ *  usage (worker thread only):
+ *      std::shared_ptr<const IrSpectrum> ir = IrStore::get().acquire(
+ *                          file, rate, norm, IrLayout::uniform(1024), token);
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "IrSpectrum.h"
+#include "IrFileCache.h"
+#include "CancelToken.h"
+
+#pragma once
+
+#ifndef IR_STORE_H_
+#define IR_STORE_H_
+
+namespace ratatouille {
+
+class IrStore {
+public:
+    // IR samples prepared before the convolver start
+    static constexpr uint32_t HEAD = 16384;
+    // segments transformed at once by the background thread
+    static constexpr uint32_t CHUNK = 8;
+
+    static IrStore& get() {
+        static IrStore store;
+        return store;
+    }
+
+    // the key of a IR file prepared for the given rate, normalisation
+    // and layout, a empty key when the file doesn't exist
+    static std::string makeKey(const std::string& file, uint32_t rate,
+                                    uint32_t norm, const IrLayout& layout) {
+        std::error_code ec;
+        const auto mtime = std::filesystem::last_write_time(file, ec);
+        if (ec) return std::string();
+        return file + "|" + std::to_string(mtime.time_since_epoch().count()) + "|" +
+                std::to_string(rate) + "|" + std::to_string(norm) + "|" + layout.str();
+    }
+
+    // get the prepared spectrum, build it when no convolver use it yet
+    std::shared_ptr<const IrSpectrum> acquire(const std::string& file, uint32_t rate,
+            uint32_t norm, const IrLayout& layout, const CancelToken *token = nullptr) {
+        const std::string key = makeKey(file, rate, norm, layout);
+        if (key.empty()) {
+            fprintf(stderr, "Unable to open %s\n", file.c_str() );
+            return nullptr;
+        }
+        {
+            std::unique_lock<std::mutex> lk(mutex);
+            for (;;) {
+                auto it = spectra.find(key);
+                if (it != spectra.end()) {
+                    std::shared_ptr<const IrSpectrum> s = it->second.lock();
+                    if (s) return s;
+                }
+                // a other convolver is preparing the same spectrum
+                if (!building.count(key)) break;
+                built.wait(lk);
+            }
+            building.insert(key);
+        }
+        // a prepared copy from the disk cache is used in place
+        std::shared_ptr<IrSpectrum> s = IrFileCache::load(file, rate, norm, layout);
+        std::vector<float> ir;
+        if (!s && IrSource::load(file, rate, norm, ir) && !(token && token->cancelled())) {
+            s = IrSpectrum::create(static_cast<uint32_t>(ir.size()), layout);
+            if (!prepareHead(*s, ir, token)) s.reset();
+            else if (s->complete()) IrFileCache::store(file, rate, norm, layout, *s);
+        }
+        if (s) s->key = key;
+        std::lock_guard<std::mutex> lk(mutex);
+        building.erase(key);
+        if (s) {
+            for (auto it = spectra.begin(); it != spectra.end();) {
+                if (it->second.expired()) it = spectra.erase(it);
+                else ++it;
+            }
+            spectra[key] = s;
+            // hand the tail over to the background thread
+            if (!s->complete()) {
+                jobs.push_back(Job{s, std::move(ir), file, rate, norm, layout});
+                if (!finisher.joinable()) finisher = std::thread(&IrStore::finish, this);
+                pending.notify_one();
+            }
+        }
+        built.notify_all();
+        return s;
+    }
+
+    // count of spectra in use, for information
+    size_t size() {
+        std::lock_guard<std::mutex> lk(mutex);
+        size_t n = 0;
+        for (auto& e : spectra) if (!e.second.expired()) n++;
+        return n;
+    }
+
+private:
+    struct Job {
+        std::shared_ptr<IrSpectrum> spectrum;
+        std::vector<float>          ir;
+        std::string                 file;
+        uint32_t                    rate;
+        uint32_t                    norm;
+        IrLayout                    layout;
+    };
+
+    std::mutex                                                          mutex;
+    std::condition_variable                                             built;
+    std::unordered_map<std::string, std::weak_ptr<const IrSpectrum> >   spectra;
+    std::set<std::string>                                               building;
+    std::deque<Job>                                                     jobs;
+    std::condition_variable                                             pending;
+    std::thread                                                         finisher;
+    std::atomic<bool>                                                   stop;
+
+    // transform the partitions of the first HEAD samples
+    static bool prepareHead(IrSpectrum& s, const std::vector<float>& ir,
+                                                    const CancelToken *token) {
+        audiofft::AudioFFT fft;
+        std::vector<float> buf;
+        for (size_t p = 0; p < s.parts.size(); p++) {
+            const IrPart& pt = s.parts[p];
+            if (pt.offset >= HEAD) continue;
+            const uint32_t end = (HEAD - pt.offset + pt.block - 1) / pt.block;
+            for (uint32_t i = 0; i < end; i += 64) {
+                if (token && token->cancelled()) return false;
+                s.transform(ir.data(), p, std::min(end, i + 64), fft, buf);
+            }
+        }
+        return true;
+    }
+
+    // false when only the job hold the spectrum, checked under the lock,
+    // so acquire() couldn't take it meanwhile
+    bool inUse(const std::shared_ptr<IrSpectrum>& s) {
+        std::lock_guard<std::mutex> lk(mutex);
+        if (s.use_count() > 1) return true;
+        spectra.erase(s->key);
+        return false;
+    }
+
+    // the background thread, transform the tail partitions
+    void finish() {
+        audiofft::AudioFFT fft;
+        std::vector<float> buf;
+        for (;;) {
+            Job j;
+            {
+                std::unique_lock<std::mutex> lk(mutex);
+                pending.wait(lk, [this] { return stop.load() || !jobs.empty();});
+                if (stop.load()) return;
+                j = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            IrSpectrum& s = *j.spectrum;
+            bool used = true;
+            for (size_t p = 0; used && p < s.parts.size(); p++) {
+                while (s.transform(j.ir.data(), p, s.readySegments(p) + CHUNK, fft, buf)) {
+                    if (stop.load() || !inUse(j.spectrum)) {
+                        used = false;
+                        break;
+                    }
+                }
+            }
+            if (used && s.complete()) IrFileCache::store(j.file, j.rate, j.norm, j.layout, s);
+        }
+    }
+
+    IrStore() : stop(false) {}
+
+    ~IrStore() {
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            stop.store(true);
+        }
+        pending.notify_all();
+        if (finisher.joinable()) finisher.join();
+    }
+
+    IrStore(const IrStore&) = delete;
+    IrStore& operator=(const IrStore&) = delete;
+};
+
+} // end namespace ratatouille
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * MappedFile.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** MappedFile - read only view of a file, mapped when possible
+ *
+ *  Used by the disk caches to read there files without a copy.
+ *  On windows the file is read into memory instead.
+ *  cacheHash() give the disk caches a file name which is stable
+ *  between builds.
+ *
+ *  usage:
+ *      MappedFile f;
+ *      if (f.open(path)) use(f.data, f.size);
+ */
+
+#if defined(_WIN32)
+#define MINGW_STDTHREAD_REDUNDANCY_WARNING
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#pragma once
+
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+namespace ratatouille {
+
+// FNV-1a, stable between builds
+inline uint64_t cacheHash(const std::string& s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+struct MappedFile {
+    const uint8_t*          data = nullptr;
+    size_t                  size = 0;
+    std::vector<uint8_t>    copy;
+    void*                   map = nullptr;
+
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path) {
+#if defined(_WIN32)
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) return false;
+        copy.resize(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        if (!in.read(reinterpret_cast<char*>(copy.data()), copy.size())) return false;
+        data = copy.data();
+        size = copy.size();
+        return true;
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            map = nullptr;
+            return false;
+        }
+        data = static_cast<const uint8_t*>(map);
+        size = static_cast<size_t>(st.st_size);
+        return true;
+#endif
+    }
+
+    ~MappedFile() {
+#if !defined(_WIN32)
+        if (map) munmap(map, size);
+#endif
+    }
+};
+
+} // end namespace ratatouille
+
+#endif
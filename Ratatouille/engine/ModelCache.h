@@ -0,0 +1,165 @@
+/*
+ * ModelCache.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** ModelCache - process wide LRU cache of prepared neural models
+ *
+ *  When a model is replaced or cleaned up, the modeler park the
+ *  parsed and warmed up model here instead of deleting it. Loading
+ *  the same file again then only take the model back out of the
+ *  cache, the file parse and the warm up are skipped.
+ *  A cached model is owned by the cache alone, so a model is
+ *  never used by two modelers at once. When the same file is
+ *  loaded twice (stereo, or in two instances) the second load
+ *  miss and parse the file again.
+ *
+ *  The key is the file path, the modification time of the file
+ *  and the host sample rate, so a edited file is never reused.
+ *  The size of a model is estimated by the size of the file.
+ *
+ *  RATATOUILLE_MODEL_CACHE_MB=n limit the cache to n MB (default 64)
+ *  RATATOUILLE_MODEL_CACHE_MB=0 disable the cache
+ *
+ *  usage (worker thread only, never from the real-time thread):
+ *      ModelCache::Entry e;
+ *      if (ModelCache::get().take(key, e)) model = std::move(e.nam);
+ *      ...
+ *      ModelCache::get().put(key, std::move(e));
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "dsp.h"
+#include "RTNeural.h"
+
+#pragma once
+
+#ifndef MODEL_CACHE_H_
+#define MODEL_CACHE_H_
+
+namespace ratatouille {
+
+class ModelCache {
+public:
+    // a prepared model and the values derived from it while loading
+    struct Entry {
+        std::unique_ptr<nam::DSP>               nam;
+        std::unique_ptr<RTNeural::Model<float>> rtn;
+        float                                   loudness = 0.0;
+        float                                   nGain = 1.0;
+        int                                     modelSampleRate = 0;
+        int                                     phaseOffset = 0;
+        size_t                                  bytes = 0;
+    };
+
+    struct Stats {
+        uint64_t    hits;
+        uint64_t    misses;
+        size_t      bytes;
+        size_t      limit;
+        size_t      entries;
+    };
+
+    static ModelCache& get() {
+        static ModelCache cache;
+        return cache;
+    }
+
+    // build the cache key for a file at the given sample rate,
+    // returns a empty key when the file doesn't exist
+    static std::string makeKey(const std::string& file, int sampleRate) {
+        std::error_code ec;
+        const auto mtime = std::filesystem::last_write_time(file, ec);
+        if (ec) return std::string();
+        return file + "|" + std::to_string(mtime.time_since_epoch().count()) +
+                                            "|" + std::to_string(sampleRate);
+    }
+
+    // size estimate of a model file in bytes
+    static size_t fileSize(const std::string& file) {
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(file, ec);
+        return ec ? 0 : static_cast<size_t>(size);
+    }
+
+    // take a model out of the cache, returns false on a miss
+    bool take(const std::string& key, Entry& e) {
+        if (!limit || key.empty()) return false;
+        std::lock_guard<std::mutex> lk(mutex);
+        for (auto it = lru.begin(); it != lru.end(); ++it) {
+            if (it->first == key) {
+                e = std::move(it->second);
+                used -= e.bytes;
+                lru.erase(it);
+                hits++;
+                return true;
+            }
+        }
+        misses++;
+        return false;
+    }
+
+    // park a model in the cache, the least recently used models
+    // are freed when the limit is exceeded
+    void put(const std::string& key, Entry&& e) {
+        if (!limit || key.empty() || e.bytes > limit || (!e.nam && !e.rtn)) return;
+        std::list<std::pair<std::string, Entry> > evicted;
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            used += e.bytes;
+            lru.emplace_front(key, std::move(e));
+            while (used > limit) {
+                used -= lru.back().second.bytes;
+                evicted.splice(evicted.begin(), lru, std::prev(lru.end()));
+            }
+        }
+        // the evicted models are deleted here, outside the lock
+    }
+
+    Stats stats() {
+        std::lock_guard<std::mutex> lk(mutex);
+        return Stats{hits, misses, used, limit, lru.size()};
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lk(mutex);
+        lru.clear();
+        used = 0;
+    }
+
+private:
+    std::mutex                                  mutex;
+    std::list<std::pair<std::string, Entry> >   lru;
+    size_t                                      used;
+    size_t                                      limit;
+    uint64_t                                    hits;
+    uint64_t                                    misses;
+
+    ModelCache() : used(0), hits(0), misses(0) {
+        long mb = 64;
+        const char* env = getenv("RATATOUILLE_MODEL_CACHE_MB");
+        if (env && env[0]) mb = std::max(0L, strtol(env, nullptr, 10));
+        limit = static_cast<size_t>(mb) * 1024 * 1024;
+    }
+
+    ModelCache(const ModelCache&) = delete;
+    ModelCache& operator=(const ModelCache&) = delete;
+};
+
+} // end namespace ratatouille
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * ModelFileCache.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** ModelFileCache - compiled binary copies of model files on disk
+ *
+ *  *.nam, *.json and *.aidax files are text JSON, parsing the
+ *  weights from text is the most expensive part of a cold load.
+ *  After a model was loaded the first time, the modeler store a
+ *  binary copy in $XDG_CACHE_HOME/ratatouille/models (or
+ *  ~/.cache/ratatouille/models, %LOCALAPPDATA% on windows).
+ *  Later loads map the binary file and skip the text parse and
+ *  the warm up measurement.
+ *
+ *  The file layout (little endian, version 2):
+ *      Header          128 bytes, see below
+ *      source          the path of the source file, without \0
+ *      meta            CBOR, *.nam: {version, architecture, config,
+ *                      metadata}, RTNeural: the complete json
+ *      weights         *.nam only, float array aligned to 64 bytes
+ *
+ *  The header keep the size and the modification time of the
+ *  source file, a changed source invalidate the cached copy. The
+ *  source path is stored and compared as well, so two files with
+ *  the same name hash never read each others copy.
+ *  RTNeural models are kept as the complete json in CBOR, a load
+ *  still build the json tree and parse the model from it, only
+ *  the text parse is skipped.
+ *  Files are written to a temporary name and renamed, so
+ *  concurrent instances never read a half written file.
+ *
+ *  RATATOUILLE_MODEL_FILE_CACHE=0 disable the cache
+ *
+ *  usage (worker thread only):
+ *      ModelFileCache::Info info;
+ *      nam::dspData data;
+ *      if (ModelFileCache::loadNam(file, data, info)) model = nam::get_dsp(data);
+ *      ...
+ *      ModelFileCache::storeNam(file, data, info);
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dsp.h"
+#include "MappedFile.h"
+
+#pragma once
+
+#ifndef MODEL_FILE_CACHE_H_
+#define MODEL_FILE_CACHE_H_
+
+namespace ratatouille {
+
+class ModelFileCache {
+public:
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint64_t ALIGN = 64;
+
+    enum Kind : uint32_t {
+        NAM = 0,
+        RTNEURAL = 1,
+    };
+
+    // values measured while loading, stored beside the model
+    struct Info {
+        int32_t     sampleRate = 0;
+        int32_t     phaseOffset = 0;
+        float       loudness = 0.0;
+        uint32_t    hasLoudness = 0;
+    };
+
+    static bool enabled() {
+        static const bool on = [] {
+            const char* env = getenv("RATATOUILLE_MODEL_FILE_CACHE");
+            return !(env && env[0] == '0');
+        }();
+        return on;
+    }
+
+    // load the binary copy of a *.nam file, returns false when there is
+    // no valid copy
+    static bool loadNam(const std::string& source, nam::dspData& data, Info& info) {
+        MappedFile f;
+        const Header* h = open(source, NAM, f);
+        if (!h) return false;
+        try {
+            const nlohmann::json meta = nlohmann::json::from_cbor(
+                f.data + h->metaOffset, f.data + h->metaOffset + h->metaSize);
+            data.version = meta.at("version").get<std::string>();
+            data.architecture = meta.at("architecture").get<std::string>();
+            data.config = meta.at("config");
+            data.metadata = meta.at("metadata");
+        } catch (const std::exception&) {
+            return false;
+        }
+        const float* w = reinterpret_cast<const float*>(f.data + h->weightsOffset);
+        data.weights.assign(w, w + h->weightsCount);
+        data.expected_sample_rate = h->info.sampleRate;
+        info = h->info;
+        return true;
+    }
+
+    // store a binary copy of a *.nam file
+    static void storeNam(const std::string& source, const nam::dspData& data, const Info& info) {
+        if (!enabled()) return;
+        nlohmann::json meta;
+        meta["version"] = data.version;
+        meta["architecture"] = data.architecture;
+        meta["config"] = data.config;
+        meta["metadata"] = data.metadata;
+        write(source, NAM, nlohmann::json::to_cbor(meta), data.weights, info);
+    }
+
+    // load the binary copy of a RTNeural *.json / *.aidax file
+    static bool loadJson(const std::string& source, nlohmann::json& j, Info& info) {
+        MappedFile f;
+        const Header* h = open(source, RTNEURAL, f);
+        if (!h) return false;
+        try {
+            j = nlohmann::json::from_cbor(f.data + h->metaOffset,
+                                          f.data + h->metaOffset + h->metaSize);
+        } catch (const std::exception&) {
+            return false;
+        }
+        info = h->info;
+        return true;
+    }
+
+    // store a binary copy of a RTNeural *.json / *.aidax file
+    static void storeJson(const std::string& source, const nlohmann::json& j, const Info& info) {
+        if (!enabled()) return;
+        write(source, RTNEURAL, nlohmann::json::to_cbor(j), std::vector<float>(), info);
+    }
+
+    static std::string cacheDir() {
+        std::string dir;
+#if defined(_WIN32)
+        if (getenv("LOCALAPPDATA")) dir = std::string(getenv("LOCALAPPDATA")) + "\\ratatouille\\models\\";
+#else
+        if (getenv("XDG_CACHE_HOME")) dir = std::string(getenv("XDG_CACHE_HOME")) + "/ratatouille/models/";
+        else if (getenv("HOME")) dir = std::string(getenv("HOME")) + "/.cache/ratatouille/models/";
+#endif
+        return dir;
+    }
+
+private:
+    struct Header {
+        char        magic[8];
+        uint32_t    version;
+        uint32_t    kind;
+        uint64_t    sourceSize;
+        int64_t     sourceTime;
+        Info        info;
+        uint64_t    metaOffset;
+        uint64_t    metaSize;
+        uint64_t    weightsOffset;
+        uint64_t    weightsCount;
+        uint64_t    sourceOffset;
+        uint64_t    sourceLength;
+        uint8_t     reserved[32];
+    };
+    static_assert(sizeof(Header) == 128, "ModelFileCache header must be 128 bytes");
+
+    static bool sourceStat(const std::string& source, uint64_t& size, int64_t& time) {
+        std::error_code ec;
+        size = std::filesystem::file_size(source, ec);
+        if (ec) return false;
+        time = std::filesystem::last_write_time(source, ec).time_since_epoch().count();
+        return !ec;
+    }
+
+    static std::string cachePath(const std::string& source) {
+        const std::string dir = cacheDir();
+        if (dir.empty()) return dir;
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.rmc",
+            static_cast<unsigned long long>(cacheHash(source)));
+        return dir + name;
+    }
+
+    static uint64_t align(uint64_t v) {
+        return (v + ALIGN - 1) & ~(ALIGN - 1);
+    }
+
+    // map the cache file and check it against the source file
+    static const Header* open(const std::string& source, Kind kind, MappedFile& f) {
+        if (!enabled()) return nullptr;
+        uint64_t size;
+        int64_t time;
+        if (!sourceStat(source, size, time)) return nullptr;
+        const std::string path = cachePath(source);
+        if (path.empty() || !f.open(path) || f.size < sizeof(Header)) return nullptr;
+        const Header* h = reinterpret_cast<const Header*>(f.data);
+        if (memcmp(h->magic, "RATMDL", 7) != 0 || h->version != VERSION ||
+                h->kind != kind || h->sourceSize != size || h->sourceTime != time)
+            return nullptr;
+        if (h->sourceOffset + h->sourceLength > f.size ||
+                h->metaOffset + h->metaSize > f.size ||
+                h->weightsOffset + h->weightsCount * sizeof(float) > f.size)
+            return nullptr;
+        // the name hash may collide, the copy must belong to this source
+        if (h->sourceLength != source.size() ||
+                memcmp(f.data + h->sourceOffset, source.data(), source.size()) != 0)
+            return nullptr;
+        return h;
+    }
+
+    static void write(const std::string& source, Kind kind, const std::vector<uint8_t>& meta,
+                                    const std::vector<float>& weights, const Info& info) {
+        Header h{};
+        memcpy(h.magic, "RATMDL", 7);
+        h.version = VERSION;
+        h.kind = kind;
+        if (!sourceStat(source, h.sourceSize, h.sourceTime)) return;
+        h.info = info;
+        h.sourceOffset = sizeof(Header);
+        h.sourceLength = source.size();
+        h.metaOffset = h.sourceOffset + h.sourceLength;
+        h.metaSize = meta.size();
+        h.weightsOffset = align(h.metaOffset + h.metaSize);
+        h.weightsCount = weights.size();
+
+        const std::string path = cachePath(source);
+        if (path.empty()) return;
+        std::error_code ec;
+        std::filesystem::create_directories(cacheDir(), ec);
+        const std::string tmp = path + "." + std::to_string(std::hash<std::thread::id>()(
+                                                    std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) return;
+            static const char zero[ALIGN] = {};
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            out.write(source.data(), source.size());
+            out.write(reinterpret_cast<const char*>(meta.data()), meta.size());
+            out.write(zero, h.weightsOffset - h.metaOffset - h.metaSize);
+            out.write(reinterpret_cast<const char*>(weights.data()), weights.size() * sizeof(float));
+            if (!out) {
+                out.close();
+                std::filesystem::remove(tmp, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(tmp, path, ec);
+        if (ec) {
+            fprintf(stderr, "ModelFileCache: unable to write %s\n", path.c_str());
+            std::filesystem::remove(tmp, ec);
+        }
+    }
+};
+
+} // end namespace ratatouille
+
+#endif
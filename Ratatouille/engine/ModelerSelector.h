@@ -10,8 +10,10 @@
 #define MINGW_STDTHREAD_REDUNDANCY_WARNING
 #endif
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
+#include <cstdio>
 #include <unistd.h>
 #include <mutex>
 #include <cstring>
@@ -24,6 +26,9 @@
 #include "RTNeural.h"
 
 #include "gx_resampler.h"
+#include "ModelCache.h"
+#include "ModelFileCache.h"
+#include "CancelToken.h"
 
 #pragma once
 
@@ -46,14 +51,23 @@ public:
     virtual inline void clearState() {}
     virtual inline void init(unsigned int sample_rate) {}
     virtual void connect(uint32_t port,void* data) {}
+    virtual void setScratch(float *buf, int frames, float *rbuf, int rframes) {}
     virtual inline void normalize(int count, float *buf) {}
     virtual inline void compute(int count, float *input0, float *output0) {}
     virtual bool loadModel() { return false;}
+    virtual bool hasModel() { return false;}
     virtual void unloadModel() {}
     virtual void cleanUp() {}
 
-    ModelerBase() {};
+    // the token checked by loadModel(), nullptr for none (non rt)
+    void setCancel(const CancelToken *token) { cancel = token;}
+    bool cancelled() const { return cancel && cancel->cancelled();}
+
+    ModelerBase() : cancel(nullptr) {};
     virtual ~ModelerBase() {};
+
+protected:
+    const CancelToken *cancel;
 };
 
 
@@ -75,6 +89,12 @@ private:
     int                             modelSampleRate;
     int                             needResample;
 
+    // working buffers taken from the engine scratch arena
+    float*                          scratch;
+    float*                          rscratch;
+    int                             scratchSize;
+    int                             rscratchSize;
+
     float                           loudness;
     float                           ramp;
     float                           ramp_down;
@@ -86,6 +106,12 @@ private:
     std::condition_variable*        SyncWait;
     std::condition_variable         SyncIntern;
 
+    // key and size of the loaded model in the ModelCache
+    std::string                     cacheKey;
+    size_t                          cacheBytes;
+
+    void parkModel();
+
 public:
     std::string                     modelFile;
     float                           nGain;
@@ -97,9 +123,11 @@ public:
     inline void clearState() override;
     inline void init(unsigned int sample_rate) override;
     void connect(uint32_t port,void* data) override;
+    void setScratch(float *buf, int frames, float *rbuf, int rframes) override;
     inline void normalize(int count, float *buf) override;
     inline void compute(int count, float *input0, float *output0) override;
     bool loadModel() override;
+    bool hasModel() override { return model != nullptr;}
     void unloadModel() override;
     void cleanUp() override;
 
@@ -126,6 +154,12 @@ private:
     int                             modelSampleRate;
     int                             needResample;
 
+    // working buffers taken from the engine scratch arena
+    float*                          scratch;
+    float*                          rscratch;
+    int                             scratchSize;
+    int                             rscratchSize;
+
     float                           ramp;
     float                           ramp_down;
     float                           ramp_step;
@@ -136,7 +170,11 @@ private:
     std::condition_variable*        SyncWait;
     std::condition_variable         SyncIntern;
 
-    void get_samplerate(std::string config_file, int *mSampleRate);
+    // key and size of the loaded model in the ModelCache
+    std::string                     cacheKey;
+    size_t                          cacheBytes;
+
+    void parkModel();
 
 public:
     std::string                     modelFile;
@@ -148,9 +186,11 @@ public:
     inline void clearState() override;
     inline void init(unsigned int sample_rate) override;
     void connect(uint32_t port,void* data) override;
+    void setScratch(float *buf, int frames, float *rbuf, int rframes) override;
     inline void normalize(int count, float *buf) override;
     inline void compute(int count, float *input0, float *output0) override;
     bool loadModel() override;
+    bool hasModel() override { return model != nullptr;}
     void unloadModel() override;
     void cleanUp() override;
 
@@ -161,75 +201,275 @@ public:
 
 /****************************************************************
  ** ModlerSelector - class to set neural modeler according to the file to load 
+ *
+ *  The selector hold two banks of modelers, the active one is
+ *  used by the real-time thread, the standby one is used to load
+ *  and warm up the next model in the background. When loaded,
+ *  the standby bank is published with a atomic index swap and
+ *  the real-time thread crossfade from the old to the new model
+ *  over FADE_MS. Afterwards the worker frees the old model.
+ *  Without a fade buffer (see setScratch) the switch is hard.
+ *
+ *  A bank is only reused or freed when the real-time thread is
+ *  confirmed to have left it. When the real-time thread doesn't
+ *  run the slot (bypass, slot off, graph active, no process
+ *  calls) the worker switch the banks itself, the real-time
+ *  thread then pass the block through for the few instructions
+ *  it takes.
  */
 
 class ModelerSelector {
 public:
+    static constexpr int FADE_MS = 10;
 
+    // set the file for the next loadModel() call (non rt)
     void setModelFile(std::string modelFile_) {
-            if (needNewModeler(modelFile_)) {
-                selectModeler();
-                modeler->init(sampleRate);
-            }
-            return modeler->setModelFile(modelFile_);}
+            nextFile = modelFile_;}
 
     inline std::string getModelFile() {
-        return modeler->getModelFile();
+        return bank(target.load(std::memory_order_acquire)).modeler->getModelFile();
     }
 
     inline void clearState() {
-            return modeler->clearState();}
+            return bank(active).modeler->clearState();}
 
     inline void init(unsigned int sample_rate) {
             sampleRate = sample_rate;
-            return modeler->init(sample_rate);}
+            fadeLen = std::max(1, static_cast<int>(sample_rate) * FADE_MS / 1000);
+            bankA.modeler->init(sample_rate);
+            return bankB.modeler->init(sample_rate);}
 
     void connect(uint32_t port,void* data) {
-            return modeler->connect(port, data);}
+            return bank(active).modeler->connect(port, data);}
+
+    // all modelers share the scratch buffers, they are used one after the other.
+    // fbuf (frames) hold the input for the incoming model while crossfading
+    void setScratch(float *buf, int frames, float *rbuf, int rframes, float *fbuf = nullptr) {
+            for (Bank* b : {&bankA, &bankB}) {
+                b->namModel.setScratch(buf, frames, rbuf, rframes);
+                b->rtnModel.setScratch(buf, frames, rbuf, rframes);
+            }
+            fadeBuf = fbuf;}
 
     inline void normalize(int count, float *buf) {
-            return modeler->normalize(count, buf); }
+            return bank(active).modeler->normalize(count, buf); }
 
     inline void compute(int count, float *input0, float *output0) {
-            return modeler->compute(count, input0, output0);}
+            return compute(count, input0, output0, false);}
+
+    // process the active model, optional normalised, and crossfade
+    // to a newly published one (rt)
+    inline void compute(int count, float *input0, float *output0, bool norm) {
+            int e = FREE;
+            if (!owner.compare_exchange_strong(e, RT, std::memory_order_acquire)) {
+                // the worker switch the banks right now
+                if (output0 != input0) memcpy(output0, input0, count*sizeof(float));
+                return;
+            }
+            run(count, input0, output0, norm);
+            ticks.fetch_add(1, std::memory_order_release);
+            owner.store(FREE, std::memory_order_release);}
 
+    // load the file set by setModelFile() into the standby bank and
+    // publish it, returns false when the model could not be loaded (non rt)
     bool loadModel() {
-            return modeler->loadModel();}
+            const bool loaded = prepare();
+            commit();
+            retire();
+            return loaded;}
+
+    // load the file set by setModelFile() into the standby bank, without
+    // publishing it, so that several slots could be switched together.
+    // The load give up early when the token is cancelled, or when the
+    // real-time thread couldn't be confirmed to have left the bank (non rt)
+    bool prepare(const CancelToken *token = nullptr) {
+            const int t = target.load(std::memory_order_acquire);
+            if (!waitLive(t)) return false;
+            Bank& b = bank(1 - t);
+            b.modeler->cleanUp();
+            standby = true;
+            if (token && token->cancelled()) return false;
+            if (needNewModeler(b, nextFile)) {
+                selectModeler(b);
+                b.modeler->init(sampleRate);
+            }
+            b.modeler->setModelFile(nextFile);
+            b.modeler->setCancel(token);
+            const bool loaded = b.modeler->loadModel();
+            b.modeler->setCancel(nullptr);
+            return loaded;}
+
+    // publish the standby bank to the real-time thread, does nothing
+    // when prepare() couldn't take the bank (non rt)
+    void commit() {
+            if (!standby) return;
+            standby = false;
+            target.store(1 - target.load(std::memory_order_acquire), std::memory_order_release);}
+
+    // free the old model when the real-time thread has faded over, when
+    // that isn't confirmed the bank is freed by the next prepare() (non rt)
+    void retire() {
+            const int t = target.load(std::memory_order_acquire);
+            Bank& b = bank(1 - t);
+            if (b.modeler->hasModel() && waitLive(t)) b.modeler->cleanUp();}
 
     int getPhaseOffset() {
-            return modeler->getPhaseOffset();}
+            return bank(target.load(std::memory_order_acquire)).modeler->getPhaseOffset();}
 
+    // fade out the active model (non rt)
     void unloadModel() {
-            return modeler->unloadModel();}
+            setModelFile("None");
+            loadModel();}
 
     void cleanUp() {
-            return modeler->cleanUp();}
+            bankA.modeler->cleanUp();
+            return bankB.modeler->cleanUp();}
 
     ModelerSelector(std::condition_variable *var) :
-            noModel(),
-            namModel(var),
-            rtnModel(var) {
-            modeler = &noModel;
+            bankA(var),
+            bankB(var),
+            SyncWait(var),
+            target(0),
+            live(0),
+            owner(FREE),
+            ticks(0) {
             sampleRate = 0;
-            isNam = 3;}
+            standby = false;
+            active = 0;
+            previous = 0;
+            fadeLen = 1;
+            fadePos = 0;
+            fading = false;
+            fadeBuf = nullptr;}
 
     ~ModelerSelector() {}
 
 private:
-    ModelerBase *modeler;
-    ModelerBase noModel;
-    NeuralModel namModel;
-    RtNeuralModel rtnModel;
+    // process the active model and crossfade, owner is RT (rt)
+    inline void run(int count, float *input0, float *output0, bool norm) {
+            const int t = target.load(std::memory_order_acquire);
+            if (t != active) {
+                previous = active;
+                active = t;
+                fadePos = 0;
+                fading = fadeBuf && bank(previous).modeler->hasModel();
+                if (!fading) live.store(active, std::memory_order_release);
+            }
+            ModelerBase *m = bank(active).modeler;
+            if (!fading) {
+                m->compute(count, input0, output0);
+                if (norm) m->normalize(count, output0);
+                return;
+            }
+            // the new model process a copy of the input, faded in from silence
+            // when it failed to load
+            if (m->hasModel()) {
+                memcpy(fadeBuf, input0, count*sizeof(float));
+                m->compute(count, fadeBuf, fadeBuf);
+                if (norm) m->normalize(count, fadeBuf);
+            } else {
+                memset(fadeBuf, 0, count*sizeof(float));
+            }
+            ModelerBase *o = bank(previous).modeler;
+            o->compute(count, input0, output0);
+            if (norm) o->normalize(count, output0);
+            const float step = 1.0f / fadeLen;
+            for (int i = 0; i < count; i++) {
+                const float g = std::min(1.0f, (fadePos + i) * step);
+                output0[i] += (fadeBuf[i] - output0[i]) * g;
+            }
+            fadePos += count;
+            if (fadePos >= fadeLen) {
+                fading = false;
+                live.store(active, std::memory_order_release);
+            }}
+
+    struct Bank {
+        ModelerBase *modeler;
+        ModelerBase noModel;
+        NeuralModel namModel;
+        RtNeuralModel rtnModel;
+        int isNam;
+
+        Bank(std::condition_variable *var) :
+            noModel(),
+            namModel(var),
+            rtnModel(var) {
+            modeler = &noModel;
+            isNam = 3;}
+    };
+
+    Bank bankA;
+    Bank bankB;
+    std::condition_variable *SyncWait;
+    std::mutex WMutex;
+    std::string nextFile;
+
+    // index of the published bank, written by the worker
+    std::atomic<int> target;
+    // index of the bank the real-time thread has fully switched to
+    std::atomic<int> live;
+    // who may touch the real-time state below, FREE, RT or WORKER
+    enum { FREE, RT, WORKER };
+    std::atomic<int> owner;
+    // count the compute() calls, to see if the real-time thread run the slot
+    std::atomic<uint32_t> ticks;
+    // the standby bank is prepared and could be published, worker only
+    bool standby;
+
+    // real-time thread state
+    int active;
+    int previous;
+    int fadeLen;
+    int fadePos;
+    bool fading;
+    float *fadeBuf;
 
     uint32_t sampleRate;
-    int isNam;
-
-    void selectModeler() {
-            isNam ?
-            modeler = dynamic_cast<ModelerBase*>(&namModel) :
-            modeler = dynamic_cast<ModelerBase*>(&rtnModel);}
 
-    bool needNewModeler(std::string newModelFile) {
+    inline Bank& bank(int i) {
+            return i ? bankB : bankA;}
+
+    // wait until the real-time thread runs on bank i, the engine notify
+    // SyncWait each process cycle. When compute() wasn't called for two
+    // cycles the slot isn't run, so switch the bank here instead of
+    // waiting for it. Returns false when it couldn't be confirmed
+    bool waitLive(int i) {
+            uint32_t last = ticks.load(std::memory_order_acquire);
+            int idle = 0;
+            for (int n = 0; n < 50; n++) {
+                if (live.load(std::memory_order_acquire) == i) return true;
+                {
+                    std::unique_lock<std::mutex> lk(WMutex);
+                    SyncWait->wait_for(lk, std::chrono::milliseconds(10));
+                }
+                const uint32_t now = ticks.load(std::memory_order_acquire);
+                idle = now == last ? idle + 1 : 0;
+                last = now;
+                if (idle >= 2 && takeOver(i)) return true;
+            }
+            return live.load(std::memory_order_acquire) == i;}
+
+    // switch the real-time state to bank i without a fade, fails when
+    // the real-time thread is in compute() right now
+    bool takeOver(int i) {
+            int e = FREE;
+            if (!owner.compare_exchange_strong(e, WORKER, std::memory_order_acquire))
+                return false;
+            active = i;
+            previous = i;
+            fading = false;
+            fadePos = 0;
+            live.store(i, std::memory_order_release);
+            owner.store(FREE, std::memory_order_release);
+            return true;}
+
+    void selectModeler(Bank& b) {
+            b.isNam ?
+            b.modeler = dynamic_cast<ModelerBase*>(&b.namModel) :
+            b.modeler = dynamic_cast<ModelerBase*>(&b.rtnModel);}
+
+    bool needNewModeler(Bank& b, std::string newModelFile) {
             bool ret = true;
             int set = 0;
             std::string::size_type idx;
@@ -241,8 +481,8 @@ private:
                 if (newExtension.compare("nam")) set = 0;
                 else if (newExtension.compare("json")) set = 1;
                 else if (newExtension.compare("aidax")) set = 1;
-                ret = (isNam == set) ? false : true;
-                isNam = set;
+                ret = (b.isNam == set) ? false : true;
+                b.isNam = set;
             }
             return ret;}
 
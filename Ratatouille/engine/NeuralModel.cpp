@@ -19,7 +19,12 @@ NeuralModel::NeuralModel(std::condition_variable *Sync)
     nGain = 1.0;
     needResample = 0;
     phaseOffset = 0;
+    scratch = nullptr;
+    rscratch = nullptr;
+    scratchSize = 0;
+    rscratchSize = 0;
     isInited = false;
+    cacheBytes = 0;
     ready.store(false, std::memory_order_release);
     do_ramp.store(false, std::memory_order_release);
     do_ramp_down.store(false, std::memory_order_release);
@@ -50,6 +55,15 @@ void NeuralModel::connect(uint32_t port,void* data)
 {
 }
 
+// set the working buffers, count in compute() must not exceed frames
+void NeuralModel::setScratch(float *buf, int frames, float *rbuf, int rframes)
+{
+    scratch = buf;
+    scratchSize = frames;
+    rscratch = rbuf;
+    rscratchSize = rframes;
+}
+
 inline std::string NeuralModel::getModelFile() {
     return modelFile;
 }
@@ -71,12 +85,12 @@ int NeuralModel::getPhaseOffset()
 
 inline void NeuralModel::compute(int count, float *input0, float *output0)
 {
-    if (!model) return;
+    if (!model || !scratch) return;
 
     if (output0 != input0)
         memcpy(output0, input0, count*sizeof(float));
 
-    float buf[count];
+    float* buf = scratch;
     memcpy(buf, output0, count*sizeof(float));
 
     // process model
@@ -88,7 +102,7 @@ inline void NeuralModel::compute(int count, float *input0, float *output0)
             } else if (needResample == 2) {
                 ReCounta = static_cast<int>(ceil((count*static_cast<double>(modelSampleRate))/fSampleRate));
             }
-            float buf1[ReCounta];
+            float* buf1 = rscratch;
             memset(buf1, 0, ReCounta*sizeof(float));
             if (needResample == 1) {
                 ReCounta = smp.up(count, buf, buf1);
@@ -138,28 +152,65 @@ inline void NeuralModel::compute(int count, float *input0, float *output0)
 // non rt callback
 bool NeuralModel::loadModel() {
     if (!modelFile.empty() && isInited) {
+        // a empty standby instance isn't in use by the rt thread, no need to wait
         if (model) {
             do_ramp_down.store(true, std::memory_order_release);
             std::unique_lock<std::mutex> lkr(WMutex);
             SyncIntern.wait_for(lkr, std::chrono::milliseconds(30));
+            lkr.unlock();
+           // fprintf(stderr, "Load file %s\n", modelFile.c_str());
+            ready.store(false, std::memory_order_release);
+            std::unique_lock<std::mutex> lk(WMutex);
+            SyncWait->wait_for(lk, std::chrono::milliseconds(60));
         }
-       // fprintf(stderr, "Load file %s\n", modelFile.c_str());
         ready.store(false, std::memory_order_release);
-        std::unique_lock<std::mutex> lk(WMutex);
-        SyncWait->wait_for(lk, std::chrono::milliseconds(60));
-        if (model != nullptr) model.reset(nullptr);
+        parkModel();
        // fprintf(stderr, "delete model\n");
         needResample = 0;
         phaseOffset = 0;
         //clearState();
         int32_t warmUpSize = 4096;
-        try {
-            model = std::move(nam::get_dsp(std::filesystem::path(modelFile)));
-        } catch (const std::exception&) {
-            modelFile = "None";
+        // a recently used model is taken ready to run from the cache
+        const std::string key = ModelCache::makeKey(modelFile, fSampleRate);
+        ModelCache::Entry cached;
+        const bool hit = ModelCache::get().take(key, cached);
+        // otherwise the compiled copy from the disk cache skip the text parse
+        nam::dspData data;
+        ModelFileCache::Info info;
+        bool binary = false;
+        if (hit) {
+            model = std::move(cached.nam);
+            // the parked model still hold the tail of its last use
+            model->prewarm();
+            loudness = cached.loudness;
+            nGain = cached.nGain;
+            modelSampleRate = cached.modelSampleRate;
+            phaseOffset = cached.phaseOffset;
+        } else {
+            try {
+                binary = ModelFileCache::loadNam(modelFile, data, info);
+                if (binary) model = std::move(nam::get_dsp(data));
+            } catch (const std::exception&) {
+                binary = false;
+            }
+            if (binary && model) {
+                phaseOffset = info.phaseOffset;
+            } else {
+                binary = false;
+                try {
+                    model = std::move(nam::get_dsp(std::filesystem::path(modelFile), data));
+                } catch (const std::exception&) {
+                    modelFile = "None";
+                }
+            }
+            // give up when a newer request superseded this one
+            if (model && cancelled()) {
+                model.reset(nullptr);
+                modelFile = "None";
+            }
         }
         
-        if (model) {
+        if (model && !hit) {
             //fprintf(stderr, "load model %s\n", modelFile.c_str());
             if (model->HasLoudness()) {
                 loudness = model->GetLoudness();
@@ -170,6 +221,8 @@ bool NeuralModel::loadModel() {
             modelSampleRate = static_cast<int>(model->GetExpectedSampleRate());
             //model->SetLoudness(-15.0);
             if (modelSampleRate <= 0) modelSampleRate = 48000;
+        }
+        if (model) {
             if (modelSampleRate > fSampleRate) {
                 smp.setup(fSampleRate, modelSampleRate);
                 needResample = 1;
@@ -177,6 +230,17 @@ bool NeuralModel::loadModel() {
                 smp.setup(modelSampleRate, fSampleRate);
                 needResample = 2;
             } 
+            // the resampled block must fit into the scratch buffer
+            if (needResample == 1 && smp.max_out_count(scratchSize) > rscratchSize) {
+                fprintf(stderr, "model sample rate %iHz not supported at %iHz\n",
+                                            modelSampleRate, fSampleRate);
+                model.reset(nullptr);
+                needResample = 0;
+                modelFile = "None";
+            }
+        }
+
+        if (model && !hit && !binary) {
             float* buffer = new float[warmUpSize];
             memset(buffer, 0, warmUpSize * sizeof(float));
             float angle = 0.0;
@@ -185,10 +249,18 @@ bool NeuralModel::loadModel() {
                 angle += (2 * 3.14159365) / 2048;
             }
 
-            float* bufPtrs[1] = { buffer };
-            model->process(bufPtrs, bufPtrs, warmUpSize);
+            // warm up in chunks, so that a superseded load could give up
+            for (int32_t i0 = 0; i0 < warmUpSize; i0 += 512) {
+                if (cancelled()) {
+                    model.reset(nullptr);
+                    modelFile = "None";
+                    break;
+                }
+                float* bufPtrs[1] = { buffer + i0 };
+                model->process(bufPtrs, bufPtrs, 512);
+            }
 
-            for(int i=0;i<2048;i++){
+            for(int i=0;model && i<2048;i++){
                 if (!std::signbit(buffer[i+1]) != !std::signbit(buffer[i])) {
                     phaseOffset = i;
                     break;
@@ -198,7 +270,19 @@ bool NeuralModel::loadModel() {
             delete[] buffer;
             //fprintf(stderr, "sample rate = %i file = %i l = %f\n",fSampleRate, modelSampleRate, loudness);
             //fprintf(stderr, "%s\n", load_file.c_str());
+            // store the compiled copy for the next cold load
+            if (model) {
+                info.sampleRate = modelSampleRate;
+                info.phaseOffset = phaseOffset;
+                info.loudness = loudness;
+                info.hasLoudness = model->HasLoudness();
+                ModelFileCache::storeNam(modelFile, data, info);
+            }
         } 
+        if (model) {
+            cacheKey = key;
+            cacheBytes = hit ? cached.bytes : ModelCache::fileSize(modelFile);
+        }
         ready.store(true, std::memory_order_release);
         do_ramp.store(true, std::memory_order_release);
         do_ramp_down.store(false, std::memory_order_release);
@@ -213,7 +297,7 @@ void NeuralModel::unloadModel() {
     std::unique_lock<std::mutex> lk(WMutex);
     ready.store(false, std::memory_order_release);
     SyncWait->wait_for(lk, std::chrono::milliseconds(160));
-    if (model != nullptr) model.reset(nullptr);
+    parkModel();
    // fprintf(stderr, "delete model\n");
     needResample = 0;
     //clearState();
@@ -224,15 +308,26 @@ void NeuralModel::unloadModel() {
 // clean up
 void NeuralModel::cleanUp() {
     ready.store(false, std::memory_order_release);
-    if (model != nullptr) {
-        rawModel = model.release();
-        model.get_deleter()(rawModel);
-        rawModel = nullptr;
-        model = nullptr;
-    }
+    parkModel();
     needResample = 0;
     modelFile = "None";
     ready.store(true, std::memory_order_release);
 }
 
+// hand the model over to the ModelCache, it's deleted there when
+// the cache is full or disabled, not in use by the rt thread
+void NeuralModel::parkModel() {
+    if (model == nullptr) return;
+    ModelCache::Entry e;
+    e.nam = std::move(model);
+    e.loudness = loudness;
+    e.nGain = nGain;
+    e.modelSampleRate = modelSampleRate;
+    e.phaseOffset = phaseOffset;
+    e.bytes = cacheBytes;
+    ModelCache::get().put(cacheKey, std::move(e));
+    model = nullptr;
+    cacheKey.clear();
+}
+
 } // end namespace ratatouille
@@ -58,6 +58,10 @@
  *         under normal circumstances.
  *      // Finally stop the thread before exit.
  *      proc.stop(); 
+ *
+ *      // optional, before start(), run the function as task in the
+ *         process wide RtPool instead of a own thread (see RtPool.h)
+ *      proc.setSharedPool(RtPool::enabled());
  */
 
 #if defined(_WIN32)
@@ -76,6 +80,8 @@
 
 #include <pthread.h>
 
+#include "RtPool.h"
+
 #pragma once
 
 #ifndef PARALLEL_THREAD_H_
@@ -148,6 +154,9 @@ public:
          #if __cplusplus > 201703L
          ,pWorkCond(false)
          #endif
+         ,inFlight(false)
+         ,pool(nullptr)
+         ,sharedPool(false)
     {
         maxWait = 5;
         #ifdef __MOD_DEVICES__
@@ -166,9 +175,22 @@ public:
         };
     }
 
+    // run the process in the shared RtPool instead of a own thread,
+    // must be set before start()
+    void setSharedPool(bool on) noexcept {
+        if (!isRunning()) sharedPool = on;
+    }
+
     // start the new thread
     void start() noexcept {
-        if (!isRunning()) run();
+        if (isRunning()) return;
+        if (sharedPool) {
+            pool = RtPool::acquire();
+            pWait.store(false, std::memory_order_release);
+            pRun.store(true, std::memory_order_release);
+        } else {
+            run();
+        }
     }
 
     // start the new thread
@@ -179,11 +201,18 @@ public:
 
     // check if thread is busy, return true when not
     inline bool getState() const noexcept {
+        if (pool) return !inFlight.load(std::memory_order_acquire);
         return isWaiting.load(std::memory_order_acquire);
     }
 
+    // check without waiting if a run is queued or in progress
+    inline bool isBusy() const noexcept {
+        return pWait.load(std::memory_order_acquire);
+    }
+
     // helper function: check if thread is running
     inline bool isRunning() const noexcept {
+        if (pool) return pRun.load(std::memory_order_acquire);
         return (pRun.load(std::memory_order_acquire) && 
                  pThd.joinable());
     }
@@ -195,7 +224,8 @@ public:
 
     // set thread policy and priority class, this may fail silent
     void setPriority(int32_t rt_prio, int32_t rt_policy) noexcept {
-        if (isRunning())
+        if (pool) pool->setPriority(rt_prio, rt_policy);
+        else if (isRunning())
             setThreadPolicy(rt_prio, rt_policy);
     }
 
@@ -206,6 +236,7 @@ public:
 
     // try to get the process pointer, return false when thread is busy 
     inline bool getProcess() noexcept {
+        if (pool) return getPoolProcess();
         if (isRunning() && !getState()) {
             int maxDuration = 0;
             pthread_mutex_lock(&pWaitProc);
@@ -225,6 +256,13 @@ public:
 
     // notify the thread that work is to be done
     inline void runProcess() noexcept {
+        if (pool) {
+            // only one task at a time, cleared by the task itself
+            inFlight.store(true, std::memory_order_release);
+            // queue is full, run the task in the calling thread
+            if (!pool->submit(&ParallelThread::poolTask, this)) poolTask(this);
+            return;
+        }
         clientCall.store(true, std::memory_order_release);
         #if __cplusplus > 201703L
         pWorkCond.store(true);
@@ -243,6 +281,7 @@ public:
             uint32_t maxDuration = 0;
             pthread_mutex_lock(&pWaitProc);
             while (pWait.load(std::memory_order_acquire)) {
+                if (helpPool()) continue;
                 if (pthread_cond_timedwait(&pProcCond, &pWaitProc, getTimeOut()) != 0) { // ETIMEDOUT 
                     //fprintf(stderr, "%s wait %i\n", threadName.c_str(), maxDuration);
                     maxDuration +=1;
@@ -261,6 +300,16 @@ public:
 
     // stop the thread (at least on Destruction)
     void stop() noexcept {
+        if (pool) {
+            pRun.store(false, std::memory_order_release);
+            // a queued task must be done before the pool is left,
+            // it would run on a destroyed instance otherwise
+            while (inFlight.load(std::memory_order_acquire))
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            pool = nullptr;
+            RtPool::release();
+            return;
+        }
         if (isRunning()) {
             pRun.store(false, std::memory_order_release);
             if (pThd.joinable()) {
@@ -298,6 +347,57 @@ private:
     pthread_cond_t pProcCond;
     struct timespec timeOut;
 
+    // shared pool: a task is queued or running, only the task clear it
+    std::atomic<bool> inFlight;
+    RtPool* pool;
+    bool sharedPool;
+
+    // shared pool: wait until the last task is done and reserve the next one.
+    // processWait() may give up on pWait, but the task could be still
+    // queued or running, so never submit a second one meanwhile
+    inline bool getPoolProcess() noexcept {
+        if (!isRunning()) return false;
+        if (inFlight.load(std::memory_order_acquire)) {
+            int maxDuration = 0;
+            pthread_mutex_lock(&pWaitProc);
+            while (inFlight.load(std::memory_order_acquire)) {
+                if (helpPool()) continue;
+                if (pthread_cond_timedwait(&pProcCond, &pWaitProc, getTimeOut()) != 0) { //ETIMEDOUT
+                    maxDuration +=1;
+                    if (maxDuration > 2) {
+                        break;
+                    }
+                }
+            }
+            pthread_mutex_unlock(&pWaitProc);
+            if (inFlight.load(std::memory_order_acquire)) return false;
+        }
+        pWait.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // shared pool: a pool worker must not block on a task queued behind
+    // it, so it run the queued tasks while it wait. Called with pWaitProc
+    // locked, return true when a task was run
+    inline bool helpPool() noexcept {
+        if (!pool || !RtPool::onWorker()) return false;
+        pthread_mutex_unlock(&pWaitProc);
+        const bool ran = pool->runOne();
+        pthread_mutex_lock(&pWaitProc);
+        return ran;
+    }
+
+    // shared pool: the task run by a pool worker
+    static void poolTask(void* arg) noexcept {
+        ParallelThread* self = static_cast<ParallelThread*>(arg);
+        self->process();
+        pthread_mutex_lock(&self->pWaitProc);
+        self->pWait.store(false, std::memory_order_release);
+        self->inFlight.store(false, std::memory_order_release);
+        pthread_cond_broadcast(&self->pProcCond);
+        pthread_mutex_unlock(&self->pWaitProc);
+    }
+
     // init pthread_cond_t and pthread_mutex_t
     inline void init() noexcept {
         pthread_condattr_t cond_attr;
@@ -0,0 +1,463 @@
+/*
+ * PartitionedConvolver.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** PartitionedConvolver - uniform partitioned convolution on a shared IrSpectrum
+ *
+ *  Zero latency overlap-add convolution like fftconvolver::FFTConvolver,
+ *  but the IR partitions are taken from a shared IrSpectrum part,
+ *  the convolver itself only own the input delay line (the spectra
+ *  of the last input blocks), the accumulators and the overlap.
+ *  While the spectrum is still prepared, only the ready partitions
+ *  are used, new ones are picked up at the next block boundary.
+ *  When the host block is smaller than the partition, the
+ *  accumulation of the older blocks for the next partition is
+ *  spread over the calls of the current one, so each call does
+ *  about the same work, instead of all at the block boundary.
+ *  feed() only keep the input delay line up to date, without
+ *  convolving, so process() could take over again later.
+ *
+ ** MultiLevelConvolver - non uniform partitioned convolution on a shared IrSpectrum
+ *
+ *  The head of the IR is convolved with small partitions in the
+ *  calling thread, the later parts (levels) with partitions growing
+ *  geometric. A level with block size B start at IR sample 2 * B, so
+ *  a full input block is convolved while the next one is collected,
+ *  that give each level a whole block of its own size as deadline.
+ *  The levels could be processed by there own background threads.
+ *  The spectrum must be build with IrLayout::multiLevel(head, max).
+ *
+ ** HybridConvolver - direct FIR head and partitioned tail on a shared IrSpectrum
+ *
+ *  For very small host blocks the per call FFT of the uniform
+ *  convolver cost more than the multiplies. The hybrid convolver
+ *  run the first taps of the IR as direct form FIR (AVX, SSE or
+ *  NEON, see simd in Smoother.h) and the rest with partitions of
+ *  the same size. The tail start at IR sample taps, so a full input
+ *  block is convolved once at the block boundary and the result is
+ *  used for the next block, without latency and without FFT's in
+ *  between. The spectrum must be build with IrLayout::direct(taps),
+ *  the FIR taps are taken back from the first segment.
+ *
+ *  usage:
+ *      PartitionedConvolver c;
+ *      c.init(IrStore::get().acquire(file, rate, norm, IrLayout::uniform(1024)), 0);
+ *      c.process(in, out, n);
+ *      HybridConvolver h;
+ *      h.init(IrStore::get().acquire(file, rate, norm, IrLayout::direct(128)));
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "AudioFFT.h"
+#include "Utilities.h"
+#include "IrSpectrum.h"
+#include "Smoother.h"
+
+#pragma once
+
+#ifndef PARTITIONED_CONVOLVER_H_
+#define PARTITIONED_CONVOLVER_H_
+
+namespace ratatouille {
+
+class PartitionedConvolver {
+public:
+    PartitionedConvolver()
+        : part(nullptr), partIndex(0), blockSize(0), segCount(0), readyCount(0),
+          complexSize(0), inputBufferFill(0), current(0), nextDone(2), fed(false) {}
+
+    virtual ~PartitionedConvolver() { reset();}
+
+    // use the part p of the spectrum, returns false when it's empty
+    bool init(std::shared_ptr<const IrSpectrum> ir, size_t p) {
+        reset();
+        if (!ir || p >= ir->parts.size() || !ir->parts[p].segments) return false;
+        spectrum = std::move(ir);
+        part = &spectrum->parts[p];
+        partIndex = p;
+        blockSize = part->block;
+        segCount = part->segments;
+        readyCount = spectrum->readySegments(p);
+        complexSize = part->complexSize;
+        fft.init(2 * blockSize);
+        fftBuffer.resize(2 * blockSize);
+        fftBuffer.setZero();
+        for (uint32_t i = 0; i < segCount; i++) {
+            segments.push_back(new fftconvolver::SplitComplex(complexSize));
+        }
+        preMultiplied.resize(complexSize);
+        nextMultiplied.resize(complexSize);
+        conv.resize(complexSize);
+        overlap.resize(blockSize);
+        overlap.setZero();
+        inputBuffer.resize(blockSize);
+        inputBuffer.setZero();
+        inputBufferFill = 0;
+        current = 0;
+        nextDone = 2;
+        fed = false;
+        return true;
+    }
+
+    // release the spectrum and free the buffers
+    void reset() {
+        for (fftconvolver::SplitComplex* s : segments) delete s;
+        segments.clear();
+        spectrum.reset();
+        part = nullptr;
+        partIndex = 0;
+        blockSize = 0;
+        segCount = 0;
+        readyCount = 0;
+        complexSize = 0;
+        fftBuffer.clear();
+        preMultiplied.clear();
+        nextMultiplied.clear();
+        conv.clear();
+        overlap.clear();
+        inputBuffer.clear();
+        inputBufferFill = 0;
+        current = 0;
+        nextDone = 2;
+        fed = false;
+    }
+
+    void process(const float* input, float* output, size_t len) {
+        if (!segCount) {
+            memset(output, 0, len * sizeof(float));
+            return;
+        }
+        size_t processed = 0;
+        while (processed < len) {
+            const bool inputBufferWasEmpty = (inputBufferFill == 0);
+            const size_t processing = std::min(len - processed, blockSize - inputBufferFill);
+            const size_t inputBufferPos = inputBufferFill;
+            memcpy(inputBuffer.data() + inputBufferPos, input + processed, processing * sizeof(float));
+
+            // forward FFT of the input block
+            fftconvolver::CopyAndPad(fftBuffer, inputBuffer.data(), blockSize);
+            fft.fft(fftBuffer.data(), segments[current]->re(), segments[current]->im());
+
+            // the older blocks are accumulated once per block, mostly
+            // ahead in the calls of the last block (see accumulateNext),
+            // or again when the last blocks were only fed
+            if (fed) {
+                fed = false;
+                if (readyCount < segCount) readyCount = spectrum->readySegments(partIndex);
+                preMultiplied.setZero();
+                accumulate(preMultiplied, current, 1, readyCount);
+                // the accumulation for the next block start over
+                nextMultiplied.setZero();
+                nextDone = 2;
+            } else if (inputBufferWasEmpty) {
+                if (readyCount < segCount) readyCount = spectrum->readySegments(partIndex);
+                preMultiplied.copyFrom(nextMultiplied);
+                // the segments which were not done ahead, at least the last block
+                accumulate(preMultiplied, current, 1, std::min(2u, readyCount));
+                accumulate(preMultiplied, current, nextDone, readyCount);
+                nextMultiplied.setZero();
+                nextDone = 2;
+            }
+            conv.copyFrom(preMultiplied);
+            if (readyCount) fftconvolver::ComplexMultiplyAccumulate(conv.re(), conv.im(),
+                part->re(0), part->im(0), segments[current]->re(), segments[current]->im(), complexSize);
+
+            // backward FFT and overlap-add
+            fft.ifft(fftBuffer.data(), conv.re(), conv.im());
+            fftconvolver::Sum(output + processed, fftBuffer.data() + inputBufferPos,
+                              overlap.data() + inputBufferPos, processing);
+
+            inputBufferFill += processing;
+            if (inputBufferFill == blockSize) {
+                inputBuffer.setZero();
+                inputBufferFill = 0;
+                memcpy(overlap.data(), fftBuffer.data() + blockSize, blockSize * sizeof(float));
+                current = (current > 0) ? (current - 1) : (segCount - 1);
+            } else {
+                accumulateNext();
+            }
+            processed += processing;
+        }
+    }
+
+    // transform the input blocks into the delay line, but skip the
+    // convolution. The output of process() is exact again from the
+    // next block boundary on, at most one block after the last feed()
+    void feed(const float* input, size_t len) {
+        if (!segCount) return;
+        size_t processed = 0;
+        while (processed < len) {
+            const size_t processing = std::min(len - processed, blockSize - inputBufferFill);
+            memcpy(inputBuffer.data() + inputBufferFill, input + processed, processing * sizeof(float));
+            inputBufferFill += processing;
+            if (inputBufferFill == blockSize) {
+                fftconvolver::CopyAndPad(fftBuffer, inputBuffer.data(), blockSize);
+                fft.fft(fftBuffer.data(), segments[current]->re(), segments[current]->im());
+                inputBuffer.setZero();
+                inputBufferFill = 0;
+                overlap.setZero();
+                current = (current > 0) ? (current - 1) : (segCount - 1);
+            }
+            processed += processing;
+        }
+        fed = true;
+    }
+
+    uint32_t getBlockSize() const { return blockSize;}
+    uint32_t getSegmentCount() const { return segCount;}
+
+private:
+    // acc += IR segment i * input block at c + i, for i in [from, to)
+    inline void accumulate(fftconvolver::SplitComplex& acc, uint32_t c, uint32_t from, uint32_t to) {
+        for (uint32_t i = from; i < to; i++) {
+            const fftconvolver::SplitComplex* a = segments[(c + i) % segCount];
+            fftconvolver::ComplexMultiplyAccumulate(acc.re(), acc.im(),
+                            part->re(i), part->im(i), a->re(), a->im(), complexSize);
+        }
+    }
+
+    // the older blocks of the next block are known already, except the
+    // current one, accumulate a share of them as the block fill up.
+    // Segment i of the next block is the input block at current + i - 1
+    inline void accumulateNext() {
+        if (readyCount <= nextDone) return;
+        const uint32_t todo = readyCount - 2;
+        const uint32_t to = 2 + static_cast<uint32_t>(
+                    (static_cast<uint64_t>(todo) * inputBufferFill + blockSize - 1) / blockSize);
+        accumulate(nextMultiplied, current + segCount - 1, nextDone, std::min(to, readyCount));
+        nextDone = std::max(nextDone, std::min(to, readyCount));
+    }
+
+    std::shared_ptr<const IrSpectrum>           spectrum;
+    const IrPart*                               part;
+    size_t                                      partIndex;
+    uint32_t                                    blockSize;
+    uint32_t                                    segCount;
+    uint32_t                                    readyCount;
+    uint32_t                                    complexSize;
+    audiofft::AudioFFT                          fft;
+    fftconvolver::SampleBuffer                  fftBuffer;
+    std::vector<fftconvolver::SplitComplex*>    segments;
+    fftconvolver::SplitComplex                  preMultiplied;
+    // the time sliced accumulation for the next block
+    fftconvolver::SplitComplex                  nextMultiplied;
+    fftconvolver::SplitComplex                  conv;
+    fftconvolver::SampleBuffer                  overlap;
+    fftconvolver::SampleBuffer                  inputBuffer;
+    size_t                                      inputBufferFill;
+    uint32_t                                    current;
+    uint32_t                                    nextDone;
+    bool                                        fed;
+
+    PartitionedConvolver(const PartitionedConvolver&) = delete;
+    PartitionedConvolver& operator=(const PartitionedConvolver&) = delete;
+};
+
+class MultiLevelConvolver {
+public:
+    MultiLevelConvolver() : minBlock(0), maxBlock(0), pos(0) {}
+
+    virtual ~MultiLevelConvolver() { reset();}
+
+    // the spectrum must be build with IrLayout::multiLevel()
+    bool init(std::shared_ptr<const IrSpectrum> ir) {
+        reset();
+        if (!ir || ir->parts.empty() || !ir->parts[0].segments) return false;
+        head.init(ir, 0);
+        for (size_t p = 1; p < ir->parts.size(); p++) {
+            std::unique_ptr<Level> l(new Level());
+            if (!l->conv.init(ir, p)) break;
+            const size_t block = ir->parts[p].block;
+            for (fftconvolver::SampleBuffer* b : {&l->input, &l->backgroundInput,
+                                                  &l->output, &l->precalculated}) {
+                b->resize(block);
+                b->setZero();
+            }
+            l->block = block;
+            minBlock = minBlock ? std::min(minBlock, block) : block;
+            maxBlock = std::max(maxBlock, block);
+            levels.push_back(std::move(l));
+        }
+        pos = 0;
+        return true;
+    }
+
+    void reset() {
+        head.reset();
+        levels.clear();
+        minBlock = 0;
+        maxBlock = 0;
+        pos = 0;
+    }
+
+    void process(const float* input, float* output, size_t len) {
+        head.process(input, output, len);
+        if (levels.empty()) return;
+        size_t processed = 0;
+        while (processed < len) {
+            const size_t processing = std::min(len - processed, minBlock - pos % minBlock);
+            // sum the precalculated blocks and fill the level inputs
+            for (std::unique_ptr<Level>& l : levels) {
+                const size_t at = pos % l->block;
+                const float* pre = l->precalculated.data() + at;
+                for (size_t i = 0; i < processing; i++) output[processed + i] += pre[i];
+                memcpy(l->input.data() + at, input + processed, processing * sizeof(float));
+            }
+            pos += processing;
+            // a full input block of a level is convolved while the next
+            // block is collected, the result is used one block later
+            for (size_t k = 0; k < levels.size(); k++) {
+                Level& l = *levels[k];
+                if (pos % l.block) continue;
+                // the last block is still in work, skip this one and
+                // keep the previous output, the worker own the input
+                if (!waitForBackgroundProcessing(k)) continue;
+                fftconvolver::SampleBuffer::Swap(l.precalculated, l.output);
+                l.backgroundInput.copyFrom(l.input);
+                startBackgroundProcessing(k);
+            }
+            if (pos == maxBlock) pos = 0;
+            processed += processing;
+        }
+    }
+
+    size_t levelCount() const { return levels.size();}
+
+protected:
+    virtual void startBackgroundProcessing(size_t level) { doBackgroundProcessing(level);}
+    // false when the level is still in work
+    virtual bool waitForBackgroundProcessing(size_t level) { return true;}
+
+    void doBackgroundProcessing(size_t level) {
+        Level& l = *levels[level];
+        l.conv.process(l.backgroundInput.data(), l.output.data(), l.block);
+    }
+
+private:
+    struct Level {
+        PartitionedConvolver        conv;
+        size_t                      block = 0;
+        fftconvolver::SampleBuffer  input;
+        fftconvolver::SampleBuffer  backgroundInput;
+        fftconvolver::SampleBuffer  output;
+        fftconvolver::SampleBuffer  precalculated;
+    };
+
+    PartitionedConvolver                    head;
+    std::vector<std::unique_ptr<Level>>     levels;
+    size_t                                  minBlock;
+    size_t                                  maxBlock;
+    size_t                                  pos;
+
+    MultiLevelConvolver(const MultiLevelConvolver&) = delete;
+    MultiLevelConvolver& operator=(const MultiLevelConvolver&) = delete;
+};
+
+class HybridConvolver {
+public:
+    HybridConvolver() : taps(0), pos(0) {}
+
+    virtual ~HybridConvolver() { reset();}
+
+    // the spectrum must be build with IrLayout::direct()
+    bool init(std::shared_ptr<const IrSpectrum> ir) {
+        reset();
+        if (!ir || ir->parts.empty() || ir->parts[0].segments != 1 ||
+                                    !ir->readySegments(0)) return false;
+        const IrPart& h = ir->parts[0];
+        // the FIR run two taps and simd::W outputs at once
+        if (h.block % 2 || h.block % simd::W) return false;
+        // the time domain taps of the first segment
+        audiofft::AudioFFT fft;
+        fft.init(2 * h.block);
+        std::vector<float> t(2 * h.block);
+        fft.ifft(t.data(), h.re(0), h.im(0));
+        taps = h.block;
+        coef.assign(t.begin(), t.begin() + taps);
+        line.assign(2 * taps, 0.0f);
+        tailOut.resize(taps);
+        tailOut.setZero();
+        if (ir->parts.size() > 1) tail.init(ir, 1);
+        pos = 0;
+        return true;
+    }
+
+    void reset() {
+        tail.reset();
+        coef.clear();
+        line.clear();
+        tailOut.clear();
+        taps = 0;
+        pos = 0;
+    }
+
+    void process(const float* input, float* output, size_t len) {
+        if (!taps) {
+            memset(output, 0, len * sizeof(float));
+            return;
+        }
+        size_t processed = 0;
+        while (processed < len) {
+            const size_t processing = std::min(len - processed, taps - pos);
+            // the line hold the last block and the current one
+            float* x = line.data() + taps + pos;
+            memcpy(x, input + processed, processing * sizeof(float));
+            fir(x, tailOut.data() + pos, output + processed, processing);
+            pos += processing;
+            if (pos == taps) {
+                // the tail of this block sound in the next one
+                if (tail.getSegmentCount()) tail.process(line.data() + taps, tailOut.data(), taps);
+                memcpy(line.data(), line.data() + taps, taps * sizeof(float));
+                pos = 0;
+            }
+            processed += processing;
+        }
+    }
+
+    uint32_t getTaps() const { return taps;}
+
+private:
+    // out[i] = add[i] + sum of coef[k] * x[i - k], vectorised over the outputs
+    inline void fir(const float* x, const float* add, float* out, size_t n) {
+        const float* c = coef.data();
+        size_t i = 0;
+        for (; i + simd::W <= n; i += simd::W) {
+            simd::vfloat a0 = simd::load(add + i);
+            simd::vfloat a1 = simd::set1(0.0f);
+            for (uint32_t k = 0; k < taps; k += 2) {
+                a0 = simd::add(a0, simd::mul(simd::set1(c[k]), simd::load(x + i - k)));
+                a1 = simd::add(a1, simd::mul(simd::set1(c[k + 1]), simd::load(x + i - k - 1)));
+            }
+            simd::store(out + i, simd::add(a0, a1));
+        }
+        for (; i < n; i++) {
+            float a = add[i];
+            for (uint32_t k = 0; k < taps; k++) a += c[k] * x[i - k];
+            out[i] = a;
+        }
+    }
+
+    PartitionedConvolver        tail;
+    std::vector<float>          coef;
+    std::vector<float>          line;
+    fftconvolver::SampleBuffer  tailOut;
+    uint32_t                    taps;
+    size_t                      pos;
+
+    HybridConvolver(const HybridConvolver&) = delete;
+    HybridConvolver& operator=(const HybridConvolver&) = delete;
+};
+
+} // end namespace ratatouille
+
+#endif
@@ -0,0 +1,487 @@
+/*
+ * ProcessGraph.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** ProcessGraph - N neural models and IR files in parallel and
+ *                 serial chains
+ *
+ *  A graph is a set of parallel branches, each branch is a serial
+ *  chain of nodes. A node is a neural model or a impulse response
+ *  with it's own input gain. The branch outputs are mixed by there
+ *  blend weight, so a layered amp + pedal chain runs in one engine.
+ *
+ *  The graph is described by a string:
+ *      branch;branch;...       parallel branches
+ *      node>node>...           serial nodes in a branch
+ *      file@dB                 input gain of a node (optional)
+ *      branch*weight           blend weight of a branch (optional, default 1)
+ *  e.g. "pedal.nam@3>amp.nam>cab.wav;amp2.nam>cab2.wav*0.5"
+ *
+ *  Each period the scheduler spreads the branches over the worker
+ *  threads, longest measured branch first (LPT). The heaviest
+ *  branch, the critical path, stays on the real-time thread, the
+ *  others are balanced over the workers.
+ *
+ *  The graph is build in the non rt worker thread by load() and
+ *  published as a whole, the audio thread take it once per period.
+ *  The old graph is freed when the audio thread left process()
+ *  since and its workers are idle, otherwise it's kept and freed
+ *  with a later load() or clear().
+ *
+ *  usage:
+ *      graph.init(rate, maxFrames, channels, prio, policy);
+ *      // non rt
+ *      graph.load("amp.nam>cab.wav;amp2.nam>cab2.wav", blockSize);
+ *      // rt, returns false when no graph is loaded
+ *      if (!graph.process(n_samples, output, nullptr)) ...
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "ParallelThread.h"
+#include "ModelerSelector.h"
+#include "fftconvolver.h"
+#include "StageProfiler.h"
+#include "ScratchArena.h"
+#include "Smoother.h"
+
+#pragma once
+
+#ifndef PROCESS_GRAPH_H_
+#define PROCESS_GRAPH_H_
+
+namespace ratatouille {
+
+class ProcessGraph {
+public:
+    static constexpr uint32_t MAX_BRANCHES = 8;
+    static constexpr uint32_t MAX_NODES = 8;
+
+    ProcessGraph(std::condition_variable *var, LevelWorkers *workers = nullptr)
+        : current(nullptr),
+          inProcess(false),
+          exits(0),
+          SyncWait(var),
+          levelWorkers(workers),
+          rate(48000),
+          maxFrames(0),
+          channels(1),
+          rt_prio(0),
+          rt_policy(0),
+          freewheel(false) {}
+
+    ~ProcessGraph() {
+        clear();
+        // last chance for the rt thread, the instance goes away anyway
+        for (int i = 0; i < 1000 && !freeRetired(); i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        retired.clear();
+    }
+
+    // set the stream parameters, must be called before load()
+    void init(uint32_t rate_, uint32_t maxFrames_, uint32_t channels_,
+                                    int32_t rt_prio_, int32_t rt_policy_) {
+        rate = rate_;
+        maxFrames = maxFrames_;
+        channels = std::clamp(channels_, 1u, 2u);
+        rt_prio = rt_prio_;
+        rt_policy = rt_policy_;
+    }
+
+    // offline rendering: run all branches in the calling thread
+    void setFreewheel(bool on) {
+        freewheel = on;
+        if (graph) setFreewheel(*graph, on);
+    }
+
+    // build the graph from the description (non rt),
+    // returns false when no node could be loaded
+    bool load(const std::string& spec, uint32_t blockSize) {
+        std::unique_ptr<Graph> g(new Graph());
+        for (std::string bs : split(spec, ';')) {
+            if (g->branches.size() >= MAX_BRANCHES) {
+                fprintf(stderr, "ProcessGraph: only %u branches supported\n", MAX_BRANCHES);
+                break;
+            }
+            std::unique_ptr<Branch> branch(new Branch());
+            branch->weight = std::max(0.0f, parseSuffix(bs, '*', 1.0f));
+            for (std::string ns : split(bs, '>')) {
+                if (branch->nodes.size() >= MAX_NODES) {
+                    fprintf(stderr, "ProcessGraph: only %u nodes per branch supported\n", MAX_NODES);
+                    break;
+                }
+                const float gain = parseSuffix(ns, '@', 0.0f);
+                ns = trim(ns);
+                if (ns.empty() || ns == "None") continue;
+                std::unique_ptr<Node> node = loadNode(ns, gain, blockSize);
+                if (node) branch->nodes.push_back(std::move(node));
+                else fprintf(stderr, "ProcessGraph: fail to load %s\n", ns.c_str());
+            }
+            if (!branch->nodes.empty()) g->branches.push_back(std::move(branch));
+        }
+        if (g->branches.empty()) {
+            clear();
+            return false;
+        }
+
+        // branch buffers
+        g->arena.allocate(ScratchArena::pad(maxFrames) * channels * g->branches.size());
+        float weights = 0.0f;
+        for (auto& b : g->branches) weights += b->weight;
+        for (auto& b : g->branches) {
+            b->weight = weights > 0.0f ? b->weight / weights : 1.0f / g->branches.size();
+            for (uint32_t c = 0; c < channels; c++)
+                b->buf[c] = g->arena.take(maxFrames);
+        }
+
+        // one worker less than branches, the rt thread takes the rest
+        const uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+        startWorkers(*g, std::min(static_cast<uint32_t>(g->branches.size()) - 1, cores - 1),
+                                                                            blockSize);
+        setFreewheel(*g, freewheel);
+        swapIn(std::move(g));
+        return true;
+    }
+
+    // remove all nodes (non rt)
+    void clear() {
+        swapIn(nullptr);
+    }
+
+    // process the graph in place (rt), output1 is the right channel
+    // in stereo mode, returns false when no graph is loaded
+    bool process(uint32_t n_samples, float* output, float* output1) noexcept {
+        inProcess.store(true);
+        Graph* g = current.load();
+        if (!g) {
+            leave();
+            return false;
+        }
+        g->frames = std::min(n_samples, maxFrames);
+        g->stereo = output1 && channels > 1;
+        const uint32_t frames = g->frames;
+        for (auto& b : g->branches) {
+            memcpy(b->buf[0], output, frames * sizeof(float));
+            if (g->stereo) memcpy(b->buf[1], output1, frames * sizeof(float));
+        }
+
+        // hand out the branches
+        schedule(*g);
+        uint32_t running[MAX_BRANCHES];
+        uint32_t nRunning = 0;
+        for (uint32_t w = 0; w < g->workers.size(); w++) {
+            if (!hasWork(*g, w + 1)) continue;
+            if (g->workers[w]->thread.getProcess()) {
+                g->workers[w]->thread.runProcess();
+                running[nRunning++] = w;
+            } else {
+                // worker is busy, take over it's branches
+                for (auto& b : g->branches)
+                    if (b->worker == w + 1) b->worker = 0;
+            }
+        }
+        runWorker(*g, 0);
+        for (uint32_t i = 0; i < nRunning; i++)
+            g->workers[running[i]]->thread.processWait();
+
+        // mix the branches
+        float* out[2] = { output, output1 };
+        for (uint32_t c = 0; c < (g->stereo ? 2u : 1u); c++) {
+            float* o = out[c];
+            const float w0 = g->branches[0]->weight;
+            const float* b0 = g->branches[0]->buf[c];
+            for (uint32_t i = 0; i < frames; i++) o[i] = b0[i] * w0;
+            for (uint32_t b = 1; b < g->branches.size(); b++) {
+                const float w = g->branches[b]->weight;
+                const float* bb = g->branches[b]->buf[c];
+                for (uint32_t i = 0; i < frames; i++) o[i] += bb[i] * w;
+            }
+        }
+        leave();
+        return true;
+    }
+
+private:
+    struct Node {
+        bool                                isModel;
+        Smoother                            gain;
+        std::unique_ptr<ModelerSelector>    model[2];
+        std::unique_ptr<ConvolverSelector>  conv[2];
+        ScratchArena                        scratch;
+
+        ~Node() {
+            for (uint32_t c = 0; c < 2; c++) {
+                if (model[c]) model[c]->cleanUp();
+                if (conv[c]) {
+                    conv[c]->set_not_runnable();
+                    conv[c]->stop_process();
+                    conv[c]->cleanup();
+                }
+            }
+        }
+    };
+
+    struct Branch {
+        std::vector<std::unique_ptr<Node>>  nodes;
+        float                               weight = 1.0f;
+        float*                              buf[2] = { nullptr, nullptr };
+        // measured process time, moving average in profiler ticks
+        uint64_t                            cost = 0;
+        // 0 = rt thread, otherwise worker index + 1
+        uint32_t                            worker = 0;
+    };
+
+    struct Graph;
+
+    struct Worker {
+        Graph*                              graph;
+        uint32_t                            index;
+        ParallelThread                      thread;
+        void run() { runWorker(*graph, index); }
+    };
+
+    // a loaded graph with its buffers and workers, the rt thread
+    // take it once per period, so it's swapped as a whole
+    struct Graph {
+        std::vector<std::unique_ptr<Branch>>    branches;
+        std::vector<std::unique_ptr<Worker>>    workers;
+        ScratchArena                            arena;
+        // the period, set by the rt thread for the workers
+        uint32_t                                frames = 0;
+        bool                                    stereo = false;
+        // count of process() exits when it was swapped out
+        uint32_t                                exitsAt = 0;
+
+        ~Graph() {
+            // the workers go first, they run the branches
+            for (auto& w : workers) w->thread.stop();
+            workers.clear();
+            branches.clear();
+        }
+    };
+
+    // the graph owned by the non rt side, and the one the rt thread run
+    std::unique_ptr<Graph>                  graph;
+    std::atomic<Graph*>                     current;
+    // swapped out graphs, which may be still in use
+    std::vector<std::unique_ptr<Graph>>     retired;
+    std::atomic<bool>                       inProcess;
+    std::atomic<uint32_t>                   exits;
+    std::condition_variable*                SyncWait;
+    // shared with the IR stage of the engine
+    LevelWorkers*                           levelWorkers;
+
+    uint32_t                                rate;
+    uint32_t                                maxFrames;
+    uint32_t                                channels;
+    int32_t                                 rt_prio;
+    int32_t                                 rt_policy;
+    bool                                    freewheel;
+
+    // the rt thread leave process()
+    inline void leave() noexcept {
+        exits.fetch_add(1);
+        inProcess.store(false);
+    }
+
+    // publish the new graph and free the old one, when the rt thread
+    // left process() since and its workers are idle. A graph still
+    // in use is kept and freed with a later swap (non rt)
+    void swapIn(std::unique_ptr<Graph> g) {
+        current.store(g.get());
+        if (graph) {
+            graph->exitsAt = exits.load();
+            retired.push_back(std::move(graph));
+        }
+        graph = std::move(g);
+        for (int i = 0; i < 1000 && !freeRetired(); i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!retired.empty()) fprintf(stderr, "ProcessGraph: keep %zu busy graph(s)\n", retired.size());
+    }
+
+    // free the retired graphs which are no longer in use,
+    // returns true when none is left
+    bool freeRetired() {
+        for (auto it = retired.begin(); it != retired.end();) {
+            bool idle = !inProcess.load() || exits.load() != (*it)->exitsAt;
+            for (auto& w : (*it)->workers) idle = idle && w->thread.getState();
+            if (idle) it = retired.erase(it);
+            else ++it;
+        }
+        return retired.empty();
+    }
+
+    // start the worker threads of a new graph (non rt)
+    void startWorkers(Graph& g, uint32_t count, uint32_t blockSize) {
+        while (g.workers.size() < count) {
+            std::unique_ptr<Worker> w(new Worker());
+            w->graph = &g;
+            w->index = static_cast<uint32_t>(g.workers.size()) + 1;
+            w->thread.setThreadName("RT-Graph");
+            w->thread.setSharedPool(RtPool::enabled());
+            w->thread.set<Worker, &Worker::run>(w.get());
+            w->thread.start();
+            w->thread.setPriority(rt_prio, rt_policy);
+            g.workers.push_back(std::move(w));
+        }
+        if (blockSize && rate) {
+            for (auto& w : g.workers)
+                w->thread.setTimeOut(std::max(100, static_cast<int>((blockSize/(rate*0.000001))*0.1)));
+        }
+    }
+
+    static void setFreewheel(Graph& g, bool on) {
+        for (auto& b : g.branches)
+            for (auto& n : b->nodes)
+                for (uint32_t c = 0; c < 2; c++)
+                    if (n->conv[c]) n->conv[c]->set_freewheel(on);
+    }
+
+    // longest processing time first: sort the branches by there
+    // measured cost and give each to the least loaded thread,
+    // on ties the rt thread wins, so it gets the heaviest branch
+    void schedule(Graph& g) noexcept {
+        const uint32_t nb = static_cast<uint32_t>(g.branches.size());
+        if (freewheel || g.workers.empty()) {
+            for (auto& b : g.branches) b->worker = 0;
+            return;
+        }
+        uint32_t order[MAX_BRANCHES];
+        for (uint32_t i = 0; i < nb; i++) order[i] = i;
+        std::sort(order, order + nb, [&g](uint32_t a, uint32_t b) {
+            return g.branches[a]->cost > g.branches[b]->cost; });
+        uint64_t load[MAX_BRANCHES] = {0};
+        const uint32_t slots = static_cast<uint32_t>(g.workers.size()) + 1;
+        for (uint32_t i = 0; i < nb; i++) {
+            uint32_t s = 0;
+            for (uint32_t k = 1; k < slots; k++)
+                if (load[k] < load[s]) s = k;
+            Branch& b = *g.branches[order[i]];
+            b.worker = s;
+            load[s] += std::max<uint64_t>(b.cost, 1);
+        }
+    }
+
+    static inline bool hasWork(const Graph& g, uint32_t worker) noexcept {
+        for (auto& b : g.branches)
+            if (b->worker == worker) return true;
+        return false;
+    }
+
+    // process all branches assigned to the worker (0 = rt thread)
+    static void runWorker(Graph& g, uint32_t worker) noexcept {
+        for (auto& b : g.branches)
+            if (b->worker == worker) runBranch(g, *b);
+    }
+
+    static void runBranch(const Graph& g, Branch& b) noexcept {
+        const uint64_t t = StageProfiler::now();
+        const uint32_t frames = g.frames;
+        float* l = b.buf[0];
+        float* r = b.buf[1];
+        for (auto& n : b.nodes) {
+            if (g.stereo) smooth::gain2(frames, l, r, l, r, n->gain);
+            else smooth::gain(frames, l, l, n->gain);
+            if (n->isModel) {
+                n->model[0]->compute(frames, l, l);
+                if (g.stereo) n->model[1]->compute(frames, r, r);
+            } else if (n->conv[0]->is_runnable()) {
+                n->conv[0]->compute(frames, l, l);
+                if (g.stereo && n->conv[1]->is_runnable()) n->conv[1]->compute(frames, r, r);
+            }
+        }
+        b.cost = (b.cost * 7 + (StageProfiler::now() - t)) / 8;
+    }
+
+    // load a model or IR node (non rt)
+    std::unique_ptr<Node> loadNode(const std::string& file, float gainDb, uint32_t blockSize) {
+        std::unique_ptr<Node> node(new Node());
+        node->isModel = isModelFile(file);
+        node->gain.reset(std::pow(1e+01, 0.05 * double(gainDb)));
+        if (node->isModel) {
+            const uint32_t ratio = std::min(static_cast<uint32_t>(MAX_UPSAMPLE),
+                                    static_cast<uint32_t>(std::ceil(192000.0 / rate)));
+            const size_t rsize = static_cast<size_t>(maxFrames) * std::max(ratio, 1u) + 16;
+            node->scratch.allocate((ScratchArena::pad(maxFrames) + ScratchArena::pad(rsize)) * channels);
+            for (uint32_t c = 0; c < channels; c++) {
+                node->model[c].reset(new ModelerSelector(SyncWait));
+                node->model[c]->init(rate);
+                node->model[c]->setScratch(node->scratch.take(maxFrames), maxFrames,
+                                           node->scratch.take(rsize), rsize);
+                node->model[c]->setModelFile(file);
+                if (!node->model[c]->loadModel()) return nullptr;
+            }
+        } else {
+            for (uint32_t c = 0; c < channels; c++) {
+                node->conv[c].reset(new ConvolverSelector(nullptr, levelWorkers));
+                ConvolverSelector* co = node->conv[c].get();
+                co->set_samplerate(rate);
+                co->set_buffersize(blockSize);
+                if (!co->configure(file, 1.0, 0, 0, 0, 0, 0)) return nullptr;
+                while (!co->checkstate());
+                if (!co->start(rt_prio, rt_policy)) return nullptr;
+            }
+        }
+        return node;
+    }
+
+    static bool isModelFile(const std::string& file) {
+        std::string::size_type idx = file.rfind('.');
+        if (idx == std::string::npos) return false;
+        std::string ext = file.substr(idx + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(),
+                        [](unsigned char c) { return std::tolower(c); });
+        return ext == "nam" || ext == "json" || ext == "aidax";
+    }
+
+    static std::vector<std::string> split(const std::string& s, char sep) {
+        std::vector<std::string> parts;
+        std::string::size_type start = 0;
+        std::string::size_type pos;
+        while ((pos = s.find(sep, start)) != std::string::npos) {
+            parts.push_back(s.substr(start, pos - start));
+            start = pos + 1;
+        }
+        parts.push_back(s.substr(start));
+        return parts;
+    }
+
+    static std::string trim(const std::string& s) {
+        std::string::size_type b = s.find_first_not_of(" \t\n\r");
+        if (b == std::string::npos) return "";
+        std::string::size_type e = s.find_last_not_of(" \t\n\r");
+        return s.substr(b, e - b + 1);
+    }
+
+    // strip a numeric "<tag>value" suffix from s and return the value
+    static float parseSuffix(std::string& s, char tag, float def) {
+        std::string::size_type pos = s.rfind(tag);
+        if (pos == std::string::npos) return def;
+        std::string v = trim(s.substr(pos + 1));
+        char* end = nullptr;
+        float value = strtof(v.c_str(), &end);
+        if (v.empty() || !end || *end) return def;
+        s = s.substr(0, pos);
+        return value;
+    }
+};
+
+}; // end namespace ratatouille
+
+#endif
@@ -16,7 +16,12 @@ RtNeuralModel::RtNeuralModel(std::condition_variable *Sync)
     : rawModel(nullptr), model(nullptr), smp(), SyncWait(Sync) {
     needResample = 0;
     phaseOffset = 0;
+    scratch = nullptr;
+    rscratch = nullptr;
+    scratchSize = 0;
+    rscratchSize = 0;
     isInited = false;
+    cacheBytes = 0;
     ready.store(false, std::memory_order_release);
     do_ramp.store(false, std::memory_order_release);
     do_ramp_down.store(false, std::memory_order_release);
@@ -47,6 +52,15 @@ void RtNeuralModel::connect(uint32_t port,void* data)
 {
 }
 
+// set the working buffers, count in compute() must not exceed frames
+void RtNeuralModel::setScratch(float *buf, int frames, float *rbuf, int rframes)
+{
+    scratch = buf;
+    scratchSize = frames;
+    rscratch = rbuf;
+    rscratchSize = rframes;
+}
+
 inline std::string RtNeuralModel::getModelFile() {
     return modelFile;
 }
@@ -63,11 +77,11 @@ inline void RtNeuralModel::normalize(int count, float *buf)
 
 inline void RtNeuralModel::compute(int count, float *input0, float *output0)
 {
-    if (!model ) return;
+    if (!model || !scratch) return;
     if (output0 != input0)
         memcpy(output0, input0, count*sizeof(float));
 
-    float bufa[count];
+    float* bufa = scratch;
     memcpy(bufa, output0, count*sizeof(float));
 
     //process model 
@@ -79,7 +93,7 @@ inline void RtNeuralModel::compute(int count, float *input0, float *output0)
             } else if (needResample == 2) {
                 ReCounta = static_cast<int>(ceil((count*static_cast<double>(modelSampleRate))/fSampleRate));
             }
-            float bufa1[ReCounta];
+            float* bufa1 = rscratch;
             memset(bufa1, 0, ReCounta*sizeof(float));
             if (needResample == 1) {
                 ReCounta = smp.up(count, bufa, bufa1);
@@ -127,54 +141,70 @@ inline void RtNeuralModel::compute(int count, float *input0, float *output0)
     }
 }
 
-void RtNeuralModel::get_samplerate(std::string config_file, int *mSampleRate) {
-    std::ifstream infile(config_file);
-    infile.imbue(std::locale::classic());
-    std::string line;
-    std::string key;
-    std::string value;
-    if (infile.is_open()) {
-        while (std::getline(infile, line)) {
-            std::istringstream buf(line);
-            buf >> key;
-            buf >> value;
-            if (key.compare("\"samplerate\":") == 0) {
-                value.erase(std::remove(value.begin(), value.end(), '\"'), value.end());
-                (*mSampleRate) = std::stoi(value);
-                break;
-            }
-            key.clear();
-            value.clear();
-        }
-        infile.close();
+// the sample rate the model was trained with, stored as number or string
+static int jsonSampleRate(const nlohmann::json& j) {
+    const auto it = j.find("samplerate");
+    if (it == j.end()) return 0;
+    try {
+        if (it->is_number()) return it->get<int>();
+        if (it->is_string()) return std::stoi(it->get<std::string>());
+    } catch (const std::exception&) {
     }
+    return 0;
 }
 
 // non rt callback
 bool RtNeuralModel::loadModel() {
     if (!modelFile.empty() && isInited) {
+        // a empty standby instance isn't in use by the rt thread, no need to wait
         if (model) {
             do_ramp_down.store(true, std::memory_order_release);
             std::unique_lock<std::mutex> lkr(WMutex);
             SyncIntern.wait_for(lkr, std::chrono::milliseconds(30));
+            lkr.unlock();
+           // fprintf(stderr, "Load file %s\n", modelFile.c_str());
+            std::unique_lock<std::mutex> lk(WMutex);
+            ready.store(false, std::memory_order_release);
+            SyncWait->wait_for(lk, std::chrono::milliseconds(60));
         }
-       // fprintf(stderr, "Load file %s\n", modelFile.c_str());
-        std::unique_lock<std::mutex> lk(WMutex);
         ready.store(false, std::memory_order_release);
-        SyncWait->wait_for(lk, std::chrono::milliseconds(60));
-        if (model != nullptr) model.reset(nullptr);
+        parkModel();
        // fprintf(stderr, "delete model\n");
         modelSampleRate = 0;
         needResample = 0;
         phaseOffset = 0;
         //clearState();
         int32_t warmUpSize = 4096;
-        try {
-            get_samplerate(std::string(modelFile), &modelSampleRate);
-            std::ifstream jsonStream(std::string(modelFile), std::ifstream::binary);
-            model = std::move(RTNeural::json_parser::parseJson<float>(jsonStream));
-        } catch (const std::exception&) {
-            modelFile = "None";
+        // a recently used model is taken ready to run from the cache
+        const std::string key = ModelCache::makeKey(modelFile, fSampleRate);
+        ModelCache::Entry cached;
+        const bool hit = ModelCache::get().take(key, cached);
+        // otherwise the compiled copy from the disk cache skip the text parse
+        nlohmann::json config;
+        ModelFileCache::Info info;
+        bool binary = false;
+        if (hit) {
+            model = std::move(cached.rtn);
+            modelSampleRate = cached.modelSampleRate;
+            phaseOffset = cached.phaseOffset;
+        } else {
+            try {
+                binary = ModelFileCache::loadJson(modelFile, config, info);
+                if (!binary) {
+                    std::ifstream jsonStream(std::string(modelFile), std::ifstream::binary);
+                    config = nlohmann::json::parse(jsonStream);
+                }
+                modelSampleRate = jsonSampleRate(config);
+                model = std::move(RTNeural::json_parser::parseJson<float>(config));
+                if (binary) phaseOffset = info.phaseOffset;
+            } catch (const std::exception&) {
+                modelFile = "None";
+            }
+            // give up when a newer request superseded this one
+            if (model && cancelled()) {
+                model.reset(nullptr);
+                modelFile = "None";
+            }
         }
         
         if (model) {
@@ -187,6 +217,17 @@ bool RtNeuralModel::loadModel() {
                 smp.setup(modelSampleRate, fSampleRate);
                 needResample = 2;
             } 
+            // the resampled block must fit into the scratch buffer
+            if (needResample == 1 && smp.max_out_count(scratchSize) > rscratchSize) {
+                fprintf(stderr, "model sample rate %iHz not supported at %iHz\n",
+                                            modelSampleRate, fSampleRate);
+                model.reset(nullptr);
+                needResample = 0;
+                modelFile = "None";
+            }
+        }
+
+        if (model && !hit && !binary) {
             // fprintf(stderr, "A: %s\n", modelFile.c_str());
 
             float* buffer = new float[warmUpSize];
@@ -198,10 +239,16 @@ bool RtNeuralModel::loadModel() {
             }
 
             for (int i0 = 0; i0 < warmUpSize; i0 = i0 + 1) {
+                // check every 512 samples if a newer request superseded this one
+                if (!(i0 & 511) && cancelled()) {
+                    model.reset(nullptr);
+                    modelFile = "None";
+                    break;
+                }
                 buffer[i0] = model->forward (&buffer[i0]);
             }
 
-            for(int i=0;i<2048;i++){
+            for(int i=0;model && i<2048;i++){
                 if (!std::signbit(buffer[i+1]) != !std::signbit(buffer[i])) {
                     phaseOffset = i;
                     break;
@@ -209,7 +256,17 @@ bool RtNeuralModel::loadModel() {
             }
 
             delete[] buffer;
+            // store the compiled copy for the next cold load
+            if (model) {
+                info.sampleRate = modelSampleRate;
+                info.phaseOffset = phaseOffset;
+                ModelFileCache::storeJson(modelFile, config, info);
+            }
         } 
+        if (model) {
+            cacheKey = key;
+            cacheBytes = hit ? cached.bytes : ModelCache::fileSize(modelFile);
+        }
         ready.store(true, std::memory_order_release);
         do_ramp.store(true, std::memory_order_release);
         do_ramp_down.store(false, std::memory_order_release);
@@ -224,7 +281,7 @@ void RtNeuralModel::unloadModel() {
     std::unique_lock<std::mutex> lk(WMutex);
     ready.store(false, std::memory_order_release);
     SyncWait->wait_for(lk, std::chrono::milliseconds(160));
-    model.reset(nullptr);
+    parkModel();
    // fprintf(stderr, "delete model\n");
     modelSampleRate = 0;
     needResample = 0;
@@ -235,16 +292,25 @@ void RtNeuralModel::unloadModel() {
 
 void RtNeuralModel::cleanUp() {
     ready.store(false, std::memory_order_release);
-    if (model != nullptr) {
-        rawModel = model.release();
-        model.get_deleter()(rawModel);
-        rawModel = nullptr;
-        model = nullptr;
-    }
+    parkModel();
     modelSampleRate = 0;
     needResample = 0;
     modelFile = "None";
     ready.store(true, std::memory_order_release);
 }
 
+// hand the model over to the ModelCache, it's deleted there when
+// the cache is full or disabled, not in use by the rt thread
+void RtNeuralModel::parkModel() {
+    if (model == nullptr) return;
+    ModelCache::Entry e;
+    e.rtn = std::move(model);
+    e.modelSampleRate = modelSampleRate;
+    e.phaseOffset = phaseOffset;
+    e.bytes = cacheBytes;
+    ModelCache::get().put(cacheKey, std::move(e));
+    model = nullptr;
+    cacheKey.clear();
+}
+
 } // end namespace ratatouille
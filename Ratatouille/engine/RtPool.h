@@ -0,0 +1,273 @@
+/*
+ * RtPool.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** RtPool - process wide pool of real-time worker threads
+ *
+ *  When enabled by the environment variable
+ *  RATATOUILLE_SHARED_POOL, all ParallelThreads which opt in
+ *  (slot B, conv1, buffered mode and the convolver tail) submit
+ *  their work as task to one pool shared by all instances in the
+ *  host process, instead of running a own thread each.
+ *  So the thread count stays flat while the instance count grows.
+ *
+ *  RATATOUILLE_SHARED_POOL=1 use one worker per core minus one
+ *  RATATOUILLE_SHARED_POOL=n use n workers
+ *
+ *  The task queue is a bounded lock free multi producer,
+ *  multi consumer ring, so submitting a task is real-time safe.
+ *  The pool is reference counted and stops the workers when the
+ *  last user releases it.
+ *  A task may submit tasks itself and wait for them. A pool worker
+ *  which wait run the queued tasks meanwhile (runOne), so the
+ *  awaited task can't get stuck behind the blocked worker.
+ */
+
+#if defined(_WIN32)
+#define MINGW_STDTHREAD_REDUNDANCY_WARNING
+#include <windows.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include <pthread.h>
+
+#pragma once
+
+#ifndef RT_POOL_H_
+#define RT_POOL_H_
+
+class RtPool
+{
+public:
+    typedef void (*TaskFunc)(void*);
+
+    // check if the shared pool is requested by the environment
+    static bool enabled() noexcept {
+        static const bool on = [] {
+            const char* env = getenv("RATATOUILLE_SHARED_POOL");
+            return env && env[0] && env[0] != '0';
+        }();
+        return on;
+    }
+
+    // get the shared pool, start the workers on first use
+    static RtPool* acquire() {
+        std::lock_guard<std::mutex> lk(instanceMutex());
+        RtPool*& pool = instance();
+        if (!pool) pool = new RtPool(workerCount());
+        pool->users++;
+        return pool;
+    }
+
+    // release the shared pool, stop the workers when unused
+    static void release() {
+        std::lock_guard<std::mutex> lk(instanceMutex());
+        RtPool*& pool = instance();
+        if (pool && --pool->users == 0) {
+            delete pool;
+            pool = nullptr;
+        }
+    }
+
+    // raise the scheduling priority of the workers when requested
+    void setPriority(int32_t rt_prio, int32_t rt_policy) noexcept {
+        std::lock_guard<std::mutex> lk(prioMutex);
+        if (rt_policy == policy && rt_prio <= prio) return;
+        prio = rt_prio;
+        policy = rt_policy;
+        for (auto& t : workers) setThreadPolicy(t, prio, policy);
+    }
+
+    // queue a task, real-time safe, return false when the queue is full
+    bool submit(TaskFunc func, void* arg) noexcept {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells[pos & (QSIZE - 1)];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->func = func;
+        cell->arg = arg;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        signal.fetch_add(1, std::memory_order_release);
+        #if __cplusplus > 201703L
+        signal.notify_one();
+        #else
+        wakeUp.notify_one();
+        #endif
+        return true;
+    }
+
+    uint32_t size() const noexcept {
+        return static_cast<uint32_t>(workers.size());
+    }
+
+    // true when the calling thread is a worker of the pool
+    static bool onWorker() noexcept {
+        return isWorker();
+    }
+
+    // run one queued task in the calling thread, false when the queue
+    // is empty. Used by a pool worker waiting for a nested task (rt)
+    bool runOne() noexcept {
+        TaskFunc func;
+        void* arg;
+        if (!pop(&func, &arg)) return false;
+        func(arg);
+        return true;
+    }
+
+private:
+    static constexpr size_t QSIZE = 256;
+
+    struct Cell {
+        std::atomic<size_t>     seq;
+        TaskFunc                func;
+        void*                   arg;
+    };
+
+    Cell                        cells[QSIZE];
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) std::atomic<uint32_t> signal;
+    std::atomic<bool>           running;
+    std::vector<std::thread>    workers;
+    std::mutex                  prioMutex;
+    #if __cplusplus <= 201703L
+    std::mutex                  waitMutex;
+    std::condition_variable     wakeUp;
+    #endif
+    uint32_t                    users;
+    int32_t                     prio;
+    int32_t                     policy;
+
+    static RtPool*& instance() {
+        static RtPool* pool = nullptr;
+        return pool;
+    }
+
+    static std::mutex& instanceMutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    static bool& isWorker() noexcept {
+        static thread_local bool worker = false;
+        return worker;
+    }
+
+    static uint32_t workerCount() {
+        const char* env = getenv("RATATOUILLE_SHARED_POOL");
+        int n = env ? atoi(env) : 0;
+        if (n > 1) return static_cast<uint32_t>(n);
+        uint32_t cores = std::thread::hardware_concurrency();
+        return cores > 2 ? cores - 1 : 1;
+    }
+
+    explicit RtPool(uint32_t count)
+        : head(0), tail(0), signal(0), running(true), users(0), prio(0), policy(0) {
+        for (size_t i = 0; i < QSIZE; i++)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < count; i++)
+            workers.emplace_back([this]() { work(); });
+    }
+
+    ~RtPool() {
+        running.store(false, std::memory_order_release);
+        signal.fetch_add(1, std::memory_order_release);
+        #if __cplusplus > 201703L
+        signal.notify_all();
+        #else
+        wakeUp.notify_all();
+        #endif
+        for (auto& t : workers) if (t.joinable()) t.join();
+    }
+
+    bool pop(TaskFunc* func, void** arg) noexcept {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells[pos & (QSIZE - 1)];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        *func = cell->func;
+        *arg = cell->arg;
+        cell->seq.store(pos + QSIZE, std::memory_order_release);
+        return true;
+    }
+
+    // worker loop, run queued tasks or sleep until a new one arrives
+    void work() noexcept {
+        TaskFunc func;
+        void* arg;
+        isWorker() = true;
+        while (running.load(std::memory_order_acquire)) {
+            uint32_t s = signal.load(std::memory_order_acquire);
+            if (pop(&func, &arg)) {
+                func(arg);
+                continue;
+            }
+            #if __cplusplus > 201703L
+            signal.wait(s, std::memory_order_acquire);
+            #else
+            std::unique_lock<std::mutex> lk(waitMutex);
+            wakeUp.wait_for(lk, std::chrono::milliseconds(1), [this, s]() {
+                return signal.load(std::memory_order_acquire) != s; });
+            #endif
+        }
+    }
+
+    // set thread scheduling class and priority level
+    static void setThreadPolicy(std::thread& t, int32_t rt_prio, int32_t rt_policy) noexcept {
+        #if defined(__linux__) || defined(_UNIX) || defined(__APPLE__) || defined(_OS_UNIX_)
+        sched_param sch_params;
+        if (rt_prio == 0) {
+            rt_prio = sched_get_priority_max(rt_policy);
+        }
+        if ((rt_prio/5) > 0) rt_prio = rt_prio/5;
+        sch_params.sched_priority = rt_prio;
+        if (pthread_setschedparam(t.native_handle(), rt_policy, &sch_params)) {
+            fprintf(stderr, "RtPool: fail to set priority\n");
+        }
+        #elif defined(_WIN32)
+        if (SetThreadPriority(t.native_handle(), 24)) {
+            fprintf(stderr, "RtPool: fail to set priority\n");
+        }
+        #else
+        //system does not supports thread priority!
+        #endif
+    }
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * ScratchArena.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** ScratchArena - one 64 byte aligned memory block for the
+ *                 working buffers of the audio path
+ *
+ *  The arena is allocated once outside the real-time context and
+ *  carved into aligned float slices, so the process functions
+ *  don't need variable length arrays on the stack and never
+ *  allocate memory.
+ *
+ *  usage:
+ *      // reserve room for all slices (non rt)
+ *      arena.allocate(ScratchArena::pad(frames) * 2);
+ *      float* bufa = arena.take(frames);
+ *      float* bufb = arena.take(frames);
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#pragma once
+
+#ifndef SCRATCH_ARENA_H_
+#define SCRATCH_ARENA_H_
+
+namespace ratatouille {
+
+class ScratchArena {
+public:
+    static constexpr size_t ALIGN = 64;
+
+    ScratchArena() : data(nullptr), size(0), used(0) {}
+    ~ScratchArena() { release(); }
+
+    // round a number of floats up to a multiple of the alignment
+    static inline size_t pad(size_t floats) noexcept {
+        const size_t n = ALIGN / sizeof(float);
+        return (floats + n - 1) & ~(n - 1);
+    }
+
+    // allocate the memory block for the given number of floats (non rt)
+    inline bool allocate(size_t floats) {
+        release();
+        size = pad(floats);
+        if (!size) return false;
+#if defined(_WIN32)
+        data = static_cast<float*>(_aligned_malloc(size * sizeof(float), ALIGN));
+#else
+        data = static_cast<float*>(std::aligned_alloc(ALIGN, size * sizeof(float)));
+#endif
+        if (!data) {
+            fprintf(stderr, "ScratchArena: fail to allocate %zu bytes\n", size * sizeof(float));
+            size = 0;
+            return false;
+        }
+        memset(data, 0, size * sizeof(float));
+        return true;
+    }
+
+    // get the next aligned slice, returns nullptr when the arena is exhausted
+    inline float* take(size_t floats) noexcept {
+        floats = pad(floats);
+        if (!data || used + floats > size) return nullptr;
+        float* slice = data + used;
+        used += floats;
+        return slice;
+    }
+
+    // zero the whole block, the slices stay valid
+    inline void clear() noexcept {
+        if (data) memset(data, 0, size * sizeof(float));
+    }
+
+    inline void release() noexcept {
+#if defined(_WIN32)
+        if (data) _aligned_free(data);
+#else
+        free(data);
+#endif
+        data = nullptr;
+        size = 0;
+        used = 0;
+    }
+
+private:
+    float*      data;
+    size_t      size;
+    size_t      used;
+};
+
+}; // end namespace ratatouille
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ * Smoother.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** Smoother - block based one pole parameter smoothing
+ *
+ *  The per sample recursion y[n] = (1-p) * T + p * y[n-1]
+ *  has the closed form y[n] = T + (y[0] - T) * p^n, so a whole
+ *  vector of gains could be computed without the loop carried
+ *  dependency. Once the value reached the target the ramp is
+ *  skipped and the kernels fall back to a plain multiply.
+ *
+ *  The kernels use AVX, SSE or NEON when available and fuse the
+ *  gain, blend and mix stages, so each stage is a single pass
+ *  over the buffers. The *2 variants apply one ramp to a left
+ *  and a right channel in the same pass.
+ *
+ *  usage:
+ *      Smoother gain;
+ *      gain.reset(0.0);
+ *      gain.setTarget(std::pow(10.0, 0.05 * dB));
+ *      smooth::gain(n_samples, buf, buf, gain);
+ */
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#pragma once
+
+#ifndef SMOOTHER_H_
+#define SMOOTHER_H_
+
+namespace ratatouille {
+
+/////////////////////////// SIMD HELPERS   //////////////////////////////
+
+namespace simd {
+
+#if defined(__AVX__)
+typedef __m256 vfloat;
+static constexpr uint32_t W = 8;
+static inline vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+static inline void store(float* p, vfloat v) { _mm256_storeu_ps(p, v); }
+static inline vfloat set1(float v) { return _mm256_set1_ps(v); }
+static inline vfloat setr(const float* v) { return _mm256_loadu_ps(v); }
+static inline vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+static inline vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+#elif defined(__SSE__)
+typedef __m128 vfloat;
+static constexpr uint32_t W = 4;
+static inline vfloat load(const float* p) { return _mm_loadu_ps(p); }
+static inline void store(float* p, vfloat v) { _mm_storeu_ps(p, v); }
+static inline vfloat set1(float v) { return _mm_set1_ps(v); }
+static inline vfloat setr(const float* v) { return _mm_loadu_ps(v); }
+static inline vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+static inline vfloat sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+static inline vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+typedef float32x4_t vfloat;
+static constexpr uint32_t W = 4;
+static inline vfloat load(const float* p) { return vld1q_f32(p); }
+static inline void store(float* p, vfloat v) { vst1q_f32(p, v); }
+static inline vfloat set1(float v) { return vdupq_n_f32(v); }
+static inline vfloat setr(const float* v) { return vld1q_f32(v); }
+static inline vfloat add(vfloat a, vfloat b) { return vaddq_f32(a, b); }
+static inline vfloat sub(vfloat a, vfloat b) { return vsubq_f32(a, b); }
+static inline vfloat mul(vfloat a, vfloat b) { return vmulq_f32(a, b); }
+#else
+typedef float vfloat;
+static constexpr uint32_t W = 1;
+static inline vfloat load(const float* p) { return *p; }
+static inline void store(float* p, vfloat v) { *p = v; }
+static inline vfloat set1(float v) { return v; }
+static inline vfloat setr(const float* v) { return *v; }
+static inline vfloat add(vfloat a, vfloat b) { return a + b; }
+static inline vfloat sub(vfloat a, vfloat b) { return a - b; }
+static inline vfloat mul(vfloat a, vfloat b) { return a * b; }
+#endif
+
+} // end namespace simd
+
+/////////////////////////// SMOOTHER   //////////////////////////////////
+
+class Smoother {
+public:
+    Smoother() {
+        setPole(0.999);
+        reset(0.0);
+    }
+
+    // set the pole of the one pole filter (the default matches the faust smoothers)
+    inline void setPole(double pole) {
+        p = pole;
+        double pk = 1.0;
+        for (uint32_t i = 0; i < simd::W; i++) {
+            pk *= p;
+            lanes[i] = static_cast<float>(pk);
+        }
+        pW = pk;
+    }
+
+    inline void reset(double value) {
+        y = value;
+        target = value;
+    }
+
+    inline void setTarget(double value) {
+        target = value;
+    }
+
+    // true when the value reached the target
+    inline bool isSteady() const {
+        return std::fabs(y - target) < 1e-6;
+    }
+
+    inline float value() const {
+        return static_cast<float>(y);
+    }
+
+    // start a ramp block, returns true when no ramp is needed
+    inline bool begin() {
+        if (isSteady()) {
+            y = target;
+            return true;
+        }
+        d = y - target;
+        pk = 1.0;
+        vlanes = simd::setr(lanes);
+        return false;
+    }
+
+    // gains for the next simd::W samples
+    inline simd::vfloat next() {
+        simd::vfloat g = simd::add(simd::set1(static_cast<float>(target)),
+                         simd::mul(simd::set1(static_cast<float>(d * pk)), vlanes));
+        pk *= pW;
+        return g;
+    }
+
+    // gain for the next single sample
+    inline float nextScalar() {
+        pk *= p;
+        return static_cast<float>(target + d * pk);
+    }
+
+    // store the state at the end of a ramp block
+    inline void end() {
+        y = target + d * pk;
+        if (isSteady()) y = target;
+    }
+
+private:
+    double          y;
+    double          target;
+    double          p;
+    double          pW;
+    double          d;
+    double          pk;
+    float           lanes[simd::W];
+    simd::vfloat    vlanes;
+};
+
+/////////////////////////// KERNELS   ///////////////////////////////////
+
+namespace smooth {
+
+// out = in * gain
+static inline void gain(uint32_t n, const float* in, float* out, Smoother& g) {
+    uint32_t i = 0;
+    const uint32_t nv = n - n % simd::W;
+    if (g.begin()) {
+        const simd::vfloat vg = simd::set1(g.value());
+        for (; i < nv; i += simd::W)
+            simd::store(out + i, simd::mul(simd::load(in + i), vg));
+        for (; i < n; i++) out[i] = in[i] * g.value();
+        return;
+    }
+    for (; i < nv; i += simd::W)
+        simd::store(out + i, simd::mul(simd::load(in + i), g.next()));
+    for (; i < n; i++) out[i] = in[i] * g.nextScalar();
+    g.end();
+}
+
+// out = a + (b - a) * mix
+static inline void mix(uint32_t n, const float* a, const float* b, float* out, Smoother& m) {
+    uint32_t i = 0;
+    const uint32_t nv = n - n % simd::W;
+    if (m.begin()) {
+        const float fm = m.value();
+        const simd::vfloat vm = simd::set1(fm);
+        for (; i < nv; i += simd::W) {
+            simd::vfloat va = simd::load(a + i);
+            simd::store(out + i, simd::add(va, simd::mul(simd::sub(simd::load(b + i), va), vm)));
+        }
+        for (; i < n; i++) out[i] = a[i] + (b[i] - a[i]) * fm;
+        return;
+    }
+    for (; i < nv; i += simd::W) {
+        simd::vfloat va = simd::load(a + i);
+        simd::store(out + i, simd::add(va, simd::mul(simd::sub(simd::load(b + i), va), m.next())));
+    }
+    for (; i < n; i++) out[i] = a[i] + (b[i] - a[i]) * m.nextScalar();
+    m.end();
+}
+
+// out = (a + (b - a) * mix) * gain
+static inline void mixGain(uint32_t n, const float* a, const float* b, float* out,
+                                                    Smoother& m, Smoother& g) {
+    const bool ms = m.begin();
+    const bool gs = g.begin();
+    uint32_t i = 0;
+    const uint32_t nv = n - n % simd::W;
+    if (ms && gs) {
+        const float fm = m.value();
+        const float fg = g.value();
+        const simd::vfloat vm = simd::set1(fm);
+        const simd::vfloat vg = simd::set1(fg);
+        for (; i < nv; i += simd::W) {
+            simd::vfloat va = simd::load(a + i);
+            simd::vfloat vb = simd::load(b + i);
+            simd::store(out + i, simd::mul(simd::add(va, simd::mul(simd::sub(vb, va), vm)), vg));
+        }
+        for (; i < n; i++) out[i] = (a[i] + (b[i] - a[i]) * fm) * fg;
+        return;
+    }
+    for (; i < nv; i += simd::W) {
+        simd::vfloat vm = ms ? simd::set1(m.value()) : m.next();
+        simd::vfloat vg = gs ? simd::set1(g.value()) : g.next();
+        simd::vfloat va = simd::load(a + i);
+        simd::vfloat vb = simd::load(b + i);
+        simd::store(out + i, simd::mul(simd::add(va, simd::mul(simd::sub(vb, va), vm)), vg));
+    }
+    for (; i < n; i++) {
+        float fm = ms ? m.value() : m.nextScalar();
+        float fg = gs ? g.value() : g.nextScalar();
+        out[i] = (a[i] + (b[i] - a[i]) * fm) * fg;
+    }
+    if (!ms) m.end();
+    if (!gs) g.end();
+}
+
+// outL = inL * gain, outR = inR * gain
+static inline void gain2(uint32_t n, const float* inL, const float* inR,
+                            float* outL, float* outR, Smoother& g) {
+    uint32_t i = 0;
+    const uint32_t nv = n - n % simd::W;
+    if (g.begin()) {
+        const float fg = g.value();
+        const simd::vfloat vg = simd::set1(fg);
+        for (; i < nv; i += simd::W) {
+            simd::store(outL + i, simd::mul(simd::load(inL + i), vg));
+            simd::store(outR + i, simd::mul(simd::load(inR + i), vg));
+        }
+        for (; i < n; i++) {
+            outL[i] = inL[i] * fg;
+            outR[i] = inR[i] * fg;
+        }
+        return;
+    }
+    for (; i < nv; i += simd::W) {
+        const simd::vfloat vg = g.next();
+        simd::store(outL + i, simd::mul(simd::load(inL + i), vg));
+        simd::store(outR + i, simd::mul(simd::load(inR + i), vg));
+    }
+    for (; i < n; i++) {
+        const float fg = g.nextScalar();
+        outL[i] = inL[i] * fg;
+        outR[i] = inR[i] * fg;
+    }
+    g.end();
+}
+
+// outL = aL + (bL - aL) * mix, outR = aR + (bR - aR) * mix
+static inline void mix2(uint32_t n, const float* aL, const float* bL,
+                        const float* aR, const float* bR,
+                        float* outL, float* outR, Smoother& m) {
+    uint32_t i = 0;
+    const uint32_t nv = n - n % simd::W;
+    const bool ms = m.begin();
+    const float fm = m.value();
+    for (; i < nv; i += simd::W) {
+        const simd::vfloat vm = ms ? simd::set1(fm) : m.next();
+        simd::vfloat va = simd::load(aL + i);
+        simd::store(outL + i, simd::add(va, simd::mul(simd::sub(simd::load(bL + i), va), vm)));
+        va = simd::load(aR + i);
+        simd::store(outR + i, simd::add(va, simd::mul(simd::sub(simd::load(bR + i), va), vm)));
+    }
+    for (; i < n; i++) {
+        const float f = ms ? fm : m.nextScalar();
+        outL[i] = aL[i] + (bL[i] - aL[i]) * f;
+        outR[i] = aR[i] + (bR[i] - aR[i]) * f;
+    }
+    if (!ms) m.end();
+}
+
+// outL = (aL + (bL - aL) * mix) * gain, outR = (aR + (bR - aR) * mix) * gain
+static inline void mixGain2(uint32_t n, const float* aL, const float* bL,
+                            const float* aR, const float* bR,
+                            float* outL, float* outR, Smoother& m, Smoother& g) {
+    const bool ms = m.begin();
+    const bool gs = g.begin();
+    const float fm = m.value();
+    const float fg = g.value();
+    uint32_t i = 0;
+    const uint32_t nv = n - n % simd::W;
+    for (; i < nv; i += simd::W) {
+        const simd::vfloat vm = ms ? simd::set1(fm) : m.next();
+        const simd::vfloat vg = gs ? simd::set1(fg) : g.next();
+        simd::vfloat va = simd::load(aL + i);
+        simd::store(outL + i, simd::mul(simd::add(va, simd::mul(simd::sub(simd::load(bL + i), va), vm)), vg));
+        va = simd::load(aR + i);
+        simd::store(outR + i, simd::mul(simd::add(va, simd::mul(simd::sub(simd::load(bR + i), va), vm)), vg));
+    }
+    for (; i < n; i++) {
+        const float m1 = ms ? fm : m.nextScalar();
+        const float g1 = gs ? fg : g.nextScalar();
+        outL[i] = (aL[i] + (bL[i] - aL[i]) * m1) * g1;
+        outR[i] = (aR[i] + (bR[i] - aR[i]) * m1) * g1;
+    }
+    if (!ms) m.end();
+    if (!gs) g.end();
+}
+
+} // end namespace smooth
+
+}; // end namespace ratatouille
+
+#endif
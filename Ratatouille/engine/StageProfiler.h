@@ -0,0 +1,245 @@
+/*
+ * StageProfiler.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** StageProfiler - lock free timing histograms for the stages
+ *                  of Engine::processDsp
+ *
+ *  Each stage of a process cycle gets time stamped with the cpu
+ *  time stamp counter (or std::chrono::steady_clock when rdtsc
+ *  isn't available). The measured duration goes into a log2
+ *  histogram with 4 sub buckets per octave, so recording is a
+ *  handful of relaxed atomic operations and never blocks.
+ *  Stages running in the parallel threads (slot B, conv1, the
+ *  buffered model stage) record into the same histograms.
+ *
+ *  The histograms are double buffered. Once per window (~250ms of
+ *  audio) the audio thread folds the buffer which was swapped out
+ *  a window before, so no stage write into it anymore, into
+ *  min/mean/p99/max values in micro seconds, resets it and swap it
+ *  in with a atomic index. The values lag one window behind.
+ *  The published values could be read from any thread.
+ *
+ *  usage:
+ *      profiler.init(sampleRate);
+ *      uint64_t t = profiler.now();
+ *      compute();
+ *      t = profiler.lap(StageProfiler::SLOT_A, t);
+ *      ...
+ *      profiler.publish(n_samples);
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_USE_TSC 1
+#endif
+
+#pragma once
+
+#ifndef STAGE_PROFILER_H_
+#define STAGE_PROFILER_H_
+
+namespace ratatouille {
+
+class StageProfiler {
+public:
+    // keep in sync with the port list in Ratatouille.ttl
+    // and PROFILE_STAGES in gui/widgets.h
+    enum Stage {
+        CDELAY = 0,
+        PDELAY,
+        GAIN_A,
+        GAIN_B,
+        SLOT_A,
+        SLOT_B,
+        WAIT_SLOT_B,
+        DCBLOCKER,
+        CONV,
+        CONV1,
+        WAIT_CONV1,
+        PERIOD,
+        STAGES
+    };
+
+    enum Value {
+        MIN = 0,
+        MEAN,
+        P99,
+        MAX,
+        VALUES
+    };
+
+    // published statistic in micro seconds, indexed [stage][value]
+    std::atomic<float>          stats[STAGES][VALUES];
+
+    StageProfiler() {
+        windowSamples = 0;
+        windowSize = 12000;
+        usPerTick = 0.001;
+        active.store(0, std::memory_order_relaxed);
+        for (uint32_t s = 0; s < STAGES; s++) {
+            reset(hist[0][s]);
+            reset(hist[1][s]);
+            for (uint32_t v = 0; v < VALUES; v++)
+                stats[s][v].store(0.0f, std::memory_order_relaxed);
+        }
+    }
+
+    // short display name for a stage
+    static const char* name(uint32_t stage) noexcept {
+        static const char* names[STAGES] = {
+            "Delta Delay", "Phase Correction", "Input A", "Input B",
+            "Slot A", "Slot B", "Wait Slot B", "DC Blocker",
+            "IR", "IR1", "Wait IR1", "Period"
+        };
+        return stage < STAGES ? names[stage] : "";
+    }
+
+    inline void init(uint32_t rate) {
+        windowSize = rate / 4;
+        windowSamples = 0;
+        usPerTick = 1.0 / ticksPerUs();
+    }
+
+    // get a time stamp in ticks
+    static inline uint64_t now() noexcept {
+#ifdef PROFILER_USE_TSC
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // record the time passed since start for stage
+    inline void record(uint32_t stage, uint64_t start) noexcept {
+        add(hist[active.load(std::memory_order_acquire)][stage], now() - start);
+    }
+
+    // record the time passed since start for stage and return a new start
+    inline uint64_t lap(uint32_t stage, uint64_t start) noexcept {
+        uint64_t t = now();
+        add(hist[active.load(std::memory_order_acquire)][stage], t - start);
+        return t;
+    }
+
+    // called once at the end of a process cycle from the audio thread
+    inline void publish(uint32_t n_samples) noexcept {
+        windowSamples += n_samples;
+        if (windowSamples < windowSize) return;
+        windowSamples = 0;
+        // swapped out a window ago, no stage record into it anymore
+        const uint32_t idle = 1 - active.load(std::memory_order_relaxed);
+        for (uint32_t s = 0; s < STAGES; s++) {
+            Histogram& h = hist[idle][s];
+            uint64_t count = h.count.load(std::memory_order_relaxed);
+            if (!count) {
+                for (uint32_t v = 0; v < VALUES; v++)
+                    stats[s][v].store(0.0f, std::memory_order_relaxed);
+                continue;
+            }
+            uint64_t maxT = h.max.load(std::memory_order_relaxed);
+            uint64_t target = count - count / 100;
+            uint64_t sum = 0;
+            uint64_t p99 = maxT;
+            for (uint32_t b = 0; b < BUCKETS; b++) {
+                sum += h.bucket[b].load(std::memory_order_relaxed);
+                if (sum >= target) {
+                    p99 = std::min(upperBound(b), maxT);
+                    break;
+                }
+            }
+            stats[s][MIN].store(h.min.load(std::memory_order_relaxed) * usPerTick, std::memory_order_relaxed);
+            stats[s][MEAN].store((double(h.sum.load(std::memory_order_relaxed)) / count) * usPerTick, std::memory_order_relaxed);
+            stats[s][P99].store(p99 * usPerTick, std::memory_order_relaxed);
+            stats[s][MAX].store(maxT * usPerTick, std::memory_order_relaxed);
+            reset(h);
+        }
+        active.store(idle, std::memory_order_release);
+    }
+
+private:
+    static constexpr uint32_t BUCKETS = 128;
+
+    struct Histogram {
+        std::atomic<uint64_t>   count;
+        std::atomic<uint64_t>   sum;
+        std::atomic<uint64_t>   min;
+        std::atomic<uint64_t>   max;
+        std::atomic<uint32_t>   bucket[BUCKETS];
+    };
+
+    Histogram                   hist[2][STAGES];
+    // the buffer the stages record into
+    std::atomic<uint32_t>       active;
+    uint32_t                    windowSamples;
+    uint32_t                    windowSize;
+    double                      usPerTick;
+
+    // log2 bucket with 2 bit sub bucket resolution
+    static inline uint32_t bucketIndex(uint64_t t) noexcept {
+        if (t < 4) return static_cast<uint32_t>(t);
+        uint32_t msb = 63 - __builtin_clzll(t);
+        uint32_t idx = msb * 4 + static_cast<uint32_t>((t >> (msb - 2)) & 3) - 4;
+        return idx < BUCKETS ? idx : BUCKETS - 1;
+    }
+
+    static inline uint64_t upperBound(uint32_t idx) noexcept {
+        if (idx < 4) return idx;
+        uint32_t msb = (idx + 4) / 4;
+        uint64_t sub = (idx + 4) % 4;
+        return ((5 + sub) << (msb - 2)) - 1;
+    }
+
+    static inline void reset(Histogram& h) noexcept {
+        h.count.store(0, std::memory_order_relaxed);
+        h.sum.store(0, std::memory_order_relaxed);
+        h.min.store(UINT64_MAX, std::memory_order_relaxed);
+        h.max.store(0, std::memory_order_relaxed);
+        for (uint32_t b = 0; b < BUCKETS; b++)
+            h.bucket[b].store(0, std::memory_order_relaxed);
+    }
+
+    static inline void add(Histogram& h, uint64_t t) noexcept {
+        h.count.fetch_add(1, std::memory_order_relaxed);
+        h.sum.fetch_add(t, std::memory_order_relaxed);
+        h.bucket[bucketIndex(t)].fetch_add(1, std::memory_order_relaxed);
+        uint64_t m = h.min.load(std::memory_order_relaxed);
+        while (t < m && !h.min.compare_exchange_weak(m, t, std::memory_order_relaxed));
+        m = h.max.load(std::memory_order_relaxed);
+        while (t > m && !h.max.compare_exchange_weak(m, t, std::memory_order_relaxed));
+    }
+
+    // calibrate the tick rate once per process
+    static double ticksPerUs() {
+#ifdef PROFILER_USE_TSC
+        static const double rate = [] {
+            auto t0 = std::chrono::steady_clock::now();
+            uint64_t c0 = __rdtsc();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            uint64_t c1 = __rdtsc();
+            auto t1 = std::chrono::steady_clock::now();
+            double us = std::chrono::duration<double, std::micro>(t1 - t0).count();
+            return us > 0.0 ? double(c1 - c0) / us : 1000.0;
+        }();
+        return rate;
+#else
+        return 1000.0;
+#endif
+    }
+};
+
+}; // end namespace ratatouille
+
+#endif
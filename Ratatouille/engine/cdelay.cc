@@ -10,6 +10,7 @@ private:
 	uint32_t fSampleRate;
 	int IOTA0;
 	double fVec0[16384];
+	double fVec1[16384];
 	float *fHslider0_;
 	double fRec4[2];
 	double fRec0[2];
@@ -25,6 +26,8 @@ public:
 	void clear_state_f();
 	void init(uint32_t sample_rate);
 	void compute(int count, float *input0, float *output0);
+	void compute_stereo(int count, float *input0, float *input1,
+	                                float *output0, float *output1);
 	Dsp();
 	~Dsp();
 };
@@ -39,6 +42,7 @@ Dsp::~Dsp() {
 inline void Dsp::clear_state_f()
 {
 	for (int l0 = 0; l0 < 16384; l0 = l0 + 1) fVec0[l0] = 0.0;
+	for (int l6 = 0; l6 < 16384; l6 = l6 + 1) fVec1[l6] = 0.0;
 	for (int l1 = 0; l1 < 2; l1 = l1 + 1) fRec4[l1] = 0.0;
 	for (int l2 = 0; l2 < 2; l2 = l2 + 1) fRec0[l2] = 0.0;
 	for (int l3 = 0; l3 < 2; l3 = l3 + 1) fRec1[l3] = 0.0;
@@ -76,6 +80,36 @@ void Dsp::compute(int count, float *input0, float *output0)
 	}
 }
 
+// process both channels in one pass, the cross fade state is
+// computed once and used for both delay lines
+void Dsp::compute_stereo(int count, float *input0, float *input1,
+                                    float *output0, float *output1)
+{
+	double fSlow0 = 0.0001000000000000009 * std::fabs(delay);
+	for (int i0 = 0; i0 < count; i0 = i0 + 1) {
+		fVec0[IOTA0 & 16383] = double(input0[i0]);
+		fVec1[IOTA0 & 16383] = double(input1[i0]);
+		fRec4[0] = fSlow0 + 0.9999 * fRec4[1];
+		double fTemp1 = ((fRec0[1] != 0.0) ? (((fRec1[1] > 0.0) & (fRec1[1] < 1.0)) ? fRec0[1] : 0.0) : (((fRec1[1] == 0.0) & (fRec4[0] != fRec2[1])) ? 0.0009765625 : (((fRec1[1] == 1.0) & (fRec4[0] != fRec3[1])) ? -0.0009765625 : 0.0)));
+		fRec0[0] = fTemp1;
+		fRec1[0] = std::max<double>(0.0, std::min<double>(1.0, fRec1[1] + fTemp1));
+		fRec2[0] = (((fRec1[1] >= 1.0) & (fRec3[1] != fRec4[0])) ? fRec4[0] : fRec2[1]);
+		fRec3[0] = (((fRec1[1] <= 0.0) & (fRec2[1] != fRec4[0])) ? fRec4[0] : fRec3[1]);
+		int iRead0 = (IOTA0 - int(std::min<double>(8192.0, std::max<double>(0.0, fRec2[0])))) & 16383;
+		int iRead1 = (IOTA0 - int(std::min<double>(8192.0, std::max<double>(0.0, fRec3[0])))) & 16383;
+		double fTemp2 = fVec0[iRead0];
+		output0[i0] = float(fTemp2 + fRec1[0] * (fVec0[iRead1] - fTemp2));
+		double fTemp3 = fVec1[iRead0];
+		output1[i0] = float(fTemp3 + fRec1[0] * (fVec1[iRead1] - fTemp3));
+		IOTA0 = IOTA0 + 1;
+		fRec4[1] = fRec4[0];
+		fRec0[1] = fRec0[0];
+		fRec1[1] = fRec1[0];
+		fRec2[1] = fRec2[0];
+		fRec3[1] = fRec3[0];
+	}
+}
+
 void Dsp::connect(uint32_t port,void* data)
 {
 	switch (port)
@@ -8,6 +8,10 @@
 
 #include <cmath>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace dcblocker {
 
 class Dsp {
@@ -17,6 +21,9 @@ private:
 	double fVec0[2];
 	double fConst2;
 	double fRec0[2];
+	// stereo state, lane 0 left, lane 1 right
+	double fStereoVec[2];
+	double fStereoRec[2];
 
 public:
 	void connect(uint32_t port,void* data);
@@ -24,6 +31,8 @@ public:
 	void clear_state_f();
 	void init(uint32_t sample_rate);
 	void compute(int count, float *input0, float *output0);
+	void compute_stereo(int count, float *input0, float *input1,
+	                                float *output0, float *output1);
 	Dsp();
 	~Dsp();
 };
@@ -40,6 +49,8 @@ inline void Dsp::clear_state_f()
 {
 	for (int l0 = 0; l0 < 2; l0 = l0 + 1) fVec0[l0] = 0.0;
 	for (int l1 = 0; l1 < 2; l1 = l1 + 1) fRec0[l1] = 0.0;
+	for (int l2 = 0; l2 < 2; l2 = l2 + 1) fStereoVec[l2] = 0.0;
+	for (int l3 = 0; l3 < 2; l3 = l3 + 1) fStereoRec[l3] = 0.0;
 }
 
 inline void Dsp::init(uint32_t sample_rate)
@@ -63,6 +74,38 @@ void Dsp::compute(int count, float *input0, float *output0)
 	}
 }
 
+// process both channels in one pass, left and right are the two
+// lanes of one double vector
+void Dsp::compute_stereo(int count, float *input0, float *input1,
+                                    float *output0, float *output1)
+{
+#if defined(__SSE2__)
+	const __m128d vConst1 = _mm_set1_pd(fConst1);
+	const __m128d vConst2 = _mm_set1_pd(fConst2);
+	__m128d vVec = _mm_loadu_pd(fStereoVec);
+	__m128d vRec = _mm_loadu_pd(fStereoRec);
+	for (int i0 = 0; i0 < count; i0 = i0 + 1) {
+		__m128d vTemp0 = _mm_set_pd(double(input1[i0]), double(input0[i0]));
+		vRec = _mm_mul_pd(vConst2, _mm_add_pd(_mm_sub_pd(vTemp0, vVec), _mm_mul_pd(vConst1, vRec)));
+		vVec = vTemp0;
+		output0[i0] = float(_mm_cvtsd_f64(vRec));
+		output1[i0] = float(_mm_cvtsd_f64(_mm_unpackhi_pd(vRec, vRec)));
+	}
+	_mm_storeu_pd(fStereoVec, vVec);
+	_mm_storeu_pd(fStereoRec, vRec);
+#else
+	for (int i0 = 0; i0 < count; i0 = i0 + 1) {
+		double fTemp0[2] = { double(input0[i0]), double(input1[i0]) };
+		for (int c = 0; c < 2; c = c + 1) {
+			fStereoRec[c] = fConst2 * (fTemp0[c] - fStereoVec[c] + fConst1 * fStereoRec[c]);
+			fStereoVec[c] = fTemp0[c];
+		}
+		output0[i0] = float(fStereoRec[0]);
+		output1[i0] = float(fStereoRec[1]);
+	}
+#endif
+}
+
 Dsp *plugin() {
 	return new Dsp();
 }
@@ -7,6 +7,7 @@
  */
 
 
+#include <algorithm>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
@@ -16,6 +17,7 @@
 #include <iostream>
 #include <cstring>
 #include <thread>
+#include <vector>
 #include <unistd.h>
 
 #ifdef __SSE__
@@ -47,6 +49,12 @@
 
 #include "ModelerSelector.h"
 #include "fftconvolver.h"
+#include "StageProfiler.h"
+#include "ScratchArena.h"
+#include "Smoother.h"
+#include "ProcessGraph.h"
+#include "CommandQueue.h"
+#include "IrPremix.h"
 
 #pragma once
 
@@ -99,12 +107,22 @@ class Engine
 {
 public:
     ParallelThread               xrworker;
+    // the tail level workers of all long IR's, must outlive the convolvers
+    LevelWorkers                 levelWorkers;
     cdeleay::Dsp*                cdelay;
     phasecor::Dsp*               pdelay;
     ModelerSelector              slotA;
     ModelerSelector              slotB;
     ConvolverSelector            conv;
     ConvolverSelector            conv1;
+    ProcessGraph                 graph;
+    StageProfiler                profiler;
+    // model cache hits and misses of the process, published by the worker
+    enum { CACHE_HITS, CACHE_MISSES, CACHE_VALUES };
+    std::atomic<float>           cacheStats[CACHE_VALUES];
+
+    // maximal latency of the buffered mode in periods
+    static constexpr uint32_t    MAX_PERIODS = 4;
 
     float                        inputGain;
     float                        inputGain1;
@@ -125,76 +143,201 @@ public:
     uint32_t                     bypass;
     uint32_t                     s_rate;
     uint32_t                     bufsize;
+    uint32_t                     maxbufsize;
     uint32_t                     buffersize;
+    uint32_t                     channels;
     int                          phaseOffset;
 
-    std::string                  model_file;
-    std::string                  model_file1;
+    // commands for the worker thread, see CommandQueue.h
+    CommandQueue                 commands;
+
+    // the loaded files, published by the worker thread
+    PathState                    model_file;
+    PathState                    model_file1;
 
-    std::string                  ir_file;
-    std::string                  ir_file1;
+    PathState                    ir_file;
+    PathState                    ir_file1;
+
+    // model graph description, see ProcessGraph.h
+    PathState                    graph_spec;
 
     std::atomic<bool>            _execute;
     std::atomic<bool>            _notify_ui;
     std::atomic<bool>            _neuralA;
     std::atomic<bool>            _neuralB;
     std::atomic<bool>            bufferIsInit;
-    std::atomic<int>             _ab;
-    std::atomic<int>             _cd;
 
     inline Engine();
     inline ~Engine();
 
     inline void init(uint32_t rate, int32_t rt_prio_, int32_t rt_policy_);
     inline void clean_up();
+    inline void setFreewheel(bool on);
     inline void do_work_mono();
     inline void process(uint32_t n_samples, float* output);
+    inline void process(uint32_t n_samples, float* output, float* output1);
 
 private:
     ParallelThread               pro;
     ParallelThread               par;
+    ParallelThread               pconv;
+    // the pre-mixed IR, build by the worker thread (xrworker)
+    IrPremix                     premix;
+    std::atomic<bool>            _build_premix;
     dcblocker::Dsp*              dcb;
+    // right channel instances for the stereo mode. The IR spectra are
+    // shared with the left channel (IrStore), but the NAM and RTNeural
+    // DSP's hold there own copy of the weights next to the state, so
+    // the right channel models cost the same memory as the left ones
+    ModelerSelector              slotAR;
+    ModelerSelector              slotBR;
+    ConvolverSelector            convR;
+    ConvolverSelector            conv1R;
     DenormalProtection           MXCSR;
+    DenormalProtection           MXCSR_IR;
     std::condition_variable      Sync;
     std::mutex                   WMutex;
 
-    float*                       bufferoutput0;
-    float*                       bufferinput0;
+    // period ring for the buffered mode, swapped by index. A power of
+    // two keeps the slot index continuous when the counters wrap around
+    static constexpr uint32_t    RING_SLOTS = 8;
+    static_assert(RING_SLOTS > MAX_PERIODS && !(RING_SLOTS & (RING_SLOTS - 1)));
+    ScratchArena                 ring;
+    float*                       ringBuf[RING_SLOTS][2];
+    uint32_t                     ringFrames[RING_SLOTS];
+    bool                         ringIR[RING_SLOTS];
+    uint32_t                     ringDepth;
+    std::atomic<uint32_t>        ringHead;
+    std::atomic<uint32_t>        ringTail;
+    // set by the one who start the model stage, cleared by the model stage
+    std::atomic<bool>            ringBusy;
     float*                       _bufb;
-
-    double                       fRec0[2];
-    double                       fRec3[2];
-    double                       fRec2[2];
-    double                       fRec1[2];
-    double                       fRec4[2];
+    float*                       _bufbR;
+    float*                       _bufd;
+    float*                       _bufdR;
+    uint32_t                     _sizeb;
+    uint32_t                     _sized;
+    bool                         _bufStereo;
+    bool                         freewheel;
+
+    ScratchArena                 scratch;
+    float*                       bufa;
+    float*                       bufb;
+    float*                       bufaR;
+    float*                       bufbR;
+    // IR stage buffers, kept apart for the buffered pipeline
+    float*                       bufc;
+    float*                       bufd;
+    float*                       bufcR;
+    float*                       bufdR;
+    // the pre-mixed IR
+    float*                       bufe;
+    float*                       bufeR;
+    uint32_t                     scratchSize;
+
+    Smoother                     gainA;
+    Smoother                     gainB;
+    Smoother                     blendAB;
+    Smoother                     gainOut;
+    Smoother                     mixIR;
 
     inline void processSlotB();
     inline void processConv1();
+    inline void buildPremix();
+    inline void do_work();
     inline void processBuffer();
-    inline void processDsp(uint32_t n_samples, float* output);
+    inline void processDsp(uint32_t n_samples, float* output, float* output1);
+    inline bool processModels(uint32_t n_samples, float* output, float* output1);
+    inline void processIR(uint32_t n_samples, float* output, float* output1,
+                                                    ParallelThread& thread);
+    inline void initScratch();
+
+    // command in work, only used by the worker thread
+    Command                      work;
+    // newest serial applied per target, only used by the worker thread
+    uint32_t                     seen[Command::TARGETS] = {};
+
+    // the model and IR loads gathered from the command queue,
+    // indexed by Command::Target
+    struct LoadBatch {
+        static constexpr uint32_t TARGETS = Command::TARGETS;
+        bool                     load[TARGETS] = {};
+        std::string              file[TARGETS];
+        int32_t                  priority[TARGETS] = {};
+        CancelToken              token[TARGETS];
+        bool                     graph = false;
+        std::string              graphSpec;
+
+        void set(int32_t t, const std::string& f, bool interactive, CancelToken tk) {
+            load[t] = true;
+            file[t] = f;
+            priority[t] = interactive ? 1 : 0;
+            token[t] = tk;
+        }
+    };
 
-    inline void setModel(ModelerSelector *slot,
-                std::string *file, std::atomic<bool> *set);
+    inline ModelerSelector* slotOf(uint32_t t) { return t == Command::MODEL_B ? &slotB : &slotA;}
+    inline ModelerSelector* slotROf(uint32_t t) { return t == Command::MODEL_B ? &slotBR : &slotAR;}
+    inline ConvolverSelector* convOf(uint32_t t) { return t == Command::IR_B ? &conv1 : &conv;}
+    inline ConvolverSelector* convROf(uint32_t t) { return t == Command::IR_B ? &conv1R : &convR;}
 
-    inline void setIRFile(ConvolverSelector *co, std::string *file);
+    inline bool startConvolver(ConvolverSelector *co, const std::string& file,
+                                        const CancelToken *token = nullptr);
+    inline void applyLoads(LoadBatch& b);
+    inline void publishLoads(LoadBatch& b, bool (&ok)[LoadBatch::TARGETS][2], int32_t pass);
 };
 
 inline Engine::Engine() :
     xrworker(),
+    levelWorkers(),
     pro(),
     par(),
+    pconv(),
+    premix(),
     dcb(dcblocker::plugin()),
     cdelay(cdeleay::plugin()),
     pdelay(phasecor::plugin()),
     slotA(&Sync),
     slotB(&Sync),
-    conv(),
-    conv1(),
-    bufferoutput0(NULL),
-    bufferinput0(NULL),
-    _bufb(0) {
+    conv(&Sync, &levelWorkers),
+    conv1(&Sync, &levelWorkers),
+    graph(&Sync, &levelWorkers),
+    slotAR(&Sync),
+    slotBR(&Sync),
+    convR(&Sync, &levelWorkers),
+    conv1R(&Sync, &levelWorkers),
+    ring(),
+    ringBuf{},
+    ringFrames{},
+    ringIR{},
+    ringDepth(0),
+    ringHead(0),
+    ringTail(0),
+    ringBusy(false),
+    _bufb(0),
+    _bufbR(0),
+    _bufd(0),
+    _bufdR(0),
+    _sizeb(0),
+    _sized(0),
+    _bufStereo(false),
+    freewheel(false),
+    scratch(),
+    bufa(nullptr),
+    bufb(nullptr),
+    bufaR(nullptr),
+    bufbR(nullptr),
+    bufc(nullptr),
+    bufd(nullptr),
+    bufcR(nullptr),
+    bufdR(nullptr),
+    bufe(nullptr),
+    bufeR(nullptr),
+    scratchSize(0) {
         bufsize = 0;
+        maxbufsize = 0;
         buffersize = 0;
+        channels = 1;
         phaseOffset = 0;
         bypass = 0;
         normSlotA = 0;
@@ -210,58 +353,69 @@ inline Engine::Engine() :
         buffered = 0.0;
         latency = 0.0;
         XrunCounter = 0.0;
+        for (auto& c : cacheStats) c.store(0.0f, std::memory_order_relaxed);
         _neuralA.store(false, std::memory_order_release);
         _neuralB.store(false, std::memory_order_release);
 
-        model_file = "None";
-        model_file1 = "None";
 
-        ir_file = "None";
-        ir_file1 = "None";
+        // opt in to the process wide real-time pool
+        pro.setSharedPool(RtPool::enabled());
+        par.setSharedPool(RtPool::enabled());
+        pconv.setSharedPool(RtPool::enabled());
 
         xrworker.start();
         pro.start();
         par.start();
-};
+        pconv.start();
+    };
 
 inline Engine::~Engine(){
     xrworker.stop();
     pro.stop();
     par.stop();
-
-    delete[] bufferoutput0;
-    delete[] bufferinput0;
+    pconv.stop();
 
     dcb->del_instance(dcb);
     cdelay->del_instance(cdelay);
     pdelay->del_instance(pdelay);
     slotA.cleanUp();
     slotB.cleanUp();
+    slotAR.cleanUp();
+    slotBR.cleanUp();
     conv.stop_process();
     conv.cleanup();
     conv1.stop_process();
     conv1.cleanup();
+    convR.stop_process();
+    convR.cleanup();
+    conv1R.stop_process();
+    conv1R.cleanup();
+    graph.clear();
 };
 
 inline void Engine::init(uint32_t rate, int32_t rt_prio_, int32_t rt_policy_) {
     s_rate = rate;
+    profiler.init(rate);
+    initScratch();
     dcb->init(rate);
     cdelay->init(rate);
     pdelay->init(rate);
     slotA.init(rate);
     slotB.init(rate);
+    slotAR.init(rate);
+    slotBR.init(rate);
 
     rt_prio = rt_prio_;
     rt_policy = rt_policy_;
+    graph.init(rate, scratchSize, channels, rt_prio, rt_policy);
 
     _execute.store(false, std::memory_order_release);
+    _build_premix.store(false, std::memory_order_release);
     _notify_ui.store(false, std::memory_order_release);
     bufferIsInit.store(false, std::memory_order_release);
-    _ab.store(0, std::memory_order_release);
-    _cd.store(0, std::memory_order_release);
 
     xrworker.setThreadName("Worker");
-    xrworker.set<Engine, &Engine::do_work_mono>(this);
+    xrworker.set<Engine, &Engine::do_work>(this);
 
     pro.setThreadName("RT-Parallel");
     pro.setPriority(rt_prio, rt_policy);
@@ -272,81 +426,247 @@ inline void Engine::init(uint32_t rate, int32_t rt_prio_, int32_t rt_policy_) {
     par.setPriority(rt_prio, rt_policy);
     par.set<Engine, &Engine::processBuffer>(this);
 
-    for (int l0 = 0; l0 < 2; l0 = l0 + 1) fRec0[l0] = 0.0;
-    for (int l0 = 0; l0 < 2; l0 = l0 + 1) fRec3[l0] = 0.0;
-    for (int l0 = 0; l0 < 2; l0 = l0 + 1) fRec2[l0] = 0.0;
-    for (int l0 = 0; l0 < 2; l0 = l0 + 1) fRec1[l0] = 0.0;
-    for (int l0 = 0; l0 < 2; l0 = l0 + 1) fRec4[l0] = 0.0;
+    // conv1 of the IR stage while pro runs slot B in buffered mode
+    pconv.setThreadName("RT-IR");
+    pconv.setPriority(rt_prio, rt_policy);
+    pconv.set<1, Engine, &Engine::processConv1>(this);
+
+    // the pre-mixed IR is build by the worker thread
+    premix.init(rate);
+
+    gainA.reset(0.0);
+    gainB.reset(0.0);
+    blendAB.reset(0.0);
+    gainOut.reset(0.0);
+    mixIR.reset(0.0);
 };
 
 void Engine::clean_up()
 {
-    for (int l0 = 0; l0 < 2; l0 = l0 + 1) fRec0[l0] = 0.0;
-    for (int l0 = 0; l0 < 2; l0 = l0 + 1) fRec3[l0] = 0.0;
-    for (int l0 = 0; l0 < 2; l0 = l0 + 1) fRec2[l0] = 0.0;
-    for (int l0 = 0; l0 < 2; l0 = l0 + 1) fRec1[l0] = 0.0;
-    for (int l0 = 0; l0 < 2; l0 = l0 + 1) fRec4[l0] = 0.0;
+    gainA.reset(0.0);
+    gainB.reset(0.0);
+    blendAB.reset(0.0);
+    gainOut.reset(0.0);
+    mixIR.reset(0.0);
     // delete the internal DSP mem
 }
 
-inline void Engine::setModel(ModelerSelector *slot,
-                std::string *file, std::atomic<bool> *set) {
-    if ((*file).compare(slot->getModelFile()) != 0) {
-        log_print("engine setModel %s\n", (*file).c_str());
-        slot->setModelFile(*file);
-        if (!slot->loadModel()) {
-            *file = "None";
-            log_print("engine setModel fail\n");
-            set->store(false, std::memory_order_release);
-        } else {
-            set->store(true, std::memory_order_release);
-        }
+// allocate the working buffers for the audio path, sized from the
+// maximal host block and the worst case model up-sample ratio
+inline void Engine::initScratch() {
+    channels = std::clamp(channels, 1u, 2u);
+    scratchSize = std::max(std::max(maxbufsize, bufsize), static_cast<uint32_t>(1024));
+    // models are expected up to 192kHz
+    const uint32_t ratio = std::min(static_cast<uint32_t>(MAX_UPSAMPLE),
+                                    static_cast<uint32_t>(std::ceil(192000.0 / s_rate)));
+    const size_t rsize = static_cast<size_t>(scratchSize) * std::max(ratio, 1u) + 16;
+    // per channel: 5 stage buffers, 2 model scratch, 2 model and 2 IR crossfade buffers
+    scratch.allocate((ScratchArena::pad(scratchSize) * 11 + ScratchArena::pad(rsize) * 2) * channels);
+    bufa = scratch.take(scratchSize);
+    bufb = scratch.take(scratchSize);
+    bufc = scratch.take(scratchSize);
+    bufd = scratch.take(scratchSize);
+    bufe = scratch.take(scratchSize);
+    slotA.setScratch(scratch.take(scratchSize), scratchSize, scratch.take(rsize), rsize,
+                                                    scratch.take(scratchSize));
+    slotB.setScratch(scratch.take(scratchSize), scratchSize, scratch.take(rsize), rsize,
+                                                    scratch.take(scratchSize));
+    conv.setFadeBuffer(scratch.take(scratchSize));
+    conv1.setFadeBuffer(scratch.take(scratchSize));
+    if (channels > 1) {
+        bufaR = scratch.take(scratchSize);
+        bufbR = scratch.take(scratchSize);
+        bufcR = scratch.take(scratchSize);
+        bufdR = scratch.take(scratchSize);
+        bufeR = scratch.take(scratchSize);
+        slotAR.setScratch(scratch.take(scratchSize), scratchSize, scratch.take(rsize), rsize,
+                                                    scratch.take(scratchSize));
+        slotBR.setScratch(scratch.take(scratchSize), scratchSize, scratch.take(rsize), rsize,
+                                                    scratch.take(scratchSize));
+        convR.setFadeBuffer(scratch.take(scratchSize));
+        conv1R.setFadeBuffer(scratch.take(scratchSize));
+    } else {
+        bufaR = nullptr;
+        bufbR = nullptr;
+        bufcR = nullptr;
+        bufdR = nullptr;
+        bufeR = nullptr;
     }
 }
 
-inline void Engine::setIRFile(ConvolverSelector *co, std::string *file) {
-    if (co->is_runnable()) {
-        co->set_not_runnable();
-        co->stop_process();
-        std::unique_lock<std::mutex> lk(WMutex);
-        Sync.wait_for(lk, std::chrono::milliseconds(160));
-    }
+// offline rendering: run all stages in the calling thread and
+// wait without time out for the convolver tail
+inline void Engine::setFreewheel(bool on) {
+    freewheel = on;
+    conv.set_freewheel(on);
+    conv1.set_freewheel(on);
+    convR.set_freewheel(on);
+    conv1R.set_freewheel(on);
+    graph.setFreewheel(on);
+}
 
-    co->cleanup();
+// load the IR file into the standby bank of the convolver
+inline bool Engine::startConvolver(ConvolverSelector *co, const std::string& file,
+                                                const CancelToken *token) {
     co->set_samplerate(s_rate);
     co->set_buffersize(bufsize);
+    return co->prepare(file, token);
+}
 
-    if (*file != "None") {
-        co->configure(*file, 1.0, 0, 0, 0, 0, 0);
-        log_print("engine setIRFile %s\n", (*file).c_str());
-        while (!co->checkstate());
-        if(!co->start(rt_prio, rt_policy)) {
-            *file = "None";
-            log_print("engine setIRFile fail\n");
-           // lv2_log_error(&logger,"impulse convolver update fail\n");
+// prepare the gathered model and IR loads concurrently, one thread for
+// each model and convolver. Interactive requests (the user browsing files)
+// are started first and published as soon as they are ready, the others
+// are published together when all are done. A load which was superseded
+// by a newer request is dropped and the running one keeps playing.
+inline void Engine::applyLoads(LoadBatch& b) {
+    const uint32_t nch = channels > 1 ? 2 : 1;
+    bool ok[LoadBatch::TARGETS][2] = {};
+    std::vector<std::thread> jobs[2];
+
+    for (uint32_t s = 0; s < 2; s++) {
+        if (b.load[s] && b.file[s].compare(slotOf(s)->getModelFile()) == 0)
+            b.load[s] = false;
+    }
+    // start the interactive loads first
+    for (int32_t pass = 1; pass >= 0; pass--) {
+        for (uint32_t t = 0; t < LoadBatch::TARGETS; t++) {
+            if (!b.load[t] || b.priority[t] != pass) continue;
+            const CancelToken *token = &b.token[t];
+            log_print("engine load %s\n", b.file[t].c_str());
+            if (t < 2) {
+                for (uint32_t c = 0; c < nch; c++) {
+                    ModelerSelector *m = c ? slotROf(t) : slotOf(t);
+                    m->setModelFile(b.file[t]);
+                    jobs[pass].emplace_back([&ok, m, token, t, c] () {
+                        ok[t][c] = m->prepare(token);});
+                }
+            } else {
+                if (nch > 1) convROf(t)->set_normalisation(convOf(t)->get_normalisation());
+                for (uint32_t c = 0; c < nch; c++) {
+                    ConvolverSelector *co = c ? convROf(t) : convOf(t);
+                    jobs[pass].emplace_back([this, &ok, &b, co, token, t, c] () {
+                        ok[t][c] = startConvolver(co, b.file[t], token);});
+                }
+            }
         }
     }
+    // (re)build the model graph meanwhile
+    if (b.graph) {
+        log_print("engine setGraph %s\n", b.graphSpec.c_str());
+        if (graph.load(b.graphSpec, bufsize)) graph_spec.set(b.graphSpec);
+        else graph_spec.set("None");
+    }
+    for (int32_t pass = 1; pass >= 0; pass--) {
+        for (auto& j : jobs[pass]) j.join();
+        publishLoads(b, ok, pass);
+    }
+    if (b.load[0] || b.load[1]) {
+        const ModelCache::Stats cs = ModelCache::get().stats();
+        cacheStats[CACHE_HITS].store(static_cast<float>(cs.hits), std::memory_order_relaxed);
+        cacheStats[CACHE_MISSES].store(static_cast<float>(cs.misses), std::memory_order_relaxed);
+        log_print("engine model cache %llu hits %llu misses %zu kB\n",
+                    static_cast<unsigned long long>(cs.hits),
+                    static_cast<unsigned long long>(cs.misses), cs.bytes / 1024);
+    }
 }
 
-void Engine::do_work_mono() {
-    // set neural models
-    if (_ab.load(std::memory_order_acquire) == 1) {
-        setModel(&slotA, &model_file, &_neuralA);
-    } else if (_ab.load(std::memory_order_acquire) == 2) {
-        setModel(&slotB, &model_file1, &_neuralB);
-    } else if (_ab.load(std::memory_order_acquire) > 2) {
-        setModel(&slotA, &model_file, &_neuralA);
-        setModel(&slotB, &model_file1, &_neuralB);
-    }
-    // set ir files
-    if (_cd.load(std::memory_order_acquire) == 1) {
-        setIRFile(&conv, &ir_file);
-    } else if (_cd.load(std::memory_order_acquire) == 2) {
-        setIRFile(&conv1, &ir_file1);
-    } else if (_cd.load(std::memory_order_acquire) > 2) {
-        setIRFile(&conv, &ir_file);
-        setIRFile(&conv1, &ir_file1);
+// publish the prepared loads of the given priority at once, the real-time
+// thread crossfade at the next period. In stereo mode the right channel
+// get a own instance of the same model and IR, so both channels keep there
+// own state, a slot only switch when all channels could be loaded,
+// otherwise it is cleared.
+inline void Engine::publishLoads(LoadBatch& b, bool (&ok)[LoadBatch::TARGETS][2],
+                                                            int32_t pass) {
+    const uint32_t nch = channels > 1 ? 2 : 1;
+    bool run[LoadBatch::TARGETS] = {};
+    for (uint32_t t = 0; t < LoadBatch::TARGETS; t++) {
+        // superseded loads are left to the next round
+        run[t] = b.load[t] && b.priority[t] == pass && !b.token[t].cancelled();
+        if (!run[t] || (ok[t][0] && ok[t][nch - 1])) continue;
+        log_print("engine load fail %s\n", b.file[t].c_str());
+        for (uint32_t c = 0; c < nch; c++) {
+            if (t < 2) {
+                if (!ok[t][c]) continue;
+                ModelerSelector *m = c ? slotROf(t) : slotOf(t);
+                m->setModelFile("None");
+                m->prepare();
+            } else {
+                startConvolver(c ? convROf(t) : convOf(t), "None");
+            }
+        }
+        ok[t][0] = false;
+    }
+    for (uint32_t t = 0; t < LoadBatch::TARGETS; t++) {
+        if (!run[t]) continue;
+        for (uint32_t c = 0; c < nch; c++) {
+            if (t < 2) (c ? slotROf(t) : slotOf(t))->commit();
+            else (c ? convROf(t) : convOf(t))->commit();
+        }
     }
+    // free the old models and IR's when the real-time thread has faded over
+    for (uint32_t t = 0; t < LoadBatch::TARGETS; t++) {
+        if (!run[t]) continue;
+        for (uint32_t c = 0; c < nch; c++) {
+            if (t < 2) (c ? slotROf(t) : slotOf(t))->retire();
+            else (c ? convROf(t) : convOf(t))->retire();
+        }
+    }
+    PathState *name[LoadBatch::TARGETS] = {&model_file, &model_file1, &ir_file, &ir_file1};
+    bool published = false;
+    for (uint32_t t = 0; t < LoadBatch::TARGETS; t++) {
+        if (!run[t]) continue;
+        name[t]->set(ok[t][0] ? b.file[t] : "None");
+        if (t < 2) (t ? _neuralB : _neuralA).store(ok[t][0], std::memory_order_release);
+        published = true;
+    }
+    // let the GUI show the interactive loads right away
+    if (published && pass) _notify_ui.store(true, std::memory_order_release);
+}
+
+void Engine::do_work_mono() {
+    // gather the queued commands, the last request for a target wins,
+    // and load them all at once. Requests pushed meanwhile cancel the
+    // superseded loads, so loop until the queue is empty.
+    do {
+        LoadBatch batch;
+        while (commands.pop(work)) {
+            const uint32_t slot = work.slot ? 1 : 0;
+            const int32_t t = Command::targetOf(work.type, slot);
+            // the GUI and the real-time thread push to different rings,
+            // drop a request which was superseded on the other ring
+            if (t >= 0) {
+                if (CommandQueue::older(work.serial, seen[t])) continue;
+                seen[t] = work.serial;
+            }
+            switch (work.type) {
+                case Command::LOAD_MODEL:
+                case Command::LOAD_IR:
+                    batch.set(t, work.path[0] ? work.path : "None",
+                        work.value == Command::INTERACTIVE, commands.token(work));
+                break;
+                case Command::ERASE_MODEL:
+                case Command::ERASE_IR:
+                    batch.set(t, "None", true, commands.token(work));
+                break;
+                case Command::NORMALISE_IR: {
+                    // reload the IR file with the new normalisation
+                    PathState *irName = slot ? &ir_file1 : &ir_file;
+                    convOf(t)->set_normalisation(static_cast<uint32_t>(work.value));
+                    if (batch.load[t]) batch.token[t] = commands.token(work);
+                    else if (!irName->isNone())
+                        batch.set(t, irName->str(), true, commands.token(work));
+                }
+                break;
+                case Command::SET_GRAPH:
+                    batch.graph = true;
+                    batch.graphSpec = work.path;
+                break;
+                case Command::INIT_BUFFER:
+                break;
+            }
+        }
+        applyLoads(batch);
+    } while (!commands.empty());
 
     // calculate phase offset
     if (_neuralA.load(std::memory_order_acquire) && _neuralB.load(std::memory_order_acquire)) {
@@ -362,19 +682,25 @@ void Engine::do_work_mono() {
     
     // init buffer for background processing
     if (buffersize < bufsize) {
+        // the ring may be still in use by the model stage
+        while (par.isRunning() && !par.getState())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         buffersize = bufsize * 2;
-        delete[] bufferoutput0;
-        bufferoutput0 = NULL;
-        bufferoutput0 = new float[buffersize];
-        memset(bufferoutput0, 0, buffersize*sizeof(float));
-        delete[] bufferinput0;
-        bufferinput0 = NULL;
-        bufferinput0 = new float[buffersize];
-        memset(bufferinput0, 0, buffersize*sizeof(float));
+        const size_t slot = ScratchArena::pad(buffersize);
+        ring.allocate(slot * RING_SLOTS * std::max(channels, 1u));
+        for (uint32_t i = 0; i < RING_SLOTS; i++) {
+            ringBuf[i][0] = ring.take(buffersize);
+            ringBuf[i][1] = channels > 1 ? ring.take(buffersize) : nullptr;
+            ringFrames[i] = 0;
+            ringIR[i] = false;
+        }
+        // force a ring reset in the next buffered period
+        ringDepth = 0;
         par.setTimeOut(std::max(100,static_cast<int>((bufsize/(s_rate*0.000001))*0.1)));
         bufferIsInit.store(true, std::memory_order_release);
         // set wait function time out for parallel processor thread
         pro.setTimeOut(std::max(100,static_cast<int>((bufsize/(s_rate*0.000001))*0.1)));
+        pconv.setTimeOut(std::max(100,static_cast<int>((bufsize/(s_rate*0.000001))*0.1)));
     }
     // set flag that work is done ready
     _execute.store(false, std::memory_order_release);
@@ -384,48 +710,136 @@ void Engine::do_work_mono() {
 
 // process slotB in parallel thread
 inline void Engine::processSlotB() {
-    slotB.compute(bufsize, _bufb, _bufb);
-    if (normSlotB) slotB.normalize(bufsize, _bufb);
+    uint64_t t = profiler.now();
+    slotB.compute(_sizeb, _bufb, _bufb, normSlotB);
+    if (_bufbR) slotBR.compute(_sizeb, _bufbR, _bufbR, normSlotB);
+    profiler.record(StageProfiler::SLOT_B, t);
 }
 
 // process second convolver in parallel thread
 inline void Engine::processConv1() {
-    conv1.compute(bufsize, _bufb, _bufb);
+    uint64_t t = profiler.now();
+    conv1.compute(_sized, _bufd, _bufd);
+    if (_bufdR && conv1R.is_runnable()) conv1R.compute(_sized, _bufdR, _bufdR);
+    profiler.record(StageProfiler::CONV1, t);
+}
+
+// build the pre-mixed IR in the worker thread
+inline void Engine::buildPremix() {
+    premix.build(conv, conv1, s_rate, channels > 1 ? 2 : 1);
+}
+
+// the worker thread run the queued commands and the IR pre-mix.
+// Commands queued while the pre-mix was build are run right after
+inline void Engine::do_work() {
+    do {
+        if (_execute.load(std::memory_order_acquire)) do_work_mono();
+        if (_build_premix.exchange(false, std::memory_order_acq_rel)) buildPremix();
+    } while (_execute.load(std::memory_order_acquire));
 }
 
-// process dsp in buffered in a background thread
+// model stage of the buffered pipeline, run in a background thread
+// while the host thread run the IR stage of a previous period.
+// Process all periods the host have queued since the last run, so a
+// slow period only eats into the headroom of the ring.
+// The thread may still look busy after the last check of the head,
+// so a period queued meanwhile is picked up here, not lost
 inline void Engine::processBuffer() {
-    processDsp(bufsize, bufferoutput0);
+    uint32_t tail = ringTail.load(std::memory_order_relaxed);
+    for (;;) {
+        while (tail != ringHead.load(std::memory_order_acquire)) {
+            const uint32_t slot = tail % RING_SLOTS;
+            if (bypass) ringIR[slot] = processModels(ringFrames[slot], ringBuf[slot][0],
+                                            _bufStereo ? ringBuf[slot][1] : nullptr);
+            else ringIR[slot] = false;
+            ringTail.store(++tail, std::memory_order_release);
+            // notify neural modeller that process cycle is done
+            Sync.notify_all();
+        }
+        ringBusy.store(false, std::memory_order_seq_cst);
+        if (tail == ringHead.load(std::memory_order_seq_cst)) break;
+        // the host queued a period after the check, take it when it
+        // didn't start a new run by itself
+        bool idle = false;
+        if (!ringBusy.compare_exchange_strong(idle, true, std::memory_order_seq_cst)) break;
+    }
 }
 
-inline void Engine::processDsp(uint32_t n_samples, float* output)
+// process a mono block in output, or a stereo block in output and
+// output1. Both channels run through the same stages, the gain,
+// delay and dcblocker stages process them in one pass.
+inline void Engine::processDsp(uint32_t n_samples, float* output, float* output1)
 {
-    if(n_samples<1) return;
+    if(n_samples<1 || !scratchSize) return;
 
     // basic bypass
     if (!bypass) {
         Sync.notify_all();
         return;
     }
+    bufsize = n_samples;
+    const uint64_t period = profiler.now();
+    if (processModels(n_samples, output, output1))
+        processIR(n_samples, output, output1, pro);
+    profiler.record(StageProfiler::PERIOD, period);
+    profiler.publish(n_samples);
+    // notify neural modeller that process cycle is done
+    Sync.notify_all();
+}
+
+// first stage: delay, input gain, the neural models, output gain and
+// dcblocker, or the model graph. Returns false when the IR stage must
+// not run on the result.
+inline bool Engine::processModels(uint32_t n_samples, float* output, float* output1)
+{
+    if(n_samples<1 || !scratchSize) return false;
+
+    // process host blocks larger than the scratch buffers in slices
+    if (n_samples > scratchSize) {
+        bool ir = false;
+        for (uint32_t i = 0; i < n_samples; i += scratchSize)
+            ir = processModels(std::min(scratchSize, n_samples - i), output + i,
+                                            output1 ? output1 + i : nullptr);
+        return ir;
+    }
+
     MXCSR.set_();
+    const bool stereo = output1 && bufaR;
 
     // get controller values from host
-    double fSlow0 = 0.0010000000000000009 * std::pow(1e+01, 0.05 * double(inputGain));
-    double fSlow4 = 0.0010000000000000009 * std::pow(1e+01, 0.05 * double(inputGain1));
-    double fSlow3 = 0.0010000000000000009 * std::pow(1e+01, 0.05 * double(outputGain));
-    double fSlow2 = 0.0010000000000000009 * double(blend);
-    double fSlow1 = 0.0010000000000000009 * double(mix);
+    gainA.setTarget(std::pow(1e+01, 0.05 * double(inputGain)));
+    gainB.setTarget(std::pow(1e+01, 0.05 * double(inputGain1)));
+    gainOut.setTarget(std::pow(1e+01, 0.05 * double(outputGain)));
+    blendAB.setTarget(double(blend));
+
+    // process the model graph instead of the fixed slots when loaded
+    if (graph.process(n_samples, output, stereo ? output1 : nullptr)) {
+        if (stereo) smooth::gain2(n_samples, output, output1, output, output1, gainOut);
+        else smooth::gain(n_samples, output, output, gainOut);
+        if (stereo) dcb->compute_stereo(n_samples, output, output1, output, output1);
+        else dcb->compute(n_samples, output, output);
+        MXCSR.reset_();
+        return false;
+    }
 
     // internal buffer
-    float bufa[n_samples];
     memcpy(bufa, output, n_samples*sizeof(float));
-    float bufb[n_samples];
     memcpy(bufb, output, n_samples*sizeof(float));
-    bufsize = n_samples;
+    if (stereo) {
+        memcpy(bufaR, output1, n_samples*sizeof(float));
+        memcpy(bufbR, output1, n_samples*sizeof(float));
+    }
 
     // process delta delay
-    if (delay < 0) cdelay->compute(n_samples, bufa, bufa);
-    else cdelay->compute(n_samples, bufb, bufb);
+    uint64_t t = profiler.now();
+    if (stereo) {
+        if (delay < 0) cdelay->compute_stereo(n_samples, bufa, bufaR, bufa, bufaR);
+        else cdelay->compute_stereo(n_samples, bufb, bufbR, bufb, bufbR);
+    } else {
+        if (delay < 0) cdelay->compute(n_samples, bufa, bufa);
+        else cdelay->compute(n_samples, bufb, bufb);
+    }
+    t = profiler.lap(StageProfiler::CDELAY, t);
 
     // clear phase correction when switch on/off
     if (phasecor_ != phase_cor) {
@@ -434,32 +848,38 @@ inline void Engine::processDsp(uint32_t n_samples, float* output)
     }
     // process phase correction
     if (phasecor_ && phaseOffset) {
-        if (phaseOffset < 0) pdelay->compute(n_samples, bufa, bufa);
-        else pdelay->compute(n_samples, bufb, bufb);
+        if (stereo) {
+            if (phaseOffset < 0) pdelay->compute_stereo(n_samples, bufa, bufaR, bufa, bufaR);
+            else pdelay->compute_stereo(n_samples, bufb, bufbR, bufb, bufbR);
+        } else {
+            if (phaseOffset < 0) pdelay->compute(n_samples, bufa, bufa);
+            else pdelay->compute(n_samples, bufb, bufb);
+        }
+        t = profiler.lap(StageProfiler::PDELAY, t);
     }
 
     // process input volume slot A
     if (_neuralA.load(std::memory_order_acquire)) {
-        for (uint32_t i0 = 0; i0 < n_samples; i0 = i0 + 1) {
-            fRec0[0] = fSlow0 + 0.999 * fRec0[1];
-            bufa[i0] = float(double(bufa[i0]) * fRec0[0]);
-            fRec0[1] = fRec0[0];
-        }
+        if (stereo) smooth::gain2(n_samples, bufa, bufaR, bufa, bufaR, gainA);
+        else smooth::gain(n_samples, bufa, bufa, gainA);
+        t = profiler.lap(StageProfiler::GAIN_A, t);
     }
 
     // process input volume slot B
     if (_neuralB.load(std::memory_order_acquire)) {
-        for (uint32_t i0 = 0; i0 < n_samples; i0 = i0 + 1) {
-            fRec4[0] = fSlow4 + 0.999 * fRec4[1];
-            bufb[i0] = float(double(bufb[i0]) * fRec4[0]);
-            fRec4[1] = fRec4[0];
-        }
+        if (stereo) smooth::gain2(n_samples, bufb, bufbR, bufb, bufbR, gainB);
+        else smooth::gain(n_samples, bufb, bufb, gainB);
+        t = profiler.lap(StageProfiler::GAIN_B, t);
     }
 
     // process slot B in parallel thread
     _bufb = bufb;
+    _bufbR = stereo ? bufbR : nullptr;
+    _sizeb = n_samples;
     if (_neuralB.load(std::memory_order_acquire) ) {
-        if ( pro.getProcess()) {
+        if (freewheel) {
+            processSlotB();
+        } else if ( pro.getProcess()) {
             pro.setProcessor(0);
             pro.runProcess();
         } else {
@@ -478,13 +898,18 @@ inline void Engine::processDsp(uint32_t n_samples, float* output)
 
     // process slot A
     if (_neuralA.load(std::memory_order_acquire)) {
-        slotA.compute(n_samples, bufa, bufa);
-        if (normSlotA) slotA.normalize(n_samples, bufa);
+        t = profiler.now();
+        slotA.compute(n_samples, bufa, bufa, normSlotA);
+        if (stereo) slotAR.compute(n_samples, bufaR, bufaR, normSlotA);
+        profiler.record(StageProfiler::SLOT_A, t);
     }
 
     //wait for parallel processed slot B when needed
-    if (_neuralB.load(std::memory_order_acquire)) {
-        if (!pro.processWait()) {
+    if (!freewheel && _neuralB.load(std::memory_order_acquire)) {
+        t = profiler.now();
+        bool ready = pro.processWait();
+        profiler.record(StageProfiler::WAIT_SLOT_B, t);
+        if (!ready) {
             XrunCounter += 1;
             _notify_ui.store(true, std::memory_order_release);
             //lv2_log_error(&logger,"thread RT missing wait\n");
@@ -497,41 +922,88 @@ inline void Engine::processDsp(uint32_t n_samples, float* output)
         }
     }
 
-    // mix output when needed
+    // mix output when needed and apply the output volume in the same pass
     if (_neuralA.load(std::memory_order_acquire) && _neuralB.load(std::memory_order_acquire)) {
-        for (uint32_t i0 = 0; i0 < n_samples; i0 = i0 + 1) {
-            fRec2[0] = fSlow2 + 0.999 * fRec2[1];
-            output[i0] = bufa[i0] * (1.0 - fRec2[0]) + bufb[i0] * fRec2[0];
-            fRec2[1] = fRec2[0];
-        }
+        if (stereo) smooth::mixGain2(n_samples, bufa, bufb, bufaR, bufbR, output, output1, blendAB, gainOut);
+        else smooth::mixGain(n_samples, bufa, bufb, output, blendAB, gainOut);
     } else if (_neuralA.load(std::memory_order_acquire)) {
-        memcpy(output, bufa, n_samples*sizeof(float));
+        if (stereo) smooth::gain2(n_samples, bufa, bufaR, output, output1, gainOut);
+        else smooth::gain(n_samples, bufa, output, gainOut);
     } else if (_neuralB.load(std::memory_order_acquire)) {
-        memcpy(output, bufb, n_samples*sizeof(float));
+        if (stereo) smooth::gain2(n_samples, bufb, bufbR, output, output1, gainOut);
+        else smooth::gain(n_samples, bufb, output, gainOut);
     }
 
-    if (_neuralA.load(std::memory_order_acquire) || _neuralB.load(std::memory_order_acquire)) {
-        // output volume
-        for (uint32_t i0 = 0; i0 < n_samples; i0 = i0 + 1) {
-            fRec3[0] = fSlow3 + 0.999 * fRec3[1];
-            output[i0] = float(double(output[i0]) * fRec3[0]);
-            fRec3[1] = fRec3[0];
-        }
+    // run dcblocker
+    t = profiler.now();
+    if (stereo) dcb->compute_stereo(n_samples, output, output1, output, output1);
+    else dcb->compute(n_samples, output, output);
+    profiler.record(StageProfiler::DCBLOCKER, t);
+    MXCSR.reset_();
+    return true;
+}
+
+// second stage: the two convolvers and the IR mix. It use it's own
+// scratch buffers, so that it could run concurrent to the model stage
+// of the next period. conv1 runs on the given thread.
+inline void Engine::processIR(uint32_t n_samples, float* output, float* output1,
+                                                        ParallelThread& thread)
+{
+    if(n_samples<1 || !scratchSize) return;
+
+    // process host blocks larger than the scratch buffers in slices
+    if (n_samples > scratchSize) {
+        for (uint32_t i = 0; i < n_samples; i += scratchSize)
+            processIR(std::min(scratchSize, n_samples - i), output + i,
+                                output1 ? output1 + i : nullptr, thread);
+        return;
     }
 
-    // run dcblocker
-    dcb->compute(n_samples, output, output);
+    MXCSR_IR.set_();
+    const bool stereo = output1 && bufcR;
+    mixIR.setTarget(double(mix));
+
+    // run both IR's as one pre-mixed convolution while the mix is static
+    IrPremix::Mode pm = IrPremix::TWO;
+    // but not in freewheel mode, the background build would make the
+    // switch point depend on the wall clock
+    if (!freewheel && !_execute.load(std::memory_order_acquire) &&
+                            conv.is_runnable() && conv1.is_runnable()) {
+        const uint32_t genA = conv.generation();
+        const uint32_t genB = conv1.generation();
+        const bool uniform = conv.is_uniform() && conv1.is_uniform() &&
+                        (!stereo || (convR.is_uniform() && conv1R.is_uniform()));
+        pm = premix.begin(n_samples, genA, genB, uniform, mix, mixIR.isSteady());
+        if (xrworker.getState() && premix.request()) {
+            _build_premix.store(true, std::memory_order_release);
+            xrworker.runProcess();
+        }
+    } else premix.drop();
+    const bool two = pm != IrPremix::PREMIX;
 
     // set buffer for mix control
-    memcpy(bufa, output, n_samples*sizeof(float));
-    memcpy(bufb, output, n_samples*sizeof(float));
+    memcpy(bufc, output, n_samples*sizeof(float));
+    memcpy(bufd, output, n_samples*sizeof(float));
+    if (stereo) {
+        memcpy(bufcR, output1, n_samples*sizeof(float));
+        memcpy(bufdR, output1, n_samples*sizeof(float));
+    }
+    if (premix.active()) {
+        memcpy(bufe, output, n_samples*sizeof(float));
+        if (stereo) memcpy(bufeR, output1, n_samples*sizeof(float));
+    }
 
     // process conv1 in parallel thread
-    _bufb = bufb;
-    if (!_execute.load(std::memory_order_acquire) && conv1.is_runnable()) {
-        if (pro.getProcess()) {
-            pro.setProcessor(1);
-            pro.runProcess();
+    _bufd = bufd;
+    _bufdR = stereo ? bufdR : nullptr;
+    _sized = n_samples;
+    uint64_t t;
+    if (two && !_execute.load(std::memory_order_acquire) && conv1.is_runnable()) {
+        if (freewheel) {
+            processConv1();
+        } else if (thread.getProcess()) {
+            thread.setProcessor(1);
+            thread.runProcess();
         } else {
             XrunCounter += 1;
             _notify_ui.store(true, std::memory_order_release);
@@ -547,12 +1019,19 @@ inline void Engine::processDsp(uint32_t n_samples, float* output)
     }
 
     // process conv
-    if (!_execute.load(std::memory_order_acquire) && conv.is_runnable())
-        conv.compute(n_samples, bufa, bufa);
+    if (two && !_execute.load(std::memory_order_acquire) && conv.is_runnable()) {
+        t = profiler.now();
+        conv.compute(n_samples, bufc, bufc);
+        if (stereo && convR.is_runnable()) convR.compute(n_samples, bufcR, bufcR);
+        profiler.record(StageProfiler::CONV, t);
+    }
 
     // wait for parallel processed conv1 when needed
-    if (!_execute.load(std::memory_order_acquire) && conv1.is_runnable()) {
-        if (!pro.processWait()) {
+    if (two && !freewheel && !_execute.load(std::memory_order_acquire) && conv1.is_runnable()) {
+        t = profiler.now();
+        bool ready = thread.processWait();
+        profiler.record(StageProfiler::WAIT_CONV1, t);
+        if (!ready) {
             XrunCounter += 1;
             _notify_ui.store(true, std::memory_order_release);
             //lv2_log_error(&logger,"thread RT (conv) missing wait\n");
@@ -565,25 +1044,62 @@ inline void Engine::processDsp(uint32_t n_samples, float* output)
         }
     }
 
+    // keep conv and conv1 up to date while the pre-mix run
+    if (!two) {
+        t = profiler.now();
+        conv.feed(n_samples, bufc);
+        conv1.feed(n_samples, bufd);
+        if (stereo) {
+            convR.feed(n_samples, bufcR);
+            conv1R.feed(n_samples, bufdR);
+        }
+        profiler.record(StageProfiler::CONV, t);
+    }
+
     // mix output when needed
-    if ((!_execute.load(std::memory_order_acquire) &&
+    if ((two && !_execute.load(std::memory_order_acquire) &&
             conv.is_runnable()) && conv1.is_runnable()) {
-        for (uint32_t i0 = 0; i0 < n_samples; i0 = i0 + 1) {
-            fRec1[0] = fSlow1 + 0.999 * fRec1[1];
-            output[i0] = bufa[i0] * (1.0 - fRec1[0]) + bufb[i0] * fRec1[0];
-            fRec1[1] = fRec1[0];
+        if (stereo) smooth::mix2(n_samples, bufc, bufd, bufcR, bufdR, output, output1, mixIR);
+        else smooth::mix(n_samples, bufc, bufd, output, mixIR);
+    } else if (two && !_execute.load(std::memory_order_acquire) && conv.is_runnable()) {
+        memcpy(output, bufc, n_samples*sizeof(float));
+        if (stereo) memcpy(output1, bufcR, n_samples*sizeof(float));
+    } else if (two && !_execute.load(std::memory_order_acquire) && conv1.is_runnable()) {
+        memcpy(output, bufd, n_samples*sizeof(float));
+        if (stereo) memcpy(output1, bufdR, n_samples*sizeof(float));
+    }
+
+    // process the pre-mix and crossfade to it when needed
+    if (premix.active()) {
+        t = profiler.now();
+        premix.compute(n_samples, bufe, bufe, 0);
+        if (stereo) premix.compute(n_samples, bufeR, bufeR, 1);
+        if (pm == IrPremix::PREMIX) {
+            memcpy(output, bufe, n_samples*sizeof(float));
+            if (stereo) memcpy(output1, bufeR, n_samples*sizeof(float));
+        } else if (pm == IrPremix::BOTH) {
+            if (stereo) smooth::mix2(n_samples, output, bufe, output1, bufeR, output, output1,
+                                                                        premix.fader());
+            else smooth::mix(n_samples, output, bufe, output, premix.fader());
         }
-    } else if (!_execute.load(std::memory_order_acquire) && conv.is_runnable()) {
-        memcpy(output, bufa, n_samples*sizeof(float));
-    } else if (!_execute.load(std::memory_order_acquire) && conv1.is_runnable()) {
-        memcpy(output, bufb, n_samples*sizeof(float));
+        profiler.record(StageProfiler::CONV, t);
     }
-    // notify neural modeller that process cycle is done
-    Sync.notify_all();
-    MXCSR.reset_();
+
+    // the tail levels of long IR's which missed there deadline
+    if (const uint32_t missed = levelWorkers.takeMissed()) {
+        XrunCounter += missed;
+        _notify_ui.store(true, std::memory_order_release);
+    }
+    MXCSR_IR.reset_();
 }
 
 inline void Engine::process(uint32_t n_samples, float* output) {
+    process(n_samples, output, nullptr);
+}
+
+// output1 is the right channel in stereo mode, nullptr in mono mode
+inline void Engine::process(uint32_t n_samples, float* output, float* output1) {
+    if (channels < 2) output1 = nullptr;
     // process in buffered mode
     if ((buffered > 0.0) && bufferIsInit.load(std::memory_order_acquire)) {
         // avoid buffer overflow on frame size change
@@ -594,48 +1110,107 @@ inline void Engine::process(uint32_t n_samples, float* output) {
             xrworker.runProcess();
             return;
         }
-        // get the buffer from previous process
-        if (!par.processWait()) {
-            XrunCounter += 1;
-            _notify_ui.store(true, std::memory_order_release);
-           // lv2_log_error(&logger,"thread RTBUF missing wait\n");
-            // if deadline was missing, erase models from processing
-            /*if (!_execute.load(std::memory_order_acquire)) {
-                _ab.store(3, std::memory_order_release);
-                 model_file = "None";
-                 model_file1 = "None";
-                _execute.store(true, std::memory_order_release);
-                xrworker.runProcess();
-            }*/
+        const uint64_t period = profiler.now();
+        const uint32_t depth = std::clamp(static_cast<uint32_t>(buffered), 1u, MAX_PERIODS);
+        uint32_t head = ringHead.load(std::memory_order_relaxed);
+        // (re)start the ring with silence when the depth change, but only
+        // when the model stage is idle, otherwise it may still store its
+        // tail over the reset. Then try again next period
+        if (depth != ringDepth && !par.getState()) {
+            memset(output, 0, n_samples*sizeof(float));
+            if (output1) memset(output1, 0, n_samples*sizeof(float));
+            profiler.record(StageProfiler::PERIOD, period);
+            profiler.publish(n_samples);
+            return;
         }
-        // copy incoming data to internal input buffer
-        memcpy(bufferinput0, output, n_samples*sizeof(float));
-
+        if (depth != ringDepth) {
+            ring.clear();
+            for (uint32_t i = 0; i < RING_SLOTS; i++) ringIR[i] = false;
+            ringTail.store(head, std::memory_order_release);
+            ringDepth = depth;
+        }
+        _bufStereo = output1 && ringBuf[0][1];
+
+        // the period leaving the ring now entered it depth periods ago,
+        // before that the ring delivers the silence it was cleared with
+        const uint32_t out = head - depth;
+        const uint32_t slot = out % RING_SLOTS;
+        bool ready = static_cast<int32_t>(ringTail.load(std::memory_order_acquire) - out) > 0;
+        if (!ready) {
+            // wait for the model stage, that is a xrun in one period mode
+            ready = par.processWait() &&
+                static_cast<int32_t>(ringTail.load(std::memory_order_acquire) - out) > 0;
+            if (!ready) {
+                XrunCounter += 1;
+                _notify_ui.store(true, std::memory_order_release);
+               // lv2_log_error(&logger,"thread RTBUF missing wait\n");
+                // if deadline was missing, erase models from processing
+                /*if (!_execute.load(std::memory_order_acquire)) {
+                    _ab.store(3, std::memory_order_release);
+                     model_file = "None";
+                     model_file1 = "None";
+                    _execute.store(true, std::memory_order_release);
+                    xrworker.runProcess();
+                }*/
+            }
+        }
+        const bool runIR = ready && ringIR[slot];
         bufsize = n_samples;
-        // copy processed data from last circle to output
-        memcpy(output, bufferoutput0, bufsize*sizeof(float));
-        // copy internal input buffer to process buffer for next circle
-        memcpy(bufferoutput0, bufferinput0, bufsize*sizeof(float));
-
-        // process data in background thread
-        if (par.getProcess()) par.runProcess();
-        else {
-            XrunCounter += 1;
-            _notify_ui.store(true, std::memory_order_release);
-            // lv2_log_error(&logger,"thread RTBUF missing deadline\n");
-            // if deadline was missing, erase models from processing
-           /* if (!_execute.load(std::memory_order_acquire)) {
-                _ab.store(3, std::memory_order_release);
-                 model_file = "None";
-                 model_file1 = "None";
-                _execute.store(true, std::memory_order_release);
-                xrworker.runProcess();
-            }*/
+
+        // the model stage lags the whole ring behind, restart it next period
+        if (head - ringTail.load(std::memory_order_acquire) >= RING_SLOTS - 1) ringDepth = 0;
+
+        // queue the incoming period, in-place in it's ring slot. The host
+        // own the buffers, so one copy in and one copy out is the minimum,
+        // the ring slots itself are only handed on by index
+        const uint32_t in = head % RING_SLOTS;
+        memcpy(ringBuf[in][0], output, n_samples*sizeof(float));
+        if (_bufStereo) memcpy(ringBuf[in][1], output1, n_samples*sizeof(float));
+        ringFrames[in] = n_samples;
+        ringHead.store(++head, std::memory_order_release);
+
+        // hand out the leaving period, or silence when it isn't ready
+        if (ready) {
+            memcpy(output, ringBuf[slot][0], n_samples*sizeof(float));
+            if (_bufStereo) memcpy(output1, ringBuf[slot][1], n_samples*sizeof(float));
+        } else {
+            memset(output, 0, n_samples*sizeof(float));
+            if (output1) memset(output1, 0, n_samples*sizeof(float));
+        }
+
+        // process the model stage for the queued periods in background thread,
+        // a still running model stage pick up the new period by itself
+        bool start = !ringBusy.exchange(true, std::memory_order_seq_cst);
+        // a run which never started, as processWait gave up on it, start again
+        if (!start && par.getState() && !par.isBusy()) start = true;
+        if (start) {
+            if (par.getProcess()) par.runProcess();
+            else {
+                ringBusy.store(false, std::memory_order_release);
+                XrunCounter += 1;
+                _notify_ui.store(true, std::memory_order_release);
+                // lv2_log_error(&logger,"thread RTBUF missing deadline\n");
+            }
         }
-        latency = n_samples;
+
+        // meanwhile run the IR stage for the leaving period here,
+        // with conv1 on it's own thread, as pro is in use by slot B
+        if (runIR && bypass) processIR(n_samples, output, _bufStereo ? output1 : nullptr, pconv);
+        profiler.record(StageProfiler::PERIOD, period);
+        profiler.publish(n_samples);
+        latency = n_samples * depth;
     } else {
+        // the model stage may still run queued periods, it share the
+        // slots, buffers and the graph with processDsp, so wait for it
+        if (ringBusy.load(std::memory_order_acquire) || !par.getState()) {
+            memset(output, 0, n_samples*sizeof(float));
+            if (output1) memset(output1, 0, n_samples*sizeof(float));
+            return;
+        }
+        // restart the ring when the buffered mode is entered again
+        ringDepth = 0;
         // process latency free
-        processDsp(n_samples, output);
+        processDsp(n_samples, output, output1);
         latency = 0.0;
     }
 }
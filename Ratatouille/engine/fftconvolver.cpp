@@ -109,169 +109,250 @@ int Audiofile::read(float *data, uint32_t frames) {
 
 bool ConvolverSelector::configure(std::string fname, float gain, unsigned int delay,
                     unsigned int offset, unsigned int length, unsigned int size, unsigned int bufsize) {
+    const bool ret = prepare(fname);
+    commit();
+    retire();
+    return ret;}
+
+bool ConvolverSelector::prepare(std::string fname, const ratatouille::CancelToken *token) {
+    const int t = target.load(std::memory_order_acquire);
+    // the standby bank may be still in use by the real-time thread
+    if (!waitLive(t)) return false;
+    Bank& b = bank(1 - t);
+    b.conv->set_not_runnable();
+    b.conv->stop_process();
+    b.conv->cleanup();
+    b.conv = &b.sconv;
+    b.file = "None";
+    b.norm = b.sconv.get_normalisation();
+    standby = true;
+    if (fname.empty() || fname == "None") return true;
+    if (token && token->cancelled()) return false;
     Audiofile audio;
     if (audio.open_read(fname)) {
         fprintf(stderr, "Unable to open %s\n", fname.c_str() );
         return false;
     }
-    int asize = audio.size();
-    //fprintf(stderr, "%i Run %s\n",asize, asize>16384 ? "DoubleThreadConvolver" : "SingelThreadConvolver");
+    // the IR length at the host rate
+    uint32_t len = audio.size();
+    if (audio.rate() > 0 && samplerate) len = static_cast<uint64_t>(len) * samplerate / audio.rate();
     audio.close();
-    int maxSize = 16384;
-    #ifdef __MOD_DEVICES__
-    maxSize = 4069;
-    #endif
-    if (asize > maxSize) conv = &dconv;
-    else conv = &sconv;
+    // the planner pick the convolver and the partition sizes
+    const ratatouille::ConvolverPlan plan =
+                ratatouille::ConvolverPlanner::get().plan(len, buffersize, samplerate, token);
+    if (plan.engine == ratatouille::ConvolverPlan::MULTI) b.conv = &b.dconv;
+    else if (plan.engine == ratatouille::ConvolverPlan::DIRECT) b.conv = &b.hconv;
+    else b.conv = &b.sconv;
+    //fprintf(stderr, "%i Run %s\n", len, plan.str().c_str());
+    b.conv->set_plan(plan);
+    b.layout = plan.layout();
+
+    b.conv->set_cancel(token);
+    const bool configured = b.conv->configure(fname, 1.0, 0, 0, 0, 0, 0);
+    b.conv->set_cancel(nullptr);
+    if (!configured) {
+        b.conv->set_not_runnable();
+        return false;
+    }
+    while (!b.conv->checkstate());
+    b.file = fname;
+    return b.conv->start(25, 1);}
+
+void ConvolverSelector::commit() {
+    if (!standby) return;
+    standby = false;
+    std::lock_guard<std::mutex> lk(sourceMutex);
+    gen.fetch_add(1, std::memory_order_acq_rel);
+    target.store(1 - target.load(std::memory_order_acquire), std::memory_order_release);}
+
+bool ConvolverSelector::getSource(std::string& file, uint32_t& norm,
+                            ratatouille::IrLayout& layout, uint32_t& generation) {
+    std::lock_guard<std::mutex> lk(sourceMutex);
+    Bank& b = bank(target.load(std::memory_order_acquire));
+    file = b.file;
+    norm = b.norm;
+    layout = b.layout;
+    generation = gen.load(std::memory_order_acquire);
+    return b.conv->is_runnable() && file != "None";}
+
+void ConvolverSelector::retire() {
+    const int t = target.load(std::memory_order_acquire);
+    Bank& b = bank(1 - t);
+    // when the real-time thread isn't confirmed to have left the bank,
+    // leave it for the next prepare()
+    if (!b.conv->is_runnable() || !waitLive(t)) return;
+    b.conv->set_not_runnable();
+    b.conv->stop_process();
+    b.conv->cleanup();}
+
+// wait until the real-time thread runs on bank i, the engine notify
+// SyncWait each process cycle. When the selector wasn't run for two
+// cycles, switch the bank here instead of waiting for it.
+// Returns false when it couldn't be confirmed
+bool ConvolverSelector::waitLive(int i) {
+    uint32_t last = ticks.load(std::memory_order_acquire);
+    int idle = 0;
+    for (int n = 0; n < 50; n++) {
+        if (live.load(std::memory_order_acquire) == i) return true;
+        if (SyncWait) {
+            std::unique_lock<std::mutex> lk(WMutex);
+            SyncWait->wait_for(lk, std::chrono::milliseconds(10));
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        const uint32_t now = ticks.load(std::memory_order_acquire);
+        idle = now == last ? idle + 1 : 0;
+        last = now;
+        if (idle >= 2 && takeOver(i)) return true;
+    }
+    return live.load(std::memory_order_acquire) == i;}
 
-    return conv->configure(fname, gain, delay, offset, length, size,bufsize);}
+// switch the real-time state to bank i without a fade, fails when
+// the real-time thread use the selector right now
+bool ConvolverSelector::takeOver(int i) {
+    int e = FREE;
+    if (!owner.compare_exchange_strong(e, WORKER, std::memory_order_acquire))
+        return false;
+    active = i;
+    previous = i;
+    fading = false;
+    fadePos = 0;
+    live.store(i, std::memory_order_release);
+    owner.store(FREE, std::memory_order_release);
+    return true;}
 
 
 /****************************************************************
- ** DoubleThreadConvolver
+ ** LevelWorkers
  */
 
-void DoubleThreadConvolver::startBackgroundProcessing()
+int LevelWorkers::bind(MultiThreadConvolver *owner, size_t level, uint32_t timeout)
 {
-    if (pro.getProcess()) {
-        pro.runProcess();
-    } else {
-        doBackgroundProcessing();
+    std::lock_guard<std::mutex> lk(lock);
+    // prefer a running worker, start a new one only when all are bound
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < MAX_WORKERS; i++) {
+            Worker& k = w[i];
+            if (k.bound || (!pass && !k.pro.isRunning())) continue;
+            k.owner = owner;
+            k.level = level;
+            k.bound = true;
+            if (!k.pro.isRunning()) {
+                k.pro.setSharedPool(RtPool::enabled());
+                k.pro.start();
+                k.pro.setThreadName("Convolver");
+                k.pro.setPriority(25, 1); //SCHED_FIFO
+                k.pro.set<Worker, &Worker::run>(&k);
+            }
+            k.pro.setTimeOut(timeout);
+            return static_cast<int>(i);
+        }
     }
+    return -1;
 }
 
-
-void DoubleThreadConvolver::waitForBackgroundProcessing()
+void LevelWorkers::unbind(int i)
 {
-    pro.processWait();
+    Worker& k = w[i];
+    // a job not yet started is dropped, a running one take at most
+    // one block of the level, the levels are freed afterwards
+    int e = QUEUED;
+    k.job.compare_exchange_strong(e, IDLE, std::memory_order_acq_rel);
+    while (k.job.load(std::memory_order_acquire) == RUNNING)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::lock_guard<std::mutex> lk(lock);
+    k.owner = nullptr;
+    k.bound = false;
 }
 
-bool DoubleThreadConvolver::get_buffer(std::string fname, float **buffer, uint32_t *rate, int *asize)
+bool LevelWorkers::run(int i)
 {
-    Audiofile audio;
-    if (audio.open_read(fname)) {
-        fprintf(stderr, "Unable to open %s\n", fname.c_str() );
-        *buffer = 0;
-        return false;
-    }
-    *rate = audio.rate();
-    *asize = audio.size();
-    const int limit = 2000000; // arbitrary size limit
-    if (*asize > limit) {
-        fprintf(stderr, "too many samples (%i), truncated to %i\n"
-                           , audio.size(), limit);
-        *asize = limit;
-    }
-    if (*asize * audio.chan() == 0) {
-        fprintf(stderr, "No samples found\n");
-        *buffer = 0;
-        audio.close();
-        return false;
-    }
-    float* cbuffer = new float[*asize * audio.chan()];
-    if (audio.read(cbuffer, *asize) != static_cast<int>(*asize)) {
-        delete[] cbuffer;
-        fprintf(stderr, "Error reading file\n");
-        *buffer = 0;
-        audio.close();
-        return false;
-    }
-    if (audio.chan() > 1) {
-        //fprintf(stderr,"only taking first channel of %i channels in impulse response\n", audio.chan());
-        float *abuffer = new float[*asize];
-        for (int i = 0; i < *asize; i++) {
-            abuffer[i] = cbuffer[i * audio.chan()];
-        }
-        delete[] cbuffer;
-        cbuffer = NULL;
-        cbuffer = abuffer;
-    }
-    *buffer = cbuffer;
-    audio.close();
-    if (*rate != samplerate) {
-        *buffer = resamp.process(*rate, *asize, *buffer, samplerate, asize);
-        if (!*buffer) {
-            printf("no buffer\n");
-            return false;
-        }
-        //fprintf(stderr, "FFTConvolver: resampled from %i to %i\n", *rate, samplerate);
-    }
+    Worker& k = w[i];
+    if (!k.pro.getProcess()) return false;
+    k.job.store(QUEUED, std::memory_order_release);
+    k.pro.runProcess();
     return true;
 }
 
-void DoubleThreadConvolver::normalize(float* buffer, int asize) {
-    // normalize
-    float gain = 0.0;
-    float peak = 0.0;
-    // get normalization peak
-    for (int i = 0; i < asize; i++) {
-        peak = std::max(peak, std::abs( buffer[i])) ;
-    }
-    // apply normalize factor and get gain factor
-    if (peak != 0.0) {
-        peak = 0.8 / peak;
-        for (int i = 0; i < asize; i++) {
-           buffer[i] *= peak;
-
-           double v = buffer[i] ;
-           gain += v*v;
-        }
-    }
-    //if (!norm) return;
-    // apply gain square root factor when needed
-    if (gain != 0.0) {
-        if (!norm) gain = 1.5 / gain;
-        else gain = 1.0 / gain;
-
-        for (int i = 0; i < asize; i++) {
-            buffer[i] *= gain;
-        }
-    }
+bool LevelWorkers::finish(int i)
+{
+    Worker& k = w[i];
+    k.pro.processWait();
+    // processWait() gave up before the worker picked up the job
+    int e = QUEUED;
+    if (k.job.compare_exchange_strong(e, IDLE, std::memory_order_acq_rel)) return false;
+    return e == IDLE;
 }
 
-void DoubleThreadConvolver::set_normalisation(uint32_t norm_) {
-    norm = norm_;
+void LevelWorkers::Worker::run()
+{
+    int e = QUEUED;
+    if (!job.compare_exchange_strong(e, RUNNING, std::memory_order_acq_rel)) return;
+    owner->doBackgroundProcessing(level);
+    job.store(IDLE, std::memory_order_release);
 }
 
-bool DoubleThreadConvolver::configure(std::string fname, float gain, unsigned int delay, unsigned int offset,
-            unsigned int length, unsigned int size, unsigned int bufsize)
+/****************************************************************
+ ** MultiThreadConvolver
+ */
+
+void MultiThreadConvolver::startBackgroundProcessing(size_t level)
 {
-    filename = fname;
-    float* abuf = NULL;
-    uint32_t arate = 0;
-    int asize = 0;
-    if (!get_buffer(fname, &abuf, &arate, &asize)) {
-        return false;
-    }
-    normalize(abuf, asize);
+    const int l = leaseOf(level);
+    // the last job of the level is done (see waitForBackgroundProcessing),
+    // so running it here doesn't race with the worker
+    if (freewheel || l < 0 || !workers->run(l)) doBackgroundProcessing(level);
+}
+
 
-    pro.setTimeOut(std::max(100,static_cast<int>((buffersize/(samplerate*0.000001))*0.1)));
+bool MultiThreadConvolver::waitForBackgroundProcessing(size_t level)
+{
+    const int l = leaseOf(level);
+    if (freewheel || l < 0) return true;
+    if (workers->finish(l)) return true;
+    workers->miss();
+    return false;
+}
 
-    uint32_t _head = 1;
-    while (_head < buffersize) {
-        _head *= 2;
+void MultiThreadConvolver::unbind()
+{
+    for (std::atomic<int>& l : lease) {
+        const int w = l.exchange(-1, std::memory_order_acq_rel);
+        if (w >= 0) workers->unbind(w);
     }
+}
+
+void MultiThreadConvolver::set_normalisation(uint32_t norm_) {
+    norm = norm_;
+}
 
-    uint32_t _tail = _head > 8192 ? _head : 8192;
-    #ifdef __MOD_DEVICES__
-    _head = 128;
-    _tail = 2048;
-    #endif
-    //fprintf(stderr, "head %i tail %i irlen %i \n", _head, _tail, asize);
-    if (init(_head, _tail, abuf, asize)) {
+bool MultiThreadConvolver::configure(std::string fname, float gain, unsigned int delay, unsigned int offset,
+            unsigned int length, unsigned int size, unsigned int bufsize)
+{
+    filename = fname;
+    timeout = std::max(100,static_cast<int>((buffersize/(samplerate*0.000001))*0.1));
+
+    // without a plan use the fixed layout
+    const ratatouille::ConvolverPlan p = plan.engine == ratatouille::ConvolverPlan::MULTI ?
+                                plan : ratatouille::ConvolverPlanner::fallback(UINT32_MAX, buffersize);
+    // the spectrum is shared with all convolvers using the same file
+    std::shared_ptr<const ratatouille::IrSpectrum> ir = ratatouille::IrStore::get().acquire(
+                fname, samplerate, norm, p.layout(), cancel);
+    // give up when a newer request superseded this one
+    if (!ir || cancelled()) return false;
+    //fprintf(stderr, "head %i levels %zu irlen %i \n", p.block, ir->parts.size(), ir->length);
+    if (init(ir)) {
         ready = true;
-        delete[] abuf;
         return true;
     }
-    delete[] abuf;
     return false;
 }
 
-inline std::string DoubleThreadConvolver::getIrFile() {
+inline std::string MultiThreadConvolver::getIrFile() {
     return filename;
 }
 
-void DoubleThreadConvolver::compute(int32_t count, float* input, float* output)
+void MultiThreadConvolver::compute(int32_t count, float* input, float* output)
 {
     if (ready) process(input, output, count);
 }
@@ -280,122 +361,70 @@ void DoubleThreadConvolver::compute(int32_t count, float* input, float* output)
  ** SingleThreadConvolver
  */
 
-bool SingleThreadConvolver::get_buffer(std::string fname, float **buffer, uint32_t *rate, int *asize)
+void SingleThreadConvolver::set_normalisation(uint32_t norm_) {
+    norm = norm_;
+}
+
+bool SingleThreadConvolver::configure(std::string fname, float gain, unsigned int delay, unsigned int offset,
+            unsigned int length, unsigned int size, unsigned int bufsize)
 {
-    Audiofile audio;
-    if (audio.open_read(fname)) {
-        fprintf(stderr, "Unable to open %s\n", fname.c_str() );
-        *buffer = 0;
-        return false;
-    }
-    *rate = audio.rate();
-    *asize = audio.size();
-    const int limit = 2000000; // arbitrary size limit
-    if (*asize > limit) {
-        fprintf(stderr, "too many samples (%i), truncated to %i\n"
-                           , audio.size(), limit);
-        *asize = limit;
-    }
-    if (*asize * audio.chan() == 0) {
-        fprintf(stderr, "No samples found\n");
-        *buffer = 0;
-        audio.close();
-        return false;
-    }
-    float* cbuffer = new float[*asize * audio.chan()];
-    if (audio.read(cbuffer, *asize) != static_cast<int>(*asize)) {
-        delete[] cbuffer;
-        fprintf(stderr, "Error reading file\n");
-        *buffer = 0;
-        audio.close();
-        return false;
-    }
-    if (audio.chan() > 1) {
-        //fprintf(stderr,"only taking first channel of %i channels in impulse response\n", audio.chan());
-        float *abuffer = new float[*asize];
-        for (int i = 0; i < *asize; i++) {
-            abuffer[i] = cbuffer[i * audio.chan()];
-        }
-        delete[] cbuffer;
-        cbuffer = NULL;
-        cbuffer = abuffer;
-    }
-    *buffer = cbuffer;
-    audio.close();
-    if (*rate != samplerate) {
-        *buffer = resamp.process(*rate, *asize, *buffer, samplerate, asize);
-        if (!*buffer) {
-            printf("no buffer\n");
-            return false;
-        }
-        //fprintf(stderr, "FFTConvolver: resampled from %i to %i\n", *rate, samplerate);
+    filename = fname;
+    // without a plan use the fixed layout
+    const ratatouille::ConvolverPlan p = plan.engine == ratatouille::ConvolverPlan::UNIFORM ?
+                                plan : ratatouille::ConvolverPlanner::fallback(0, buffersize);
+    // the spectrum is shared with all convolvers using the same file
+    std::shared_ptr<const ratatouille::IrSpectrum> ir = ratatouille::IrStore::get().acquire(
+                    fname, samplerate, norm, p.layout(), cancel);
+    // give up when a newer request superseded this one
+    if (!ir || cancelled()) return false;
+    if (init(ir, 0)) {
+        ready = true;
+        return true;
     }
-    return true;
+    return false;
 }
 
-void SingleThreadConvolver::normalize(float* buffer, int asize) {
-    // normalize
-    float gain = 0.0;
-    float peak = 0.0;
-    // get normalization peak
-    for (int i = 0; i < asize; i++) {
-        peak = std::max(peak, std::abs( buffer[i])) ;
-    }
-    // apply normalize factor and get gain factor
-    if (peak != 0.0) {
-        peak = 0.8/peak;
-        for (int i = 0; i < asize; i++) {
-           buffer[i] *= peak;
-
-           double v = buffer[i] ;
-           gain += v*v;
-        }
-    }
-    //if (!norm) return;
-    // apply gain square root factor when needed
-    if (gain != 0.0) {
-        if (!norm) gain = 1.5 / gain;
-        else gain = 1.0 / gain;
-
-        for (int i = 0; i < asize; i++) {
-            buffer[i] *= gain;
-        }
-    }
+inline std::string SingleThreadConvolver::getIrFile() {
+    return filename;
 }
 
-void SingleThreadConvolver::set_normalisation(uint32_t norm_) {
+void SingleThreadConvolver::compute(int32_t count, float* input, float* output)
+{
+    if (ready) process(input, output, count);
+}
+
+/****************************************************************
+ ** DirectHeadConvolver
+ */
+
+void DirectHeadConvolver::set_normalisation(uint32_t norm_) {
     norm = norm_;
 }
 
-bool SingleThreadConvolver::configure(std::string fname, float gain, unsigned int delay, unsigned int offset,
+bool DirectHeadConvolver::configure(std::string fname, float gain, unsigned int delay, unsigned int offset,
             unsigned int length, unsigned int size, unsigned int bufsize)
 {
     filename = fname;
-    float* abuf = NULL;
-    uint32_t arate = 0;
-    int asize = 0;
-    if (!get_buffer(fname, &abuf, &arate, &asize)) {
-        return false;
-    }
-    normalize(abuf, asize);
-    uint32_t csize = 1024;
-    #ifdef __MOD_DEVICES__
-    csize = 256;
-    #endif
-    if (init(csize, abuf, asize)) {
+    // only used with a plan, fall back to the smallest FIR head
+    const ratatouille::ConvolverPlan p = plan.engine == ratatouille::ConvolverPlan::DIRECT ?
+                                plan : ratatouille::ConvolverPlan{ratatouille::ConvolverPlan::DIRECT, 64, 0};
+    // the spectrum is shared with all convolvers using the same file
+    std::shared_ptr<const ratatouille::IrSpectrum> ir = ratatouille::IrStore::get().acquire(
+                    fname, samplerate, norm, p.layout(), cancel);
+    // give up when a newer request superseded this one
+    if (!ir || cancelled()) return false;
+    if (init(ir)) {
         ready = true;
-        delete[] abuf;
         return true;
     }
-    delete[] abuf;
     return false;
 }
 
-inline std::string SingleThreadConvolver::getIrFile() {
+inline std::string DirectHeadConvolver::getIrFile() {
     return filename;
 }
 
-void SingleThreadConvolver::compute(int32_t count, float* input, float* output)
+void DirectHeadConvolver::compute(int32_t count, float* input, float* output)
 {
     if (ready) process(input, output, count);
 }
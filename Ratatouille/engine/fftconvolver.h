@@ -30,15 +30,20 @@
 
 #include <stdint.h>
 #include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
 #include <sndfile.hh>
 
-#include "TwoStageFFTConvolver.h"
+#include "PartitionedConvolver.h"
+#include "IrStore.h"
+#include "ConvolverPlanner.h"
 #include "ParallelThread.h"
-#include "gx_resampler.h"
+#include "CancelToken.h"
 
 
 /****************************************************************
@@ -125,30 +130,128 @@ public:
     virtual void set_samplerate(uint32_t sr) {}
     virtual int stop_process() {return 0;}
     virtual int cleanup() {return 0;}
+    virtual void set_freewheel(bool on) {}
 
-    ConvolverBase() {};
+    // the token checked by configure(), nullptr for none (non rt)
+    void set_cancel(const ratatouille::CancelToken *token) { cancel = token;}
+    bool cancelled() const { return cancel && cancel->cancelled();}
+
+    // the partition sizes used by configure(), see ConvolverPlanner.h
+    void set_plan(const ratatouille::ConvolverPlan& p) { plan = p;}
+
+    ConvolverBase() : cancel(nullptr) {};
     virtual ~ConvolverBase() {};
+
+protected:
+    const ratatouille::CancelToken *cancel;
+    ratatouille::ConvolverPlan plan;
+};
+
+/****************************************************************
+ ** LevelWorkers - the worker threads for the tail levels of the MultiThreadConvolvers
+ *
+ *  One set per engine, shared by all MultiThreadConvolvers of it
+ *  (both banks of each ConvolverSelector and the graph nodes).
+ *  A MultiThreadConvolver bind a idle worker to each level of the
+ *  loaded IR when it's started, and give them back in cleanup().
+ *  So only the levels of the loaded IR's hold a worker, a idle bank
+ *  hold none. The workers are started on first use and kept for
+ *  later loads. When all MAX_WORKERS are bound, the level run in
+ *  the calling thread.
+ *  Each worker run one job at a time. A job the worker didn't pick
+ *  up in time is dropped, a job still running when the next block
+ *  of the level is due make the level skip that block, so a level
+ *  is never processed by two threads at once. Both count as missed.
+ *
+ *  usage (non rt):
+ *      int w = workers.bind(owner, level, timeout);
+ *      workers.unbind(w);
+ *  usage (rt):
+ *      if (workers.finish(w)) { swap the buffers; workers.run(w);}
+ *      XrunCounter += workers.takeMissed();
+ */
+
+class MultiThreadConvolver;
+
+class LevelWorkers
+{
+public:
+    static constexpr size_t MAX_WORKERS = 16;
+
+    // bind a idle worker to the level of owner, -1 when all are bound (non rt)
+    int bind(MultiThreadConvolver *owner, size_t level, uint32_t timeout);
+
+    // drop a job not yet started, wait for a running one, then free
+    // the worker (non rt)
+    void unbind(int i);
+
+    // start the job of the bound level, false when the thread is busy (rt)
+    bool run(int i);
+
+    // wait for the job, true when it's done and the next one could
+    // start, false when it's still running or was dropped (rt)
+    bool finish(int i);
+
+    // count a skipped block (rt)
+    inline void miss() { missed.fetch_add(1, std::memory_order_relaxed);}
+
+    // the skipped blocks since the last call (rt)
+    inline uint32_t takeMissed() { return missed.exchange(0, std::memory_order_relaxed);}
+
+    LevelWorkers() : missed(0) {}
+
+    ~LevelWorkers() {
+        for (Worker& k : w) k.pro.stop();}
+
+private:
+    enum { IDLE, QUEUED, RUNNING };
+
+    struct Worker {
+        MultiThreadConvolver *owner = nullptr;
+        size_t level = 0;
+        bool bound = false;
+        std::atomic<int> job{IDLE};
+        ParallelThread pro;
+        void run();
+    };
+
+    Worker w[MAX_WORKERS];
+    std::mutex lock;
+    std::atomic<uint32_t> missed;
 };
 
 /****************************************************************
- ** DoubleThreadConvolver - convolver for larger IR files, using a background thread to handle the tail
+ ** MultiThreadConvolver - convolver for larger IR files, using background threads to handle the tail
+ *
+ *  The head of the IR is convolved in the calling thread, each tail
+ *  level of the MultiLevelConvolver by a worker of the engine wide
+ *  LevelWorkers, so the levels are spread over the cores and each
+ *  one has a whole block of its size to finish. processWait() stays
+ *  only as a safety guard. Without LevelWorkers (see setWorkers)
+ *  the levels run in the calling thread.
+ *  The head and level sizes are given by the plan.
+ *  The prepared IR partitions are taken from the IrStore, so the
+ *  same file loaded in several convolvers is prepared only once.
  */
 
-class DoubleThreadConvolver: public ConvolverBase, public fftconvolver::TwoStageFFTConvolver
+class MultiThreadConvolver: public ConvolverBase, public ratatouille::MultiLevelConvolver
 {
 public:
-    std::mutex mo;
-    std::condition_variable co;
+    // levels beyond run in the calling thread
+    static constexpr size_t MAX_LEVELS = 8;
+
+    // bind the workers for the levels of the loaded IR
     bool start(int32_t policy, int32_t priority) override {
-        if (!pro.isRunning()) {
-            pro.start(); 
-            pro.setThreadName("Convolver");
-            pro.setPriority(25, 1); //SCHED_FIFO
-            pro.setTimeOut(200);
-            pro.set<DoubleThreadConvolver, &DoubleThreadConvolver::backgroundProcessing>(this);
+        if (workers) {
+            for (size_t k = 0; k < std::min(levelCount(), MAX_LEVELS); k++)
+                if (lease[k].load(std::memory_order_acquire) < 0)
+                    lease[k].store(workers->bind(this, k, timeout), std::memory_order_release);
         }
         return ready;}
 
+    // the workers to use, must be set before the first start (non rt)
+    void setWorkers(LevelWorkers *w) { workers = w;}
+
     void set_normalisation(uint32_t norm) override;
 
     uint32_t get_normalisation() override { return norm;}
@@ -174,40 +277,56 @@ public:
             ready = false;
             return 0;}
 
+    // a level may be still in work, wait for it before the levels are freed
     int cleanup () override {
+            unbind();
             reset();
             return 0;}
 
-    DoubleThreadConvolver()
-        : resamp(), ready(false), samplerate(0), pro() {
-            norm = 0;}
+    void set_freewheel(bool on) override { freewheel = on;}
+
+    MultiThreadConvolver()
+        : ready(false), samplerate(0), timeout(200), workers(nullptr) {
+            norm = 0;
+            freewheel = false;
+            for (std::atomic<int>& l : lease) l.store(-1, std::memory_order_relaxed);}
 
-    ~DoubleThreadConvolver() { reset(); pro.stop();}
+    ~MultiThreadConvolver() {
+        unbind();
+        reset();}
 
 protected:
-    void startBackgroundProcessing() override;
-    void waitForBackgroundProcessing() override;
+    void startBackgroundProcessing(size_t level) override;
+    bool waitForBackgroundProcessing(size_t level) override;
 
 private:
-    friend class ParallelThread;
-    gx_resample::BufferResampler resamp;
-    void backgroundProcessing() { return doBackgroundProcessing();}
+    friend class LevelWorkers;
+
     volatile bool ready;
     uint32_t buffersize;
     uint32_t samplerate;
     uint32_t norm;
+    uint32_t timeout;
+    bool freewheel;
     std::string filename;
-    ParallelThread pro;
-    std::atomic<bool> setWait;
-    bool get_buffer(std::string fname, float **buffer, uint32_t* rate, int* size);
-    void normalize(float* buffer, int asize);
+    LevelWorkers *workers;
+    // the worker bound to each level, -1 run the level in the calling thread
+    std::atomic<int> lease[MAX_LEVELS];
+
+    inline int leaseOf(size_t level) const {
+        return level < MAX_LEVELS ? lease[level].load(std::memory_order_acquire) : -1;}
+
+    void unbind();
 };
 
 /****************************************************************
  ** SingleThreadConvolver - convolver for small IR files, process in a single thread
+ *
+ *  The prepared IR partitions are taken from the IrStore,
+ *  the partition size is given by the plan.
  */
 
-class SingleThreadConvolver: public ConvolverBase, public fftconvolver::FFTConvolver
+class SingleThreadConvolver: public ConvolverBase, public ratatouille::PartitionedConvolver
 {
 public:
     bool start(int32_t policy, int32_t priority) override {
@@ -243,86 +362,369 @@ public:
             return 0;}
 
     SingleThreadConvolver()
-        : resamp(), ready(false), samplerate(0) { norm = 0;}
+        : ready(false), samplerate(0) { norm = 0;}
 
     ~SingleThreadConvolver() { reset();}
 
 private:
-    gx_resample::BufferResampler resamp;
     volatile bool ready;
     uint32_t buffersize;
     uint32_t samplerate;
     uint32_t norm;
     std::string filename;
-    bool get_buffer(std::string fname, float **buffer, uint32_t* rate, int* size);
-    void normalize(float* buffer, int asize);
+};
+
+/****************************************************************
+ ** DirectHeadConvolver - convolver for short IR files at small block sizes
+ *
+ *  The first taps of the IR run as direct FIR, the rest with
+ *  partitions of the same size, once per partition (see
+ *  ratatouille::HybridConvolver). The taps are given by the plan,
+ *  the planner choose it when it run cheaper than the per call
+ *  FFT of the SingleThreadConvolver.
+ */
+
+class DirectHeadConvolver: public ConvolverBase, public ratatouille::HybridConvolver
+{
+public:
+    bool start(int32_t policy, int32_t priority) override {
+        return ready;}
+
+    void set_normalisation(uint32_t norm) override;
+
+    uint32_t get_normalisation() override { return norm;}
+
+    bool configure(std::string fname, float gain, unsigned int delay, unsigned int offset,
+                    unsigned int length, unsigned int size, unsigned int bufsize) override;
+
+    inline std::string getIrFile() override;
+
+    void compute(int32_t count, float* input, float *output) override;
+
+    bool checkstate() override { return true;}
+
+    inline void set_not_runnable() override { ready = false;}
+
+    inline bool is_runnable() override { return ready;}
+
+    inline void set_buffersize(uint32_t sz) override { buffersize = sz;}
+
+    inline void set_samplerate(uint32_t sr) override { samplerate = sr;}
+
+    int stop_process() override {
+            ready = false;
+            return 0;}
+
+    int cleanup () override {
+            reset();
+            return 0;}
+
+    DirectHeadConvolver()
+        : ready(false), samplerate(0) { norm = 0;}
+
+    ~DirectHeadConvolver() { reset();}
+
+private:
+    volatile bool ready;
+    uint32_t buffersize;
+    uint32_t samplerate;
+    uint32_t norm;
+    std::string filename;
 };
 
 /****************************************************************
  ** ConvolverSelector - class to select the convolver to use based on the file size
+ *
+ *  The convolver and its partition sizes are taken from the
+ *  ConvolverPlanner, for the IR length, the host block size and
+ *  the sample rate.
+ *  The selector hold two banks of convolvers. A new IR file is
+ *  loaded into the standby bank by the worker thread (prepare),
+ *  while the real-time thread keeps running the active one.
+ *  commit() publish the standby bank with a atomic index swap, the
+ *  real-time thread pick it up at the next period and crossfade
+ *  from the old to the new IR over FADE_MS. A bank without IR
+ *  pass the dry signal, so loading and erasing fade as well.
+ *  retire() free the old bank, off the real-time thread, after the
+ *  fade is done. Without a fade buffer (see setFadeBuffer) the
+ *  switch is hard.
+ *  Each commit() count up the generation, so the IrPremix could
+ *  check that a pre-mixed IR still match the published banks.
+ *  A bank is only reused or freed when the real-time thread is
+ *  confirmed to have left it. When the real-time thread doesn't
+ *  run the selector (bypass, graph active, worker busy) the
+ *  worker switch the banks itself, see ModelerSelector.
+ *  The tail levels of long IR's run on the LevelWorkers given to
+ *  the constructor, shared with the other selectors of the engine.
+ *
+ *  usage (worker thread):
+ *      co.prepare(file);
+ *      co.commit();
+ *      co.retire();
  */
 
 class ConvolverSelector
 {
 public:
+    static constexpr int FADE_MS = 10;
+
     bool start(int32_t policy, int32_t priority) {
-            return conv->start(policy, priority);}
+            return bank(target.load(std::memory_order_acquire)).conv->start(policy, priority);}
 
     void set_normalisation(uint32_t norm) {
-            sconv.set_normalisation(norm);
-            dconv.set_normalisation(norm);}
+            for (Bank* b : {&bankA, &bankB}) {
+                b->sconv.set_normalisation(norm);
+                b->dconv.set_normalisation(norm);
+                b->hconv.set_normalisation(norm);
+            }}
 
     uint32_t get_normalisation() { 
-        return conv->get_normalisation();
+        return bank(target.load(std::memory_order_acquire)).conv->get_normalisation();
     }
 
+    // load, publish and retire in one go (non rt)
     bool configure(std::string fname, float gain, unsigned int delay,
                             unsigned int offset, unsigned int length,
                             unsigned int size, unsigned int bufsize);
 
+    // load the IR file into the standby bank, "None" leave it empty.
+    // The load give up early when the token is cancelled, or when the
+    // real-time thread couldn't be confirmed to have left the bank (non rt)
+    bool prepare(std::string fname, const ratatouille::CancelToken *token = nullptr);
+
+    // publish the standby bank to the real-time thread, does nothing
+    // when prepare() couldn't take the bank (non rt)
+    void commit();
+
+    // free the old bank when the real-time thread faded over, when that
+    // isn't confirmed the bank is freed by the next prepare() (non rt)
+    void retire();
+
     inline std::string getIrFile() {
-        return conv->getIrFile();
+        return bank(target.load(std::memory_order_acquire)).conv->getIrFile();
     }
 
-    void compute(int32_t count, float* input, float *output) {
-            conv->compute(count, input, output);}
+    // count of commits, read the generation before the banks (rt)
+    inline uint32_t generation() const {
+        return gen.load(std::memory_order_acquire);
+    }
+
+    // the file, normalisation and layout of the published bank with
+    // its generation, returns false without a IR (non rt)
+    bool getSource(std::string& file, uint32_t& norm, ratatouille::IrLayout& layout,
+                                                        uint32_t& generation);
+
+    // true when the real-time thread run a short IR in the published
+    // bank, without a pending fade (rt)
+    inline bool is_uniform() {
+        if (!claim()) return false;
+        const bool ret = uniform();
+        owner.store(FREE, std::memory_order_release);
+        return ret;
+    }
+
+    // keep the input delay line of the short IR up to date, while the
+    // IrPremix run the output (rt)
+    inline void feed(int32_t count, float* input) {
+        if (!claim()) return;
+        if (uniform()) bank(active).sconv.feed(input, count);
+        release();
+    }
+
+    // the buffer must hold the maximal count passed to compute()
+    void setFadeBuffer(float *fbuf) {
+            fadeBuf = fbuf;}
+
+    // process the active IR and crossfade to a newly published one (rt)
+    inline void compute(int32_t count, float* input, float *output) {
+            if (!claim()) {
+                // the worker switch the banks right now
+                if (output != input) memcpy(output, input, count*sizeof(float));
+                return;
+            }
+            run(count, input, output);
+            release();}
 
     bool checkstate() {
-            return conv->checkstate();}
+            return bank(target.load(std::memory_order_acquire)).conv->checkstate();}
 
     inline void set_not_runnable() {
-            conv->set_not_runnable();}
+            bankA.conv->set_not_runnable();
+            bankB.conv->set_not_runnable();}
 
+    // true as long as a IR is loaded or a fade is pending
     inline bool is_runnable() {
-            return conv->is_runnable();}
+            const int t = target.load(std::memory_order_acquire);
+            return bank(t).conv->is_runnable() ||
+                        live.load(std::memory_order_acquire) != t;}
 
     inline void set_buffersize(uint32_t sz) {
-            sconv.set_buffersize(sz);
-            dconv.set_buffersize(sz);}
+            buffersize = sz;
+            for (Bank* b : {&bankA, &bankB}) {
+                b->sconv.set_buffersize(sz);
+                b->dconv.set_buffersize(sz);
+                b->hconv.set_buffersize(sz);
+            }}
 
     void set_samplerate(uint32_t sr) {
-            sconv.set_samplerate(sr);
-            dconv.set_samplerate(sr);}
+            samplerate = sr;
+            fadeLen = std::max(1, static_cast<int>(sr) * FADE_MS / 1000);
+            for (Bank* b : {&bankA, &bankB}) {
+                b->sconv.set_samplerate(sr);
+                b->dconv.set_samplerate(sr);
+                b->hconv.set_samplerate(sr);
+            }}
 
     int stop_process() {
-            return conv->stop_process();}
+            bankA.conv->stop_process();
+            return bankB.conv->stop_process();}
 
     int cleanup() {
-            return conv->cleanup();}
-
-    ConvolverSelector():
-            sconv(),
-            dconv(){        
-            dconv.start(25, 1);
-            conv = &sconv;
+            bankA.conv->cleanup();
+            return bankB.conv->cleanup();}
+
+    void set_freewheel(bool on) {
+            for (Bank* b : {&bankA, &bankB}) {
+                b->sconv.set_freewheel(on);
+                b->dconv.set_freewheel(on);
+                b->hconv.set_freewheel(on);
+            }}
+
+    ConvolverSelector(std::condition_variable *var = nullptr, LevelWorkers *workers = nullptr):
+            bankA(),
+            bankB(),
+            SyncWait(var),
+            target(0),
+            live(0),
+            owner(FREE),
+            ticks(0),
+            standby(false),
+            gen(0),
+            samplerate(0),
+            buffersize(0) {
+            active = 0;
+            previous = 0;
+            fadeLen = 1;
+            fadePos = 0;
+            fading = false;
+            fadeBuf = nullptr;
+            bankA.dconv.setWorkers(workers);
+            bankB.dconv.setWorkers(workers);
             }
 
     ~ ConvolverSelector() {}
     
 private:
-    ConvolverBase *conv;
-    SingleThreadConvolver sconv;
-    DoubleThreadConvolver dconv;
+    // process the active IR and crossfade, the caller own the
+    // real-time state (rt)
+    inline void run(int32_t count, float* input, float *output) {
+            const int t = target.load(std::memory_order_acquire);
+            if (t != active) {
+                previous = active;
+                active = t;
+                fadePos = 0;
+                fading = fadeBuf && (bank(previous).conv->is_runnable() ||
+                                     bank(active).conv->is_runnable());
+                if (!fading) live.store(active, std::memory_order_release);
+            }
+            ConvolverBase *c = bank(active).conv;
+            if (!fading) {
+                if (c->is_runnable()) c->compute(count, input, output);
+                else if (output != input) memcpy(output, input, count*sizeof(float));
+                return;
+            }
+            memcpy(fadeBuf, input, count*sizeof(float));
+            if (c->is_runnable()) c->compute(count, fadeBuf, fadeBuf);
+            ConvolverBase *o = bank(previous).conv;
+            if (o->is_runnable()) o->compute(count, input, output);
+            else if (output != input) memcpy(output, input, count*sizeof(float));
+            const float step = 1.0f / fadeLen;
+            for (int i = 0; i < count; i++) {
+                const float g = std::min(1.0f, (fadePos + i) * step);
+                output[i] += (fadeBuf[i] - output[i]) * g;
+            }
+            fadePos += count;
+            if (fadePos >= fadeLen) {
+                fading = false;
+                live.store(active, std::memory_order_release);
+            }}
+
+    // true when the published bank run a short IR, without a pending
+    // fade, the caller own the real-time state (rt)
+    inline bool uniform() {
+        const int t = target.load(std::memory_order_acquire);
+        return t == active && !fading && bank(t).conv == &bank(t).sconv &&
+                                            bank(t).sconv.is_runnable();
+    }
+
+    // take the real-time state, fails while the worker switch the banks (rt)
+    inline bool claim() {
+        int e = FREE;
+        return owner.compare_exchange_strong(e, RT, std::memory_order_acquire);
+    }
+
+    inline void release() {
+        ticks.fetch_add(1, std::memory_order_release);
+        owner.store(FREE, std::memory_order_release);
+    }
+
+    struct Bank {
+        ConvolverBase *conv;
+        SingleThreadConvolver sconv;
+        MultiThreadConvolver dconv;
+        DirectHeadConvolver hconv;
+        // the loaded file, "None" for a empty bank
+        std::string file;
+        uint32_t norm;
+        ratatouille::IrLayout layout;
+
+        Bank():
+            sconv(),
+            dconv(),
+            hconv(),
+            file("None"),
+            norm(0) {
+            dconv.start(25, 1);
+            conv = &sconv;}
+    };
+
+    Bank bankA;
+    Bank bankB;
+    // notified by the engine each process cycle
+    std::condition_variable *SyncWait;
+    std::mutex WMutex;
+
+    // index of the published bank, written by the worker
+    std::atomic<int> target;
+    // index of the bank the real-time thread has fully switched to
+    std::atomic<int> live;
+    // who may touch the real-time state below, FREE, RT or WORKER
+    enum { FREE, RT, WORKER };
+    std::atomic<int> owner;
+    // count the calls from the real-time thread, to see if it run the selector
+    std::atomic<uint32_t> ticks;
+    // the standby bank is prepared and could be published, worker only
+    bool standby;
+    // count of commits, and the lock for the source of the published bank
+    std::atomic<uint32_t> gen;
+    std::mutex sourceMutex;
+    // for the planner
+    uint32_t samplerate;
+    uint32_t buffersize;
+
+    // real-time thread state
+    int active;
+    int previous;
+    int fadeLen;
+    int fadePos;
+    bool fading;
+    float *fadeBuf;
+
+    inline Bank& bank(int i) {
+            return i ? bankB : bankA;}
+
+    bool waitLive(int i);
+    bool takeOver(int i);
 };
 
 #endif  // FFTCONVOLVER_H_
@@ -161,6 +161,8 @@ void plugin_create_controller_widgets(X11_UI *ui, const char * plugin_uri) {
     ps->ir.dir_name = NULL;
     ps->ir1.dir_name = NULL;
     ps->fname = NULL;
+    memset(ps->timing, 0, sizeof(ps->timing));
+    memset(ps->cache, 0, sizeof(ps->cache));
     ps->ma.filepicker = (FilePicker*)malloc(sizeof(FilePicker));
     fp_init(ps->ma.filepicker, "/");
     asprintf(&ps->ma.filepicker->filter ,"%s", ".nam|.aidax|.json");
@@ -182,6 +184,8 @@ void plugin_create_controller_widgets(X11_UI *ui, const char * plugin_uri) {
 
     ui->widget[17] = add_lv2_label (ui->widget[17], ui->win, 22, "Latency", ui, 115,  22, 130, 30);
     ui->widget[18] = add_lv2_label (ui->widget[18], ui->win, 23, "Xrun", ui, 510,  205, 100, 30);
+    ui->widget[19] = add_lv2_label (ui->widget[19], ui->win, PROFILE_PERIOD_P99, "DSP", ui, 20,  205, 130, 30);
+    ui->widget[19]->adj->max_value = 100000.0;
 
     ui->widget[16] = add_lv2_switch (ui->widget[16], ui->win, 21, "Phase", ui, 90,  22, 30, 30);
     ui->widget[10] = add_lv2_switch (ui->widget[10], ui->win, 14, "", ui, 505,  22, 50, 50);
@@ -657,6 +657,40 @@ Widget_t* add_lv2_slider(Widget_t *w, Widget_t *p, int index, const char * label
     return w;
 }
 
+// show the period p99, the stage which takes most of the time
+// and the model cache counters
+static void draw_timing_label(Widget_t *w, char *s, float value) {
+    static const char* stages[PROFILE_STAGES] = {
+        "Delta Delay", "Phase Correction", "Input A", "Input B",
+        "Slot A", "Slot B", "Wait Slot B", "DC Blocker",
+        "IR", "IR1", "Wait IR1", "Period"
+    };
+    X11_UI* ui = (X11_UI*)w->parent_struct;
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    snprintf(s, 63,"DSP: %.0fµs",  value);
+    int worst = -1;
+    float p99 = 0.0;
+    // the wait stages and the period itself are no consumers
+    for (int i = 0; i < PROFILE_STAGES - 1; i++) {
+        if (i == 6 || i == 10) continue;
+        if (ps->timing[i * PROFILE_VALUES + 2] > p99) {
+            p99 = ps->timing[i * PROFILE_VALUES + 2];
+            worst = i;
+        }
+    }
+    if (worst < 0) {
+        w->flags &= ~HAS_TOOLTIP;
+        hide_tooltip(w);
+        return;
+    }
+    const float* t = &ps->timing[worst * PROFILE_VALUES];
+    char tip[192];
+    snprintf(tip, 191, "%s: min %.0f mean %.0f p99 %.0f max %.0f µs, model cache %.0f hits %.0f misses",
+                        stages[worst], t[0], t[1], t[2], t[3], ps->cache[0], ps->cache[1]);
+    tooltip_set_text(w, tip);
+    w->flags |= HAS_TOOLTIP;
+}
+
 void draw_my_label(void *w_, void* user_data) {
     Widget_t *w = (Widget_t*)w_;
     Metrics_t metrics;
@@ -670,6 +704,7 @@ void draw_my_label(void *w_, void* user_data) {
     char s[64];
     float value = adj_get_value(w->adj);
     if (w->data == 22) snprintf(s, 63,"Latency: %.2fms",  value);
+    else if (w->data == PROFILE_PERIOD_P99) draw_timing_label(w, s, value);
     else snprintf(s, 63,"Xruns: %.0f",  value);
     cairo_select_font_face (w->crb, "Sans", CAIRO_FONT_SLANT_NORMAL,
                                CAIRO_FONT_WEIGHT_BOLD);
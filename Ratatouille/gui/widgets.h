@@ -27,7 +27,16 @@ extern "C" {
 #define log_gprint(...) \
             ((void)((LV2LOG) ? fprintf(stderr, __VA_ARGS__) : 0))
 
-#define CONTROLS 19
+#define CONTROLS 20
+
+// stage timing output ports (see engine/StageProfiler.h)
+#define PROFILE_PORT 24
+#define PROFILE_STAGES 12
+#define PROFILE_VALUES 4
+#define PROFILE_PERIOD_P99 (PROFILE_PORT + 11 * PROFILE_VALUES + 2)
+// model cache hit and miss output ports (see engine/ModelCache.h)
+#define CACHE_PORT 72
+#define CACHE_VALUES 2
 
 #define GUI_ELEMENTS 0
 
@@ -49,6 +58,8 @@ typedef struct {
     ModelPicker ir;
     ModelPicker ir1;
     char *fname;
+    float timing[PROFILE_STAGES * PROFILE_VALUES];
+    float cache[CACHE_VALUES];
 } X11_UI_Private_t;
 
 // main window struct
@@ -42,6 +42,10 @@ private:
     int32_t                      rt_policy;
     float*                       input0;
     float*                       output0;
+    // right channel audio ports of the stereo plugin
+    static constexpr uint32_t    STEREO_PORT = 74;
+    float*                       input1;
+    float*                       output1;
     float*                       _inputGain;
     float*                       _inputGain1;
     float*                       _outputGain;
@@ -64,15 +68,29 @@ private:
     float*                       _buffered;
     float*                       _phasecor;
     float*                       _xrun;
+    // stage timing output ports, indexed stage * VALUES + value
+    static constexpr uint32_t    TIMING_PORT = 24;
+    float*                       _timing[StageProfiler::STAGES * StageProfiler::VALUES];
+    // model cache hit and miss output ports, follow the timing ports
+    static constexpr uint32_t    CACHE_PORT = 72;
+    float*                       _cache[Engine::CACHE_VALUES];
     uint32_t                     s_rate;
     double                       s_time;
     int                          processCounter;
     bool                         doit;
+    // file path copied from the engine for the atom messages
+    char                         pathBuf[MAX_PATH_LEN];
+    // file loads the command queue couldn't take, pushed again
+    // in the next period, indexed by Command::Target
+    bool                         loadPending[Command::TARGETS];
+    char                         loadPath[Command::TARGETS][MAX_PATH_LEN];
 
     std::atomic<bool>            _restore;
 
     // private functions
     inline void check_messages(uint32_t n_samples);
+    inline void queueLoad(Command::Type type, uint32_t slot, const char* path);
+    inline bool queueErase(Command::Type type, uint32_t slot);
     inline void runBufferedDsp(uint32_t n_samples);
     inline void connect_(uint32_t port,void* data);
     inline void init_dsp_(uint32_t rate);
@@ -84,13 +102,16 @@ private:
 public:
     inline LV2_Atom* write_set_file(LV2_Atom_Forge* forge,
                     const LV2_URID xlv2_model, const char* filename);
-    inline const LV2_Atom* read_set_file(const LV2_Atom_Object* obj);
+    inline const LV2_Atom* read_set_file(const LV2_Atom_Object* obj, LV2_URID *key);
+    inline void write_path_state(LV2_Atom_Forge* forge,
+                    const LV2_URID xlv2_model, const PathState& file, bool always);
     inline void storeFile(LV2_State_Store_Function store,
             LV2_State_Handle handle, const LV2_URID urid, const std::string file);
     inline bool restoreFile(LV2_State_Retrieve_Function retrieve,
                 LV2_State_Handle handle, const LV2_URID urid, std::string *file);
     // LV2 Descriptor
     static const LV2_Descriptor descriptor;
+    static const LV2_Descriptor descriptor_stereo;
     static const void* extension_data(const char* uri);
     // static wrapper to private functions
     static void deactivate(LV2_Handle instance);
@@ -132,6 +153,8 @@ Xratatouille::Xratatouille() :
     rt_policy(0),
     input0(NULL),
     output0(NULL),
+    input1(NULL),
+    output1(NULL),
     _inputGain(0),
     _inputGain1(0),
     _outputGain(0),
@@ -156,6 +179,8 @@ Xratatouille::Xratatouille() :
         notify = nullptr;
         log = nullptr;
         memset(&logger,0,sizeof(logger));
+        for (auto& t : _timing) t = nullptr;
+        for (auto& c : _cache) c = nullptr;
 };
 
 // destructor
@@ -174,6 +199,7 @@ void Xratatouille::init_dsp_(uint32_t rate)
 
     processCounter = 0;
     doit = false;
+    for (auto& p : loadPending) p = false;
     _restore.store(false, std::memory_order_release);
 }
 
@@ -254,7 +280,21 @@ void Xratatouille::connect_(uint32_t port,void* data)
         case 23:
             _xrun = static_cast<float*>(data);
             break;
+        case CACHE_PORT:
+        case CACHE_PORT + 1:
+            _cache[port - CACHE_PORT] = static_cast<float*>(data);
+            break;
+        case STEREO_PORT:
+            input1 = static_cast<float*>(data);
+            break;
+        case STEREO_PORT + 1:
+            output1 = static_cast<float*>(data);
+            break;
         default:
+            // stage timing ports follow the Xrun port
+            if (port >= TIMING_PORT && port < TIMING_PORT +
+                    StageProfiler::STAGES * StageProfiler::VALUES)
+                _timing[port - TIMING_PORT] = static_cast<float*>(data);
             break;
     }
 }
@@ -293,8 +333,15 @@ inline LV2_Atom* Xratatouille::write_set_file(LV2_Atom_Forge* forge,
     return set;
 }
 
+// prepare atom message with the file path loaded in the engine
+inline void Xratatouille::write_path_state(LV2_Atom_Forge* forge,
+                const LV2_URID xlv2_model, const PathState& file, bool always) {
+    if (file.copy(pathBuf, MAX_PATH_LEN) || always)
+        write_set_file(forge, xlv2_model, pathBuf);
+}
+
 // read atom message with file path
-inline const LV2_Atom* Xratatouille::read_set_file(const LV2_Atom_Object* obj) {
+inline const LV2_Atom* Xratatouille::read_set_file(const LV2_Atom_Object* obj, LV2_URID *key) {
     if (obj->body.otype != patch_Set) {
         return NULL;
     }
@@ -302,17 +349,10 @@ inline const LV2_Atom* Xratatouille::read_set_file(const LV2_Atom_Object* obj) {
     const LV2_Atom* property = NULL;
     lv2_atom_object_get(obj, patch_property, &property, 0);
 
-    if (property && (property->type == atom_URID)) {
-        if (((LV2_Atom_URID*)property)->body == xlv2_model_file)
-            engine._ab.store(1, std::memory_order_release);
-        else if (((LV2_Atom_URID*)property)->body == xlv2_model_file1)
-            engine._ab.store(2, std::memory_order_release);
-        else if (((LV2_Atom_URID*)property)->body == xlv2_ir_file)
-            engine._cd.store(1, std::memory_order_release);
-        else if (((LV2_Atom_URID*)property)->body == xlv2_ir_file1)
-            engine._cd.store(2, std::memory_order_release);
-        else return NULL;
-    }
+    if (!property || (property->type != atom_URID)) return NULL;
+    *key = ((LV2_Atom_URID*)property)->body;
+    if (*key != xlv2_model_file && *key != xlv2_model_file1 &&
+        *key != xlv2_ir_file && *key != xlv2_ir_file1) return NULL;
 
     const LV2_Atom* file_path = NULL;
     lv2_atom_object_get(obj, patch_value, &file_path, 0);
@@ -323,10 +363,39 @@ inline const LV2_Atom* Xratatouille::read_set_file(const LV2_Atom_Object* obj) {
     return file_path;
 }
 
+// push a file load from the real-time thread, when the queue is full keep
+// the newest request per target and push it again in the next period
+inline void Xratatouille::queueLoad(Command::Type type, uint32_t slot, const char* path)
+{
+    const int32_t t = Command::targetOf(type, slot);
+    if (!loadPending[t] &&
+            engine.commands.pushRt(type, slot, Command::INTERACTIVE, path)) return;
+    const size_t len = strnlen(path, MAX_PATH_LEN);
+    if (len >= MAX_PATH_LEN) return;
+    memcpy(loadPath[t], path, len + 1);
+    loadPending[t] = true;
+}
+
+// push a erase request, a pending load for the target is dropped,
+// returns false when the queue is full
+inline bool Xratatouille::queueErase(Command::Type type, uint32_t slot)
+{
+    if (!engine.commands.pushRt(type, slot, 0)) return false;
+    loadPending[Command::targetOf(type, slot)] = false;
+    return true;
+}
+
 // read all incoming atom messages
 inline void Xratatouille::check_messages(uint32_t n_samples)
 {
     if(n_samples<1) return;
+    // retry the loads the command queue couldn't take last period
+    for (uint32_t t = 0; t < Command::TARGETS; t++) {
+        if (!loadPending[t]) continue;
+        if (engine.commands.pushRt(t < Command::IR_A ? Command::LOAD_MODEL : Command::LOAD_IR,
+                            t & 1, Command::INTERACTIVE, loadPath[t])) loadPending[t] = false;
+        if (!doit) doit = true;
+    }
     const uint32_t notify_capacity = this->notify->atom.size;
     lv2_atom_forge_set_buffer(&forge, (uint8_t*)notify, notify_capacity);
     lv2_atom_forge_sequence_head(&forge, &notify_frame, 0);
@@ -337,25 +406,23 @@ inline void Xratatouille::check_messages(uint32_t n_samples)
         if (lv2_atom_forge_is_object_type(&forge, ev->body.type)) {
             const LV2_Atom_Object* obj = (LV2_Atom_Object*)&ev->body;
             if (obj->body.otype == patch_Get) {
-                if (engine.model_file != "None")
-                    write_set_file(&forge, xlv2_model_file, engine.model_file.data());
-                if (engine.model_file1 != "None")
-                    write_set_file(&forge, xlv2_model_file1, engine.model_file1.data());
-                if (engine.ir_file != "None")
-                    write_set_file(&forge, xlv2_ir_file, engine.ir_file.data());
-                if (engine.ir_file1 != "None")
-                    write_set_file(&forge, xlv2_ir_file1, engine.ir_file1.data());
+                write_path_state(&forge, xlv2_model_file, engine.model_file, false);
+                write_path_state(&forge, xlv2_model_file1, engine.model_file1, false);
+                write_path_state(&forge, xlv2_ir_file, engine.ir_file, false);
+                write_path_state(&forge, xlv2_ir_file1, engine.ir_file1, false);
            } else if (obj->body.otype == patch_Set) {
-                const LV2_Atom* file_path = read_set_file(obj);
+                LV2_URID key = 0;
+                const LV2_Atom* file_path = read_set_file(obj, &key);
                 if (file_path) {
-                    if (engine._ab.load(std::memory_order_acquire) == 1)
-                        engine.model_file = (const char*)(file_path+1);
-                    else if (engine._ab.load(std::memory_order_acquire) == 2)
-                        engine.model_file1 = (const char*)(file_path+1);
-                    else if (engine._cd.load(std::memory_order_acquire) == 1)
-                        engine.ir_file = (const char*)(file_path+1);
-                    else if (engine._cd.load(std::memory_order_acquire) == 2)
-                        engine.ir_file1 = (const char*)(file_path+1);
+                    const char* path = (const char*)(file_path+1);
+                    if (key == xlv2_model_file)
+                        queueLoad(Command::LOAD_MODEL, 0, path);
+                    else if (key == xlv2_model_file1)
+                        queueLoad(Command::LOAD_MODEL, 1, path);
+                    else if (key == xlv2_ir_file)
+                        queueLoad(Command::LOAD_IR, 0, path);
+                    else if (key == xlv2_ir_file1)
+                        queueLoad(Command::LOAD_IR, 1, path);
                     if (!doit) doit = true;
                 }
             }
@@ -376,27 +443,20 @@ inline void Xratatouille::check_messages(uint32_t n_samples)
     engine.phasecor_ = *_phasecor;
     engine.buffered = *_buffered;
 
-    // check if a model or IR file is to be removed
+    // check if a model or IR file is to be removed, the port stay set
+    // when the queue is full, so it's tried again next period
     if ((*_eraseSlotA)) {
-        engine._ab.fetch_add(1, std::memory_order_relaxed);
-        engine.model_file = "None";
+        if (queueErase(Command::ERASE_MODEL, 0)) (*_eraseSlotA) = 0.0;
         if (!doit) doit = true;
-        (*_eraseSlotA) = 0.0;
     } else if ((*_eraseSlotB)) {
-        engine._ab.fetch_add(2, std::memory_order_relaxed);
-        engine.model_file1 = "None";
+        if (queueErase(Command::ERASE_MODEL, 1)) (*_eraseSlotB) = 0.0;
         if (!doit) doit = true;
-        (*_eraseSlotB) = 0.0;
     } else if ((*_eraseIr)) {
-        engine._cd.fetch_add(1, std::memory_order_relaxed);
-        engine.ir_file = "None";
+        if (queueErase(Command::ERASE_IR, 0)) (*_eraseIr) = 0.0;
         if (!doit) doit = true;
-        (*_eraseIr) = 0.0;
     } else if ((*_eraseIr1)) {
-        engine._cd.fetch_add(2, std::memory_order_relaxed);
-        engine.ir_file1 = "None";
+        if (queueErase(Command::ERASE_IR, 1)) (*_eraseIr1) = 0.0;
         if (!doit) doit = true;
-        (*_eraseIr1) = 0.0;
     }
 
     if (_restore.load(std::memory_order_acquire)) {
@@ -405,21 +465,16 @@ inline void Xratatouille::check_messages(uint32_t n_samples)
     }
     // check if normalisation is pressed for conv
     if (normA != static_cast<uint32_t>(*(_normA))) {
-        normA = static_cast<uint32_t>(*(_normA));
-        engine._cd.fetch_add(1, std::memory_order_relaxed);
-        engine.conv.set_normalisation(normA);
-        if (engine.ir_file.compare("None") != 0) {
-            if (!doit) doit = true;
-        }
+        // only take the new state when the queue took it, retry next period
+        if (engine.commands.pushRt(Command::NORMALISE_IR, 0, static_cast<int32_t>(*(_normA))))
+            normA = static_cast<uint32_t>(*(_normA));
+        if (!doit) doit = true;
     }
     // check if normalisation is pressed for conv1
     if (normB != static_cast<uint32_t>(*(_normB))) {
-        normB = static_cast<uint32_t>(*(_normB));
-        engine._cd.fetch_add(2, std::memory_order_relaxed);
-        engine.conv1.set_normalisation(normB);
-        if (engine.ir_file1.compare("None") != 0) {
-            if (!doit) doit = true;
-        }
+        if (engine.commands.pushRt(Command::NORMALISE_IR, 1, static_cast<int32_t>(*(_normB))))
+            normB = static_cast<uint32_t>(*(_normB));
+        if (!doit) doit = true;
     }
     // init buffer for background processing when needed
     if (!engine.bufferIsInit.load(std::memory_order_acquire)) {
@@ -435,13 +490,11 @@ inline void Xratatouille::check_messages(uint32_t n_samples)
     if (engine._notify_ui.load(std::memory_order_acquire)) {
         engine._notify_ui.store(false, std::memory_order_release);
 
-        write_set_file(&forge, xlv2_model_file, engine.model_file.data());
-        write_set_file(&forge, xlv2_model_file1, engine.model_file1.data());
+        write_path_state(&forge, xlv2_model_file, engine.model_file, true);
+        write_path_state(&forge, xlv2_model_file1, engine.model_file1, true);
 
-        write_set_file(&forge, xlv2_ir_file, engine.ir_file.data());
-        write_set_file(&forge, xlv2_ir_file1, engine.ir_file1.data());
-        engine._ab.store(0, std::memory_order_release);
-        engine._cd.store(0, std::memory_order_release);
+        write_path_state(&forge, xlv2_ir_file, engine.ir_file, true);
+        write_path_state(&forge, xlv2_ir_file1, engine.ir_file1, true);
     }
 }
 
@@ -454,6 +507,8 @@ inline void Xratatouille::runBufferedDsp(uint32_t n_samples)
     // doing in place processing
     if(output0 != input0)
         memcpy(output0, input0, n_samples*sizeof(float));
+    if(output1 && input1 && output1 != input1)
+        memcpy(output1, input1, n_samples*sizeof(float));
 
     // the early bird die
     if (processCounter < 5) {
@@ -463,11 +518,21 @@ inline void Xratatouille::runBufferedDsp(uint32_t n_samples)
     // check atom messages (full cycle)
     check_messages(n_samples);
     // run engine
-    engine.process(n_samples, output0);
+    engine.process(n_samples, output0, (input1 && output1) ? output1 : nullptr);
     // report lanency
     *(_latency) = engine.latency;
     *(_latencyms) = engine.latency * s_time;
     *(_xrun) = engine.XrunCounter;
+    // report stage timing
+    for (uint32_t s = 0; s < StageProfiler::STAGES; s++) {
+        for (uint32_t v = 0; v < StageProfiler::VALUES; v++) {
+            float* port = _timing[s * StageProfiler::VALUES + v];
+            if (port) *(port) = engine.profiler.stats[s][v].load(std::memory_order_relaxed);
+        }
+    }
+    for (uint32_t c = 0; c < Engine::CACHE_VALUES; c++) {
+        if (_cache[c]) *(_cache[c]) = engine.cacheStats[c].load(std::memory_order_relaxed);
+    }
 }
 
 void Xratatouille::connect_all__ports(uint32_t port, void* data)
@@ -511,10 +576,11 @@ LV2_State_Status Xratatouille::save_state(LV2_Handle instance,
 
     Xratatouille* self = static_cast<Xratatouille*>(instance);
 
-    self->storeFile(store, handle, self->xlv2_model_file, self->engine.model_file);
-    self->storeFile(store, handle, self->xlv2_model_file1, self->engine.model_file1);
-    self->storeFile(store, handle, self->xlv2_ir_file, self->engine.ir_file);
-    self->storeFile(store, handle, self->xlv2_ir_file1, self->engine.ir_file1);
+    self->storeFile(store, handle, self->xlv2_model_file, self->engine.model_file.str());
+    self->storeFile(store, handle, self->xlv2_model_file1, self->engine.model_file1.str());
+    self->storeFile(store, handle, self->xlv2_ir_file, self->engine.ir_file.str());
+    self->storeFile(store, handle, self->xlv2_ir_file1, self->engine.ir_file1.str());
+    self->storeFile(store, handle, self->xlv2_graph, self->engine.graph_spec.str());
 
     return LV2_STATE_SUCCESS;
 }
@@ -526,14 +592,17 @@ LV2_State_Status Xratatouille::restore_state(LV2_Handle instance,
 
     Xratatouille* self = static_cast<Xratatouille*>(instance);
 
-    if (self->restoreFile(retrieve, handle, self->xlv2_model_file, &self->engine.model_file))
-        self->engine._ab.fetch_add(1, std::memory_order_relaxed);
-    if (self->restoreFile(retrieve, handle, self->xlv2_model_file1, &self->engine.model_file1))
-        self->engine._ab.fetch_add(2, std::memory_order_relaxed);
-    if (self->restoreFile(retrieve, handle, self->xlv2_ir_file, &self->engine.ir_file))
-        self->engine._cd.fetch_add(1, std::memory_order_relaxed);
-    if (self->restoreFile(retrieve, handle, self->xlv2_ir_file1, &self->engine.ir_file1))
-        self->engine._cd.fetch_add(2, std::memory_order_relaxed);
+    std::string file;
+    if (self->restoreFile(retrieve, handle, self->xlv2_model_file, &file))
+        self->engine.commands.push(Command::LOAD_MODEL, 0, 0, file.c_str());
+    if (self->restoreFile(retrieve, handle, self->xlv2_model_file1, &file))
+        self->engine.commands.push(Command::LOAD_MODEL, 1, 0, file.c_str());
+    if (self->restoreFile(retrieve, handle, self->xlv2_ir_file, &file))
+        self->engine.commands.push(Command::LOAD_IR, 0, 0, file.c_str());
+    if (self->restoreFile(retrieve, handle, self->xlv2_ir_file1, &file))
+        self->engine.commands.push(Command::LOAD_IR, 1, 0, file.c_str());
+    if (self->restoreFile(retrieve, handle, self->xlv2_graph, &file))
+        self->engine.commands.push(Command::SET_GRAPH, 0, 0, file.c_str());
 
     self-> _restore.store(true, std::memory_order_release);
     return LV2_STATE_SUCCESS;
@@ -552,6 +621,7 @@ Xratatouille::instantiate(const LV2_Descriptor* descriptor,
 
     const LV2_Options_Option* options  = NULL;
     uint32_t bufsize = 0;
+    uint32_t maxbufsize = 0;
 
     for (int32_t i = 0; features[i]; ++i) {
         if (!strcmp(features[i]->URI, LV2_URID__map)) {
@@ -598,6 +668,7 @@ Xratatouille::instantiate(const LV2_Descriptor* descriptor,
                 bufsize = *(const int32_t*)o->value;
             } else if (o->context == LV2_OPTIONS_INSTANCE &&
               o->key == bufsz_max && o->type == atom_Int) {
+                maxbufsize = *(const int32_t*)o->value;
                 if (!bufsize)
                     bufsize = *(const int32_t*)o->value;
             } else if (o->context == LV2_OPTIONS_INSTANCE &&
@@ -615,9 +686,16 @@ Xratatouille::instantiate(const LV2_Descriptor* descriptor,
             self->engine.bufsize = bufsize;
             lv2_log_note(&self->logger, "using block size: %d\n", bufsize);
         }
+        // size the scratch buffers from the maximal block length
+        self->engine.maxbufsize = maxbufsize;
     }
 
     lv2_atom_forge_init(&self->forge, self->map);
+    // the stereo plugin runs both channels through one engine
+    if (!strcmp(descriptor->URI, PLUGIN_URI_STEREO)) {
+        self->engine.channels = 2;
+    }
+
     self->init_dsp_((uint32_t)rate);
 
     return (LV2_Handle)self;
@@ -701,6 +779,18 @@ const LV2_Descriptor Xratatouille::descriptor =
     Xratatouille::extension_data
 };
 
+const LV2_Descriptor Xratatouille::descriptor_stereo =
+{
+    PLUGIN_URI_STEREO ,
+    Xratatouille::instantiate,
+    Xratatouille::connect_port,
+    Xratatouille::activate,
+    Xratatouille::run,
+    Xratatouille::deactivate,
+    Xratatouille::cleanup,
+    Xratatouille::extension_data
+};
+
 } // end namespace ratatouille
 
 ////////////////////////// LV2 SYMBOL EXPORT ///////////////////////////
@@ -713,6 +803,8 @@ lv2_descriptor(uint32_t index)
     {
         case 0:
             return &ratatouille::Xratatouille::descriptor;
+        case 1:
+            return &ratatouille::Xratatouille::descriptor_stereo;
         default:
             return NULL;
     }
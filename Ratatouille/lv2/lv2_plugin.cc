@@ -200,9 +200,19 @@ void plugin_port_event(LV2UI_Handle handle, uint32_t port_index,
                 }
             }
         }
-    }
     // port value change message from host
     // do special stuff when needed
+    } else if (format == 0 && port_index >= PROFILE_PORT &&
+            port_index < PROFILE_PORT + PROFILE_STAGES * PROFILE_VALUES) {
+        // keep the stage timing for the DSP label tooltip
+        X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+        ps->timing[port_index - PROFILE_PORT] = *(float*)buffer;
+    } else if (format == 0 && port_index >= CACHE_PORT &&
+            port_index < CACHE_PORT + CACHE_VALUES) {
+        // and the model cache counters
+        X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+        ps->cache[port_index - CACHE_PORT] = *(float*)buffer;
+    }
 }
 
 /*---------------------------------------------------------------------
@@ -26,10 +26,12 @@
 
 
 #define PLUGIN_URI "urn:brummer:ratatouille"
+#define PLUGIN_URI_STEREO "urn:brummer:ratatouille_stereo"
 #define XLV2__MODELFILE "urn:brummer:ratatouille#Neural_Model"
 #define XLV2__MODELFILE1 "urn:brummer:ratatouille#Neural_Model1"
 #define XLV2__IRFILE "urn:brummer:ratatouille#irfile"
 #define XLV2__IRFILE1 "urn:brummer:ratatouille#irfile1"
+#define XLV2__GRAPH "urn:brummer:ratatouille#graph"
 
 #define XLV2__GUI "urn:brummer:ratatouille#gui"
 
@@ -57,6 +59,7 @@ public:
     LV2_URID                     xlv2_model_file1;
     LV2_URID                     xlv2_ir_file;
     LV2_URID                     xlv2_ir_file1;
+    LV2_URID                     xlv2_graph;
     LV2_URID                     xlv2_gui;
     LV2_URID                     atom_Object;
     LV2_URID                     atom_Int;
@@ -78,6 +81,7 @@ public:
         xlv2_model_file1 =      map->map(map->handle, XLV2__MODELFILE1);
         xlv2_ir_file =          map->map(map->handle, XLV2__IRFILE);
         xlv2_ir_file1 =         map->map(map->handle, XLV2__IRFILE1);
+        xlv2_graph =            map->map(map->handle, XLV2__GRAPH);
         xlv2_gui =              map->map(map->handle, XLV2__GUI);
         atom_Object =           map->map(map->handle, LV2_ATOM__Object);
         atom_Int =              map->map(map->handle, LV2_ATOM__Int);
@@ -0,0 +1,402 @@
+/*
+ * main.cpp
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** ratatouille-render - headless offline renderer
+ *
+ *  Render WAV files through the Ratatouille engine without
+ *  X11, libxputty or a audio server.
+ *  Each input file get's it's own Engine instance, running in
+ *  freewheel mode, so the result is deterministic and
+ *  independent from the order the files are processed.
+ *  The engine doesn't pre-mix the IR's in freewheel mode, as the
+ *  background build would switch in at a time dependent point.
+ *  Inputs which would write the same output file are refused.
+ *  The files are spread over all available cores.
+ *  Stereo files are rendered through the stereo engine.
+ *
+ *  usage:
+ *      ratatouille-render -a model.nam -i cab.wav -o out/ di1.wav di2.wav
+ *      ratatouille-render -c "pedal.nam>amp.nam>cab.wav" -c "amp2.nam>cab2.wav" di.wav
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <thread>
+#include <cmath>
+
+#include <sndfile.h>
+
+#include "engine.h"
+
+
+/****************************************************************
+ ** RenderSettings - the command line options shared by all jobs
+ */
+
+struct RenderSettings {
+    std::string     modelA      = "None";
+    std::string     modelB      = "None";
+    std::string     irA         = "None";
+    std::string     irB         = "None";
+    std::string     graph       = "";
+    std::string     outDir      = "";
+    float           inputGain   = 0.0;
+    float           inputGain1  = 0.0;
+    float           outputGain  = 0.0;
+    float           blend       = 0.5;
+    float           mix         = 0.5;
+    float           delay       = 0.0;
+    float           tail        = 1.0;
+    int32_t         normSlotA   = 0;
+    int32_t         normSlotB   = 0;
+    uint32_t        normIrA     = 0;
+    uint32_t        normIrB     = 0;
+    float           phasecor    = 0.0;
+    uint32_t        blockSize   = 256;
+    uint32_t        jobs        = 0;
+};
+
+// the output file for input, next to it or in the output directory
+static std::string outputName(const RenderSettings& settings, const std::string& input) {
+    std::string base = input;
+    std::string::size_type idx = base.rfind('/');
+    std::string dir = (idx != std::string::npos) ? base.substr(0, idx+1) : "";
+    if (idx != std::string::npos) base = base.substr(idx+1);
+    idx = base.rfind('.');
+    if (idx != std::string::npos) base = base.substr(0, idx);
+    if (!settings.outDir.empty()) dir = settings.outDir + "/";
+    return dir + base + "-ratatouille.wav";
+}
+
+/****************************************************************
+ ** RenderJob - render a single file through a own Engine instance
+ */
+
+class RenderJob {
+public:
+    RenderJob(const RenderSettings& s, std::string in_)
+        : settings(s), input(in_) {}
+
+    bool run();
+
+private:
+    const RenderSettings&   settings;
+    std::string             input;
+    std::string             output;
+
+    bool setupEngine(ratatouille::Engine *engine, uint32_t rate);
+};
+
+// returns false when a requested file couldn't be loaded
+bool RenderJob::setupEngine(ratatouille::Engine *engine, uint32_t rate) {
+    engine->maxbufsize = settings.blockSize;
+    engine->init(rate, 0, SCHED_OTHER);
+    engine->setFreewheel(true);
+    engine->bypass = 1;
+    engine->inputGain = settings.inputGain;
+    engine->inputGain1 = settings.inputGain1;
+    engine->outputGain = settings.outputGain;
+    engine->blend = settings.blend;
+    engine->mix = settings.mix;
+    engine->delay = settings.delay;
+    engine->cdelay->delay = settings.delay;
+    engine->normSlotA = settings.normSlotA;
+    engine->normSlotB = settings.normSlotB;
+    engine->phasecor_ = settings.phasecor;
+    engine->conv.set_normalisation(settings.normIrA);
+    engine->conv1.set_normalisation(settings.normIrB);
+
+    // load the models and IR files synchronous in this thread
+    using ratatouille::Command;
+    engine->bufsize = settings.blockSize;
+    engine->commands.push(Command::LOAD_MODEL, 0, 0, settings.modelA.c_str());
+    engine->commands.push(Command::LOAD_MODEL, 1, 0, settings.modelB.c_str());
+    engine->commands.push(Command::LOAD_IR, 0, 0, settings.irA.c_str());
+    engine->commands.push(Command::LOAD_IR, 1, 0, settings.irB.c_str());
+    if (!settings.graph.empty())
+        engine->commands.push(Command::SET_GRAPH, 0, 0, settings.graph.c_str());
+    engine->_execute.store(true, std::memory_order_release);
+    engine->do_work_mono();
+
+    // a file which fail to load leave the target at "None"
+    bool ok = true;
+    const std::pair<const std::string*, const ratatouille::PathState*> loads[] = {
+        {&settings.modelA, &engine->model_file}, {&settings.modelB, &engine->model_file1},
+        {&settings.irA, &engine->ir_file}, {&settings.irB, &engine->ir_file1}};
+    for (const auto& l : loads) {
+        if (*l.first != "None" && l.second->isNone()) {
+            fprintf(stderr, "%s: unable to load %s\n", input.c_str(), l.first->c_str());
+            ok = false;
+        }
+    }
+    if (!settings.graph.empty() && engine->graph_spec.isNone()) {
+        fprintf(stderr, "%s: unable to load the chains %s\n", input.c_str(), settings.graph.c_str());
+        ok = false;
+    }
+    return ok;
+}
+
+bool RenderJob::run() {
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    SNDFILE *in = sf_open(input.c_str(), SFM_READ, &info);
+    if (!in) {
+        fprintf(stderr, "Unable to open %s: %s\n", input.c_str(), sf_strerror(NULL));
+        return false;
+    }
+    // stereo files run through the stereo engine
+    const int channels = std::min(info.channels, 2);
+    if (info.channels > 2)
+        fprintf(stderr, "%s: only taking first two channels of %i channels\n",
+                                            input.c_str(), info.channels);
+
+    output = outputName(settings, input);
+    SF_INFO oinfo;
+    memset(&oinfo, 0, sizeof(oinfo));
+    oinfo.samplerate = info.samplerate;
+    oinfo.channels = channels;
+    oinfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+    SNDFILE *out = sf_open(output.c_str(), SFM_WRITE, &oinfo);
+    if (!out) {
+        fprintf(stderr, "Unable to create %s: %s\n", output.c_str(), sf_strerror(NULL));
+        sf_close(in);
+        return false;
+    }
+
+    ratatouille::Engine *engine = new ratatouille::Engine();
+    engine->channels = channels;
+    if (!setupEngine(engine, info.samplerate)) {
+        sf_close(in);
+        sf_close(out);
+        delete engine;
+        remove(output.c_str());
+        return false;
+    }
+
+    const uint32_t bsize = settings.blockSize;
+    std::vector<float> frames(bsize * std::max(info.channels, channels));
+    std::vector<float> buf(bsize);
+    std::vector<float> buf1(bsize);
+    sf_count_t tailFrames = static_cast<sf_count_t>(settings.tail * info.samplerate);
+    sf_count_t total = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        sf_count_t n = sf_readf_float(in, frames.data(), bsize);
+        if (n <= 0) {
+            if (tailFrames <= 0) break;
+            n = std::min<sf_count_t>(bsize, tailFrames);
+            tailFrames -= n;
+            memset(buf.data(), 0, n * sizeof(float));
+            memset(buf1.data(), 0, n * sizeof(float));
+        } else {
+            for (sf_count_t i = 0; i < n; i++) {
+                buf[i] = frames[i * info.channels];
+                if (channels > 1) buf1[i] = frames[i * info.channels + 1];
+            }
+        }
+        if (channels > 1) {
+            engine->process(static_cast<uint32_t>(n), buf.data(), buf1.data());
+            for (sf_count_t i = 0; i < n; i++) {
+                frames[i * 2] = buf[i];
+                frames[i * 2 + 1] = buf1[i];
+            }
+            sf_writef_float(out, frames.data(), n);
+        } else {
+            engine->process(static_cast<uint32_t>(n), buf.data());
+            sf_writef_float(out, buf.data(), n);
+        }
+        total += n;
+    }
+    double elapsed = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+
+    sf_close(in);
+    sf_close(out);
+    delete engine;
+
+    double duration = static_cast<double>(total) / info.samplerate;
+    fprintf(stdout, "%s -> %s: %.2fs audio in %.2fs, real-time factor %.3f (%.1fx)\n",
+        input.c_str(), output.c_str(), duration, elapsed,
+        duration > 0.0 ? elapsed / duration : 0.0,
+        elapsed > 0.0 ? duration / elapsed : 0.0);
+    return true;
+}
+
+/****************************************************************
+ ** command line handling
+ */
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [options] input.wav [input.wav ...]\n"
+        "  -a, --model-a FILE        neural model for slot A (*.nam, *.json, *.aidax)\n"
+        "  -b, --model-b FILE        neural model for slot B\n"
+        "  -i, --ir FILE             impulse response file A\n"
+        "  -I, --ir1 FILE            impulse response file B\n"
+        "  -c, --chain SPEC          add a parallel chain of serial models and IR files,\n"
+        "                            replaces the slots, e.g. \"pedal.nam@3>amp.nam>cab.wav*0.5\"\n"
+        "                            (@ input gain in dB, * blend weight of the chain)\n"
+        "  -o, --output-dir DIR      write results to DIR (default: next to the input)\n"
+        "  -g, --input-gain dB       input gain slot A (default 0)\n"
+        "  -G, --input-gain1 dB      input gain slot B (default 0)\n"
+        "  -O, --output-gain dB      output gain (default 0)\n"
+        "  -B, --blend VALUE         blend between slot A and B 0..1 (default 0.5)\n"
+        "  -m, --mix VALUE           mix between IR A and B 0..1 (default 0.5)\n"
+        "  -d, --delay SAMPLES       delta delay between slots (default 0)\n"
+        "  -p, --phase-correction    compensate the phase offset between the models\n"
+        "      --norm-a, --norm-b    normalize the loudness of slot A / B\n"
+        "      --norm-ir, --norm-ir1 normalize IR A / B\n"
+        "  -t, --tail SECONDS        render tail after end of input (default 1.0)\n"
+        "  -n, --block-size FRAMES   processing block size (default 256)\n"
+        "  -j, --jobs N              number of parallel jobs (default: all cores)\n"
+        "  -h, --help                show this help\n", name);
+}
+
+enum {
+    OPT_NORM_A = 256,
+    OPT_NORM_B,
+    OPT_NORM_IR,
+    OPT_NORM_IR1
+};
+
+int main(int argc, char *argv[]) {
+    RenderSettings settings;
+
+    static struct option long_options[] = {
+        {"model-a",          required_argument, 0, 'a'},
+        {"model-b",          required_argument, 0, 'b'},
+        {"ir",               required_argument, 0, 'i'},
+        {"ir1",              required_argument, 0, 'I'},
+        {"chain",            required_argument, 0, 'c'},
+        {"output-dir",       required_argument, 0, 'o'},
+        {"input-gain",       required_argument, 0, 'g'},
+        {"input-gain1",      required_argument, 0, 'G'},
+        {"output-gain",      required_argument, 0, 'O'},
+        {"blend",            required_argument, 0, 'B'},
+        {"mix",              required_argument, 0, 'm'},
+        {"delay",            required_argument, 0, 'd'},
+        {"phase-correction", no_argument,       0, 'p'},
+        {"norm-a",           no_argument,       0, OPT_NORM_A},
+        {"norm-b",           no_argument,       0, OPT_NORM_B},
+        {"norm-ir",          no_argument,       0, OPT_NORM_IR},
+        {"norm-ir1",         no_argument,       0, OPT_NORM_IR1},
+        {"tail",             required_argument, 0, 't'},
+        {"block-size",       required_argument, 0, 'n'},
+        {"jobs",             required_argument, 0, 'j'},
+        {"help",             no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "a:b:i:I:c:o:g:G:O:B:m:d:pt:n:j:h",
+                                        long_options, NULL)) != -1) {
+        switch (c) {
+            case 'a': settings.modelA = optarg; break;
+            case 'b': settings.modelB = optarg; break;
+            case 'i': settings.irA = optarg; break;
+            case 'I': settings.irB = optarg; break;
+            case 'c':
+                if (!settings.graph.empty()) settings.graph += ";";
+                settings.graph += optarg;
+                break;
+            case 'o': settings.outDir = optarg; break;
+            case 'g': settings.inputGain = std::clamp(atof(optarg), -20.0, 20.0); break;
+            case 'G': settings.inputGain1 = std::clamp(atof(optarg), -20.0, 20.0); break;
+            case 'O': settings.outputGain = std::clamp(atof(optarg), -20.0, 20.0); break;
+            case 'B': settings.blend = std::clamp(atof(optarg), 0.0, 1.0); break;
+            case 'm': settings.mix = std::clamp(atof(optarg), 0.0, 1.0); break;
+            case 'd': settings.delay = std::clamp(atof(optarg), -4096.0, 4096.0); break;
+            case 'p': settings.phasecor = 1.0; break;
+            case OPT_NORM_A: settings.normSlotA = 1; break;
+            case OPT_NORM_B: settings.normSlotB = 1; break;
+            case OPT_NORM_IR: settings.normIrA = 1; break;
+            case OPT_NORM_IR1: settings.normIrB = 1; break;
+            case 't': settings.tail = std::max(0.0, atof(optarg)); break;
+            case 'n': settings.blockSize = std::clamp(atoi(optarg), 16, 8192); break;
+            case 'j': settings.jobs = std::max(1, atoi(optarg)); break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (settings.modelA == "None" && settings.modelB == "None" &&
+        settings.irA == "None" && settings.irB == "None" && settings.graph.empty()) {
+        fprintf(stderr, "Nothing to render, load at least one model or IR file\n");
+        return 1;
+    }
+    if (!settings.outDir.empty()) {
+        #if defined(_WIN32)
+        if (mkdir(settings.outDir.c_str()) != 0 && errno != EEXIST) {
+        #else
+        if (mkdir(settings.outDir.c_str(), 0755) != 0 && errno != EEXIST) {
+        #endif
+            fprintf(stderr, "Unable to create %s\n", settings.outDir.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<std::string> files(argv + optind, argv + argc);
+    // two inputs with the same base name would overwrite each others output
+    std::map<std::string, std::string> outputs;
+    for (const std::string& f : files) {
+        auto r = outputs.emplace(outputName(settings, f), f);
+        if (!r.second) {
+            fprintf(stderr, "%s and %s both render to %s\n",
+                    r.first->second.c_str(), f.c_str(), r.first->first.c_str());
+            return 1;
+        }
+    }
+    uint32_t jobs = settings.jobs ? settings.jobs
+                    : std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min<uint32_t>(jobs, files.size());
+
+    // hand out the files to the workers
+    std::atomic<size_t> next(0);
+    std::atomic<int> failed(0);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t j = 0; j < jobs; j++) {
+        workers.emplace_back([&]() {
+            size_t i;
+            while ((i = next.fetch_add(1)) < files.size()) {
+                RenderJob job(settings, files[i]);
+                if (!job.run()) failed.fetch_add(1);
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    double elapsed = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+
+    fprintf(stdout, "rendered %zu file(s) with %u job(s) in %.2fs, %i failed\n",
+                        files.size() - failed.load(), jobs, elapsed, failed.load());
+    const ratatouille::ModelCache::Stats cs = ratatouille::ModelCache::get().stats();
+    fprintf(stdout, "model cache: %llu hit(s), %llu miss(es), %zu of %zu kB used\n",
+                        static_cast<unsigned long long>(cs.hits),
+                        static_cast<unsigned long long>(cs.misses),
+                        cs.bytes / 1024, cs.limit / 1024);
+    return failed.load() ? 1 : 0;
+}
@@ -81,6 +81,16 @@ public:
         #endif
    }
 
+    // set the maximal block size before init the engine
+    void setMaxBufferSize(uint32_t frames) {
+        engine.maxbufsize = frames;
+    }
+
+    // 1 = mono, 2 = stereo, must be set before initEngine()
+    void setChannels(uint32_t channels) {
+        engine.channels = channels;
+    }
+
     void initEngine(uint32_t rate, int32_t prio, int32_t policy) {
         engine.init(rate, prio, policy);
         s_time = (1.0 / (double)rate) * 1000;
@@ -96,6 +106,10 @@ public:
         engine.process(n_samples, output);
     }
 
+    inline void process(uint32_t n_samples, float* output, float* output1) {
+        engine.process(n_samples, output, output1);
+    }
+
     // send value changes from GUI to the engine
     void sendValueChanged(int port, float value) {
         settingsHaveChanged = true;
@@ -122,20 +136,14 @@ public:
             break;
             case 9:
             {
-                engine._cd.fetch_add(1, std::memory_order_relaxed);
-                engine.conv.set_normalisation(static_cast<uint32_t>(value));
-                if (engine.ir_file.compare("None") != 0) {
-                    workToDo.store(true, std::memory_order_release);
-                }
+                engine.commands.push(ratatouille::Command::NORMALISE_IR, 0, static_cast<int32_t>(value));
+                workToDo.store(true, std::memory_order_release);
             }
             break;
             case 10:
             {
-                engine._cd.fetch_add(2, std::memory_order_relaxed);
-                engine.conv1.set_normalisation(static_cast<uint32_t>(value));
-                if (engine.ir_file1.compare("None") != 0) {
-                    workToDo.store(true, std::memory_order_release);
-                }
+                engine.commands.push(ratatouille::Command::NORMALISE_IR, 1, static_cast<int32_t>(value));
+                workToDo.store(true, std::memory_order_release);
             }
             break;
             case 11:
@@ -152,29 +160,25 @@ public:
             break;
             case 15:
             {
-                engine._ab.fetch_add(1, std::memory_order_relaxed);
-                engine.model_file = "None";
+                engine.commands.push(ratatouille::Command::ERASE_MODEL, 0, 0);
                 workToDo.store(true, std::memory_order_release);
             }
             break;
             case 16:
             {
-                engine._ab.fetch_add(2, std::memory_order_relaxed);
-                engine.model_file1 = "None";
+                engine.commands.push(ratatouille::Command::ERASE_MODEL, 1, 0);
                 workToDo.store(true, std::memory_order_release);
              }
             break;
             case 17:
             {
-                engine._cd.fetch_add(1, std::memory_order_relaxed);
-                engine.ir_file = "None";
+                engine.commands.push(ratatouille::Command::ERASE_IR, 0, 0);
                 workToDo.store(true, std::memory_order_release);
             }
             break;
             case 18:
             {
-                engine._cd.fetch_add(2, std::memory_order_relaxed);
-                engine.ir_file1 = "None";
+                engine.commands.push(ratatouille::Command::ERASE_IR, 1, 0);
                 workToDo.store(true, std::memory_order_release);
             }
             break;
@@ -201,38 +205,38 @@ public:
         if ((strcmp(m->filename, "None") == 0)) {
             if (old == 1) {
                 if ( m == &ps->ma) {
-                    engine.model_file = m->filename;
-                    engine._ab.fetch_add(1, std::memory_order_relaxed);
+                    engine.commands.push(ratatouille::Command::LOAD_MODEL, 0,
+                        ratatouille::Command::INTERACTIVE, m->filename);
                 } else {
-                    engine.model_file1 = m->filename;
-                    engine._ab.fetch_add(2, std::memory_order_relaxed);
+                    engine.commands.push(ratatouille::Command::LOAD_MODEL, 1,
+                        ratatouille::Command::INTERACTIVE, m->filename);
                 }
             } else if (old == 2) {
                 if ( m == &ps->ir) {
-                    engine.ir_file = m->filename;
-                    engine._cd.fetch_add(1, std::memory_order_relaxed);
+                    engine.commands.push(ratatouille::Command::LOAD_IR, 0,
+                        ratatouille::Command::INTERACTIVE, m->filename);
                 } else {
-                    engine.ir_file1 = m->filename;
-                    engine._cd.fetch_add(2, std::memory_order_relaxed);
+                    engine.commands.push(ratatouille::Command::LOAD_IR, 1,
+                        ratatouille::Command::INTERACTIVE, m->filename);
                 }
             } else return;
         } else if (ends_with(m->filename, "nam") ||
                    ends_with(m->filename, "json") ||
                    ends_with(m->filename, "aidax")) {
             if ( m == &ps->ma) {
-                engine.model_file = m->filename;
-                engine._ab.fetch_add(1, std::memory_order_relaxed);
+                engine.commands.push(ratatouille::Command::LOAD_MODEL, 0,
+                        ratatouille::Command::INTERACTIVE, m->filename);
             } else {
-                engine.model_file1 = m->filename;
-                engine._ab.fetch_add(2, std::memory_order_relaxed);
+                engine.commands.push(ratatouille::Command::LOAD_MODEL, 1,
+                        ratatouille::Command::INTERACTIVE, m->filename);
             }
         } else if (ends_with(m->filename, "wav")) {
             if ( m == &ps->ir) {
-                engine.ir_file = m->filename;
-                engine._cd.fetch_add(1, std::memory_order_relaxed);
+                engine.commands.push(ratatouille::Command::LOAD_IR, 0,
+                        ratatouille::Command::INTERACTIVE, m->filename);
             } else {
-                engine.ir_file1 = m->filename;
-                engine._cd.fetch_add(2, std::memory_order_relaxed);
+                engine.commands.push(ratatouille::Command::LOAD_IR, 1,
+                        ratatouille::Command::INTERACTIVE, m->filename);
             }
         } else return;
         settingsHaveChanged = true;
@@ -260,17 +264,15 @@ public:
                                 buf >> value;
                             }
                         } else if (key.compare("[Model]") == 0) {
-                            engine.model_file = remove_sub(line, "[Model] ");
-                            engine._ab.fetch_add(1, std::memory_order_relaxed);
+                            engine.commands.push(ratatouille::Command::LOAD_MODEL, 0, 0, remove_sub(line, "[Model] ").c_str());
                         } else if (key.compare("[Model1]") == 0) {
-                            engine.model_file1 = remove_sub(line, "[Model1] ");
-                            engine._ab.fetch_add(2, std::memory_order_relaxed);
+                            engine.commands.push(ratatouille::Command::LOAD_MODEL, 1, 0, remove_sub(line, "[Model1] ").c_str());
                         } else if (key.compare("[IrFile]") == 0) {
-                            engine.ir_file = remove_sub(line, "[IrFile] ");
-                            engine._cd.fetch_add(1, std::memory_order_relaxed);
+                            engine.commands.push(ratatouille::Command::LOAD_IR, 0, 0, remove_sub(line, "[IrFile] ").c_str());
                         } else if (key.compare("[IrFile1]") == 0) {
-                            engine.ir_file1 = remove_sub(line, "[IrFile1] ");
-                            engine._cd.fetch_add(2, std::memory_order_relaxed);
+                            engine.commands.push(ratatouille::Command::LOAD_IR, 1, 0, remove_sub(line, "[IrFile1] ").c_str());
+                        } else if (key.compare("[Graph]") == 0) {
+                            engine.commands.push(ratatouille::Command::SET_GRAPH, 0, 0, remove_sub(line, "[Graph] ").c_str());
                         }
                     }
                     key.clear();
@@ -347,10 +349,11 @@ private:
                 outfile << adj_get_value(ui->widget[i]->adj) << " ";
             }
             outfile << std::endl;
-            outfile << "[Model] " << engine.model_file << std::endl;
-            outfile << "[Model1] " << engine.model_file1 << std::endl;
-            outfile << "[IrFile] " << engine.ir_file << std::endl;
-            outfile << "[IrFile1] " << engine.ir_file1 << std::endl;
+            outfile << "[Model] " << engine.model_file.str() << std::endl;
+            outfile << "[Model1] " << engine.model_file1.str() << std::endl;
+            outfile << "[IrFile] " << engine.ir_file.str() << std::endl;
+            outfile << "[IrFile1] " << engine.ir_file1.str() << std::endl;
+            outfile << "[Graph] " << engine.graph_spec.str() << std::endl;
             outfile.close();
         }
     }
@@ -420,21 +423,48 @@ private:
             XLockDisplay(ui->main.dpy);
             #endif
             X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
-            get_file(engine.model_file, &ps->ma);
-            get_file(engine.model_file1, &ps->mb);
-            get_file(engine.ir_file, &ps->ir);
-            get_file(engine.ir_file1, &ps->ir1);
+            get_file(engine.model_file.str(), &ps->ma);
+            get_file(engine.model_file1.str(), &ps->mb);
+            get_file(engine.ir_file.str(), &ps->ir);
+            get_file(engine.ir_file1.str(), &ps->ir1);
             adj_set_value(ui->widget[17]->adj,(float) engine.latency * s_time);
             adj_set_value(ui->widget[18]->adj,(float) engine.XrunCounter);
             expose_widget(ui->win);
-            engine._ab.store(0, std::memory_order_release);
-            engine._cd.store(0, std::memory_order_release);
             #if defined(__linux__) || defined(__FreeBSD__) || \
                 defined(__NetBSD__) || defined(__OpenBSD__)
             XFlush(ui->main.dpy);
             XUnlockDisplay(ui->main.dpy);
             #endif
         }
+        // update stage timing display
+        #if defined(__linux__) || defined(__FreeBSD__) || \
+            defined(__NetBSD__) || defined(__OpenBSD__)
+        XLockDisplay(ui->main.dpy);
+        #endif
+        getTiming();
+        #if defined(__linux__) || defined(__FreeBSD__) || \
+            defined(__NetBSD__) || defined(__OpenBSD__)
+        XFlush(ui->main.dpy);
+        XUnlockDisplay(ui->main.dpy);
+        #endif
+    }
+
+    // copy the published stage timing from the engine to the GUI
+    void getTiming() {
+        X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+        for (uint32_t s = 0; s < ratatouille::StageProfiler::STAGES; s++) {
+            for (uint32_t v = 0; v < ratatouille::StageProfiler::VALUES; v++) {
+                ps->timing[s * PROFILE_VALUES + v] =
+                    engine.profiler.stats[s][v].load(std::memory_order_relaxed);
+            }
+        }
+        for (uint32_t c = 0; c < CACHE_VALUES; c++)
+            ps->cache[c] = engine.cacheStats[c].load(std::memory_order_relaxed);
+        // output only, don't send the value back to the engine
+        xevfunc store = ui->widget[19]->func.value_changed_callback;
+        ui->widget[19]->func.value_changed_callback = dummy_callback;
+        adj_set_value(ui->widget[19]->adj, ps->timing[PROFILE_PERIOD_P99 - PROFILE_PORT]);
+        ui->widget[19]->func.value_changed_callback = store;
     }
 
 };
@@ -19,6 +19,8 @@
 jack_client_t *client;
 jack_port_t *in_port;
 jack_port_t *out_port;
+jack_port_t *in_port1 = nullptr;
+jack_port_t *out_port1 = nullptr;
 
 void jack_shutdown (void *arg) {
     fprintf (stderr, "jack shutdown, exit now \n");
@@ -34,6 +36,7 @@ int jack_srate_callback(jack_nframes_t samplerate, void* arg) {
     int prio = jack_client_real_time_priority(client);
     if (prio < 0) prio = 25;
     fprintf (stderr, "Samplerate %iHz \n", samplerate);
+    r->setMaxBufferSize(jack_get_buffer_size(client));
     r->initEngine(samplerate, prio, 1);
     return 0;
 }
@@ -50,7 +53,15 @@ int jack_process(jack_nframes_t nframes, void *arg) {
     if(output != input)
         memcpy(output, input, nframes*sizeof(float));
 
-    r->process(nframes, output);
+    if (in_port1 && out_port1) {
+        float *input1 = static_cast<float *>(jack_port_get_buffer (in_port1, nframes));
+        float *output1 = static_cast<float *>(jack_port_get_buffer (out_port1, nframes));
+        if(output1 != input1)
+            memcpy(output1, input1, nframes*sizeof(float));
+        r->process(nframes, output, output1);
+    } else {
+        r->process(nframes, output);
+    }
 
     return 0;
 }
@@ -67,6 +78,12 @@ void startJack() {
                        client, "in_0", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
         out_port = jack_port_register(
                        client, "out_0", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        if (channels > 1) {
+            in_port1 = jack_port_register(
+                       client, "in_1", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+            out_port1 = jack_port_register(
+                       client, "out_1", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        }
 
         jack_set_xrun_callback(client, jack_xrun_callback, 0);
         jack_set_sample_rate_callback(client, jack_srate_callback, 0);
@@ -95,6 +112,14 @@ void quitJack() {
         jack_port_unregister(client,in_port);
         if (jack_port_connected(out_port)) jack_port_disconnect(client,out_port);
         jack_port_unregister(client,out_port);
+        if (in_port1) {
+            if (jack_port_connected(in_port1)) jack_port_disconnect(client,in_port1);
+            jack_port_unregister(client,in_port1);
+        }
+        if (out_port1) {
+            if (jack_port_connected(out_port1)) jack_port_disconnect(client,out_port1);
+            jack_port_unregister(client,out_port1);
+        }
         jack_client_close (client);
     }    
 }
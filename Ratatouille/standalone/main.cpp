@@ -24,6 +24,8 @@
 #include "Ratatouille.cc"
 
 Ratatouille *r;
+// run both channels through the engine, set by --stereo
+uint32_t channels = 1;
 
 #if defined(HAVE_JACK)
 #include "jack.cc"
@@ -52,7 +54,15 @@ static int process(const void* inputBuffer, void* outputBuffer,
     if(output != input)
         memcpy(output, input, nframes*sizeof(float));
 
-    r->process(nframes, output);
+    if (channels > 1) {
+        const float* input1 = ((const float**)inputBuffer)[1];
+        float* output1 = ((float**)outputBuffer)[1];
+        if(output1 != input1)
+            memcpy(output1, input1, nframes*sizeof(float));
+        r->process(nframes, output, output1);
+    } else {
+        r->process(nframes, output);
+    }
 
     return 0;
 }
@@ -88,7 +98,11 @@ int main(int argc, char *argv[]){
     #if defined(HAVE_PA)
     bool runPA = false;
     #endif
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--stereo")) channels = 2;
+    }
     r = new Ratatouille();
+    r->setChannels(channels);
     r->startGui();
 
     #if defined(__linux__) || defined(__FreeBSD__) || \
@@ -101,7 +115,7 @@ int main(int argc, char *argv[]){
 
     #if defined(HAVE_PA)
     XPa xpa ("Ratatouille");
-    if(!xpa.openStream(1, 1, &process, nullptr)) {
+    if(!xpa.openStream(channels, channels, &process, nullptr)) {
         #if defined(HAVE_JACK)
         startJack();
         #else    
@@ -125,6 +125,9 @@ static intptr_t dispatcher(AEffect* effect, int32_t opCode, int32_t index, intpt
         case effGetParamName:
             getParameterName(effect, index, (char*)ptr);
             break;
+        case effSetBlockSize:
+            plug->r->setMaxBufferSize((uint32_t)value);
+            break;
         case effSetSampleRate:
             plug->SampleRate = opt;
             plug->r->initEngine((uint32_t)plug->SampleRate, 25, 1);